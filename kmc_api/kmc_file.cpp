@@ -194,6 +194,10 @@ bool CKMCFile::ReadParamsFrom_prefix_file_buf(uint64 &size)
 	result = fread(&max_count, 1, sizeof(uint32), file_pre);
 	original_max_count = max_count;
 	result = fread(&total_kmers, 1, sizeof(uint64), file_pre);
+	uint32 tmp_order;
+	result = fread(&tmp_order, 1, sizeof(uint32), file_pre);		// 0 in the databases with lexicographic order
+	sig_order = (signature_order) tmp_order;
+	CMmer::prepare(signature_len, sig_order);
 
 	signature_map_size = ((1 << (2 * signature_len)) + 1);
 	uint64 lut_area_size_in_bytes = size - (signature_map_size * sizeof(uint32) + header_offset + 8);
@@ -233,7 +237,7 @@ bool CKMCFile::CheckKmer(CKmerAPI &kmer, float &count)
 	if(end_of_file)
 		return false;
 	
-	uint32 signature = kmer.get_signature(signature_len);
+	uint32 signature = kmer.get_signature(signature_len, sig_order);
 	
 	uint32 bin_start_pos = signature_map[signature];
 	bin_start_pos *= single_LUT_size;
@@ -42,6 +42,7 @@ class CKMCFile
 	uint32 counter_size;
 	uint32 lut_prefix_length;
 	uint32 signature_len;
+	signature_order sig_order;
 	uint32 min_count;
 	uint32 max_count;
 	uint64 total_kmers;
@@ -507,12 +507,13 @@ public:
 //-----------------------------------------------------------------------
 // Counts a signature of an existing kmer
 // IN	: sig_len	- the length of a signature
+//		  sig_order	- the order of signatures
 // RET	: signature value
 //-----------------------------------------------------------------------
-	 uint32 get_signature(uint32 sig_len)
+	 uint32 get_signature(uint32 sig_len, signature_order sig_order = sig_lexicographic)
 	 {
 		 uchar symb;
-		 CMmer cur_mmr(sig_len);
+		 CMmer cur_mmr(sig_len, sig_order);
 		 
 		 for(uint32 i = 0; i < sig_len; ++i)
 		 {
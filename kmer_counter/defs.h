@@ -33,10 +33,31 @@
 
 #define STATS_FASTQ_SIZE (1 << 28)
 
+// Size of the windows of uncompressed files sampled in stage 0
+#define STATS_WINDOW_SIZE (1 << 20)
+
+#define INPUT_RANGE_SIZE (1ull << 30)
+
 #define EXPAND_BUFFER_RECS (1 << 16)
 
+// Size of chunks of compressed temporary files
+#define TMP_CHUNK_SIZE (1 << 20)
+
+// Size of the buffer of a writer of temporary files
+#define TMP_WRITE_BUFFER_SIZE (1 << 22)
+
+// Alignment of addresses, sizes and offsets of direct (O_DIRECT) writes
+#define DIRECT_IO_ALIGNMENT (1 << 12)
+
+// Step of preallocation of the single-file store of temporary bins
+#define TMP_STORE_GROWTH (1ull << 30)
 
-#define MAX_BINS 512
+
+#define DEFAULT_N_BINS	512
+
+// Range of number of bins
+#define MIN_N_BINS	64
+#define MAX_N_BINS	16384
 
 
 #ifndef MAX_K
@@ -53,7 +74,7 @@
 
 // Range of number of signature length
 #define MIN_SL		5
-#define MAX_SL		8
+#define MAX_SL		12
 
 // Range of number of splitting threads
 #define MIN_SP		1
@@ -67,6 +88,18 @@
 #define MIN_SR		1
 #define MAX_SR		16
 
+// Range of number of decompression threads per single reading thread (multi-member gzip files)
+#define MIN_SZ		1
+#define MAX_SZ		32
+
+// Range of number of threads writing temporary files
+#define MIN_SW		1
+#define MAX_SW		32
+
+// Range of number of threads reading bins (per working directory) in stage 2
+#define MIN_SB		1
+#define MAX_SB		32
+
 
 typedef float	count_t;
 
@@ -86,6 +119,7 @@ typedef float	count_t;
 #define my_fopen	fopen
 #define my_fseek	_fseeki64
 #define my_ftell	_ftelli64
+typedef unsigned short uint16;
 typedef int int32;
 typedef unsigned int uint32;
 typedef long long int64;
@@ -100,6 +134,7 @@ typedef unsigned long long uint64;
 #define _TCHAR	char
 #define _tmain	main
 
+typedef unsigned short uint16;
 typedef int int32;
 typedef unsigned int uint32;
 typedef long long int64;
@@ -13,6 +13,12 @@
 #include <boost/filesystem.hpp>
 #include "defs.h"
 #include "fastq_reader.h"
+#include "libs/asmlib.h"
+
+#ifdef WIN32
+#include <io.h>
+#include <fcntl.h>
+#endif
 
 //************************************************************************************************************
 // CFastqReader	- reader class
@@ -24,7 +30,7 @@ uint64 CFastqReader::OVERHEAD_SIZE = 1 << 16;
 // Constructor of FASTA/FASTQ reader
 // Parameters:
 //    * _mm - pointer to memory monitor (to check the memory limits)
-CFastqReader::CFastqReader(CMemoryMonitor *_mm, CMemoryPool *_pmm_fastq, input_type _file_type, uint32 _gzip_buffer_size, uint32 _bzip2_buffer_size, int _kmer_len)
+CFastqReader::CFastqReader(CMemoryMonitor *_mm, CMemoryPool *_pmm_fastq, input_type _file_type, uint32 _gzip_buffer_size, uint32 _bzip2_buffer_size, uint32 _gzip_threads, int _kmer_len)
 {
 	mm		  = _mm;
 	pmm_fastq = _pmm_fastq;
@@ -33,19 +39,33 @@ CFastqReader::CFastqReader(CMemoryMonitor *_mm, CMemoryPool *_pmm_fastq, input_t
 	kmer_len = _kmer_len;
 	// Input file mode (default: uncompressed)
 	mode      = m_plain;
+	stream	  = false;
 
 	// Pointers to input files in various formats (uncompressed, gzip-compressed, bzip2-compressed)
 	in		  = NULL;
 	in_gzip   = NULL;
+	in_gzip_blocks = NULL;
+	in_gzip_spec   = NULL;
 	in_bzip2  = NULL;
 	bzerror   = BZ_OK;
 
+	// Memory mapping of uncompressed files (disabled by default)
+	mapped			   = NULL;
+	max_mapped_parts   = 0;
+	mapped_free_behind = false;
+
+	// Whole file by default
+	range_begin = 0;
+	range_end   = CInputFilesQueue::FILE_END;
+	range_pos   = 0;
+
 	// Size and pointer for the buffer
 	part_size = 1 << 23;
 	part      = NULL;
 
 	gzip_buffer_size  = _gzip_buffer_size;
 	bzip2_buffer_size = _bzip2_buffer_size;
+	gzip_threads      = _gzip_threads;
 
 	containsNextChromosome = false;
 }
@@ -58,12 +78,24 @@ CFastqReader::~CFastqReader()
 	{
 		if(in)
 			fclose(in);
+		if(mapped)
+			mapped->Detach();
 	}
 	else if(mode == m_gzip)
 	{
 		if(in_gzip)
 			gzclose(in_gzip);
 	}
+	else if(mode == m_gzip_blocks)
+	{
+		if(in_gzip_blocks)
+			delete in_gzip_blocks;
+	}
+	else if(mode == m_gzip_spec)
+	{
+		if(in_gzip_spec)
+			delete in_gzip_spec;
+	}
 	else if(mode == m_bzip2)
 	{
 		if(in)
@@ -82,6 +114,7 @@ CFastqReader::~CFastqReader()
 bool CFastqReader::SetNames(string _input_file_name)
 {
 	input_file_name = _input_file_name;
+	stream			= CInputFilesQueue::IsStream(input_file_name);
 
 	// Set mode according to the extension of the file name
 	if(input_file_name.size() > 3 && string(input_file_name.end()-3, input_file_name.end()) == ".gz")
@@ -98,7 +131,7 @@ bool CFastqReader::SetNames(string _input_file_name)
 // Set part size of the buffer
 bool CFastqReader::SetPartSize(uint64 _part_size)
 {
-	if(in || in_gzip || in_bzip2)
+	if(in || in_gzip || in_gzip_blocks || in_gzip_spec || in_bzip2 || mapped)
 		return false;
 
 	if(_part_size < (1 << 20) || _part_size > (1 << 30))
@@ -109,25 +142,99 @@ bool CFastqReader::SetPartSize(uint64 _part_size)
 	return true;
 }
 
+//----------------------------------------------------------------------------------
+// Allow passing views of memory mapped uncompressed files to the splitters
+void CFastqReader::SetMapping(uint32 _max_mapped_parts, bool _free_behind)
+{
+	max_mapped_parts   = _max_mapped_parts;
+	mapped_free_behind = _free_behind;
+}
+
+//----------------------------------------------------------------------------------
+// Set the byte range of an uncompressed file to process
+void CFastqReader::SetRange(uint64 _range_begin, uint64 _range_end)
+{
+	range_begin = _range_begin;
+	range_end   = _range_end;
+}
+
 //----------------------------------------------------------------------------------
 // Open the file
 bool CFastqReader::OpenFiles()
 {
-	if(in || in_gzip || in_bzip2)
+	if(in || in_gzip || in_gzip_blocks || in_gzip_spec || in_bzip2 || mapped)
 		return false;
 
 	// Uncompressed file
 	if(mode == m_plain)	
 	{
-		if((in = fopen(input_file_name.c_str(), "rb")) == NULL)
+		// Multi line FASTA files are modified in a buffer, so they cannot be mapped
+		if(max_mapped_parts && file_type != multiline_fasta && !stream)
+			mapped = CMappedFile::Open(input_file_name, max_mapped_parts, mapped_free_behind);
+
+		if(input_file_name == "-")
+		{
+#ifdef WIN32
+			_setmode(_fileno(stdin), _O_BINARY);
+#endif
+			in = stdin;
+		}
+		else if(!mapped && (in = fopen(input_file_name.c_str(), "rb")) == NULL)
 			return false;
+
+		// The range is moved to the starts of the records, so the neighbouring ranges do not overlap
+		if(range_begin || range_end != CInputFilesQueue::FILE_END)
+		{
+			range_begin = FindRangeBoundary(range_begin);
+			range_end   = FindRangeBoundary(range_end);
+			if(in)
+				my_fseek(in, range_begin, SEEK_SET);
+		}
+		range_pos = range_begin;
+
+		if(mapped)
+			return true;
 	}
 	// Gzip-compressed file
 	else if(mode == m_gzip)
 	{
-		if((in_gzip = gzopen(input_file_name.c_str(), "rb")) == NULL)
-			return false;
-		gzbuffer(in_gzip, gzip_buffer_size);
+		// Files consisting of many members (e.g., BGZF) are decompressed by several threads
+		// (the layout of a stream cannot be checked as it cannot be read twice)
+		CGzBlockReader::t_layout layout = stream ? CGzBlockReader::gl_single : CGzBlockReader::CheckLayout(input_file_name);
+		if(layout != CGzBlockReader::gl_single)
+		{
+			mode = m_gzip_blocks;
+			in_gzip_blocks = new CGzBlockReader(gzip_threads);
+			if(!in_gzip_blocks->Open(input_file_name, layout))
+			{
+				delete in_gzip_blocks;
+				in_gzip_blocks = NULL;
+				return false;
+			}
+		}
+		else
+		{
+			// Large single-stream files are decompressed speculatively by several threads
+			boost::system::error_code ec;
+			if(gzip_threads > 1 && !stream && boost::filesystem::file_size(input_file_name, ec) >= CGzSpecReader::MIN_FILE_SIZE && !ec)
+			{
+				in_gzip_spec = new CGzSpecReader(gzip_threads);
+				if(in_gzip_spec->Open(input_file_name))
+					mode = m_gzip_spec;
+				else
+				{
+					delete in_gzip_spec;
+					in_gzip_spec = NULL;
+				}
+			}
+
+			if(mode == m_gzip)
+			{
+				if((in_gzip = gzopen(input_file_name.c_str(), "rb")) == NULL)
+					return false;
+				gzbuffer(in_gzip, gzip_buffer_size);
+			}
+		}
 	}
 	// Bzip2-compressed file
 	else if(mode == m_bzip2)
@@ -161,12 +268,7 @@ bool CFastqReader::GetPartFromMultilneFasta(uchar *&_part, uint64 &_size)
 			if(IsEof())
 				return false;
 		}
-		if(mode == m_plain)
-			readed = fread(part+part_filled, 1, part_size-part_filled, in);
-		else if(mode == m_gzip)
-			readed = gzread(in_gzip, part+part_filled, (int) (part_size-part_filled));
-		else if(mode == m_bzip2)
-			readed = BZ2_bzRead(&bzerror, in_bzip2, part+part_filled, (int) (part_size-part_filled));
+		readed = ReadData(part+part_filled, part_size-part_filled);
 		int64 total_filled = part_filled + readed;
 		int64 last_header_pos = 0;
 		int64 pos = 0;
@@ -208,9 +310,14 @@ bool CFastqReader::GetPartFromMultilneFasta(uchar *&_part, uint64 &_size)
 
 //----------------------------------------------------------------------------------
 // Read a part of the file
-bool CFastqReader::GetPart(uchar *&_part, uint64 &_size)
+bool CFastqReader::GetPart(uchar *&_part, uint64 &_size, CMappedFile *&_mapped)
 {
-	if(!in && !in_gzip && !in_bzip2)
+	_mapped = NULL;
+
+	if(mapped)
+		return GetMappedPart(_part, _size, _mapped);
+
+	if(!in && !in_gzip && !in_gzip_blocks && !in_gzip_spec && !in_bzip2)
 		return false;
 
 	
@@ -223,17 +330,9 @@ bool CFastqReader::GetPart(uchar *&_part, uint64 &_size)
 	uint64 readed;
 	
 	// Read data
-	if(mode == m_plain)
-		readed = fread(part+part_filled, 1, part_size, in);
-	else if(mode == m_gzip)
-		readed = gzread(in_gzip, part+part_filled, (int) part_size);
-	else if(mode == m_bzip2)
-		readed = BZ2_bzRead(&bzerror, in_bzip2, part+part_filled, (int) part_size);
-	else
-		readed = 0;				// Never should be here
+	readed = ReadData(part+part_filled, part_size);
 
 	int64 total_filled = part_filled + readed;
-	int64 i;
 
 	if(part_filled >= OVERHEAD_SIZE)
 	{
@@ -250,95 +349,212 @@ bool CFastqReader::GetPart(uchar *&_part, uint64 &_size)
 		return true;
 	}
 	
-	// Look for the end of the last complete record in a buffer
+	_part = part;
+	_size = FindRecordStart(part, total_filled - OVERHEAD_SIZE / 2, total_filled);
+
+	// Allocate new memory for the buffer
+
+	pmm_fastq->reserve(part);
+	copy(_part+_size, _part+total_filled, part);
+	part_filled = total_filled - _size;
+
+	return true;
+}
+
+//----------------------------------------------------------------------------------
+// Return a view of the next part of the memory mapped file
+bool CFastqReader::GetMappedPart(uchar *&_part, uint64 &_size, CMappedFile *&_mapped)
+{
+	uint64 end = MIN(range_end, mapped->Size());
+	if(range_pos >= end)
+		return false;
+
+	uint64 rest = end - range_pos;
+
+	// The last part is copied to a regular buffer, as the splitters can look a few bytes past the end of a truncated record
+	if(rest <= part_size && end == mapped->Size())
+	{
+		pmm_fastq->reserve(_part);
+		A_memcpy(_part, mapped->Data() + range_pos, rest);
+		_size = rest;
+		range_pos += rest;
+
+		return true;
+	}
+
+	if(rest <= part_size)
+		_size = rest;
+	else
+		_size = FindRecordStart(mapped->Data() + range_pos, part_size - OVERHEAD_SIZE / 2, part_size);
+	if(!_size)
+	{
+		cout << "Error: Wrong input file!\n";
+		exit(1);
+	}
+
+	_part = mapped->GetView(range_pos, _size);
+	_mapped = mapped;
+	range_pos += _size;
+
+	return true;
+}
+
+//----------------------------------------------------------------------------------
+// Look for the first record starting after the position in a buffer (0 if not found)
+uint64 CFastqReader::FindRecordStart(uchar *buf, int64 pos, int64 total_filled)
+{
+	int64 i;
+
 	if(file_type == fasta)			// FASTA files
 	{
-		// Looking for a FASTA record at the end of the area
+		// Looking for a FASTA record
 		int64 line_start[3];
 		int32 j;
 
-		i = total_filled - OVERHEAD_SIZE / 2;
+		i = pos;
 		for(j = 0; j < 3; ++j)
 		{
-			if(!SkipNextEOL(part, i, total_filled))
+			if(!SkipNextEOL(buf, i, total_filled))
 				break;
 			line_start[j] = i;
 		}
 
-		_part = part;
 		if(j < 3)
-			_size = 0;
-		else
-		{
-			int k;
-			for(k = 0; k < 2; ++k)
-				if(part[line_start[k]+0] == '>')
-					break;
+			return 0;
 
-			if(k == 2)
-				_size = 0;
-			else
-				_size = line_start[k];
-		}	
+		int k;
+		for(k = 0; k < 2; ++k)
+			if(buf[line_start[k]+0] == '>')
+				break;
+
+		if(k == 2)
+			return 0;
+		return line_start[k];
 	}
 	else			// FASTQ file
 	{
-		// Looking for a FASTQ record at the end of the area
+		// Looking for a FASTQ record
 		int64 line_start[9];
 		int32 j;
 
-		i = total_filled - OVERHEAD_SIZE / 2;
+		i = pos;
 		for(j = 0; j < 9; ++j)
 		{
-			if(!SkipNextEOL(part, i, total_filled))
+			if(!SkipNextEOL(buf, i, total_filled))
 				break;
 			line_start[j] = i;
 		}
 
-		_part = part;
 		if(j < 9)
-			_size = 0;
-		else
+			return 0;
+
+		int k;
+		for(k = 0; k < 4; ++k)
 		{
-			int k;
-			for(k = 0; k < 4; ++k)
+			if(buf[line_start[k]+0] == '@' && buf[line_start[k+2]+0] == '+')
 			{
-				if(part[line_start[k]+0] == '@' && part[line_start[k+2]+0] == '+')
-				{
-					if(part[line_start[k+2]+1] == '\n' || part[line_start[k+2]+1] == '\r')
-						break;
-					if(line_start[k+1]-line_start[k] == line_start[k+3]-line_start[k+2] && 
-						memcmp(part+line_start[k]+1, part+line_start[k+2]+1, line_start[k+3]-line_start[k+2]-1) == 0)
-						break;
-				}
+				if(buf[line_start[k+2]+1] == '\n' || buf[line_start[k+2]+1] == '\r')
+					break;
+				if(line_start[k+1]-line_start[k] == line_start[k+3]-line_start[k+2] && 
+					memcmp(buf+line_start[k]+1, buf+line_start[k+2]+1, line_start[k+3]-line_start[k+2]-1) == 0)
+					break;
 			}
+		}
 
-			if(k == 4)
-				_size = 0;
-			else
-				_size = line_start[k];
+		if(k == 4)
+			return 0;
+		return line_start[k];
+	}
+}
+
+//----------------------------------------------------------------------------------
+// Return the start of the first record at the given position of an uncompressed file or after it
+uint64 CFastqReader::FindRangeBoundary(uint64 pos)
+{
+	if(!pos)
+		return 0;
+
+	uint64 file_size;
+	if(mapped)
+		file_size = mapped->Size();
+	else
+	{
+		my_fseek(in, 0, SEEK_END);
+		file_size = my_ftell(in);
+	}
+	if(pos >= file_size)
+		return file_size;
+
+	// The search starts at the preceding byte, as a record can start exactly at pos
+	uint64 size = MIN(OVERHEAD_SIZE, file_size - pos + 1);
+	vector<uchar> tmp;
+	uchar *buf;
+	if(mapped)
+		buf = mapped->Data() + pos - 1;
+	else
+	{
+		tmp.resize(size);
+		my_fseek(in, pos - 1, SEEK_SET);
+		if(fread(tmp.data(), 1, size, in) != size)
+		{
+			cout << "Error: Cannot read file " << input_file_name << "\n";
+			exit(1);
 		}
+		buf = tmp.data();
 	}
-	// Allocate new memory for the buffer
 
-	pmm_fastq->reserve(part);
-	copy(_part+_size, _part+total_filled, part);
-	part_filled = total_filled - _size;
+	uint64 start = FindRecordStart(buf, 0, size);
+	if(start)
+		return pos - 1 + start;
+	
+	// No complete record till the end of the file
+	if(pos - 1 + size == file_size)
+		return file_size;
 
-	return true;
+	cout << "Error: Wrong input file!\n";
+	exit(1);
+
+	return 0;
+}
+
+//----------------------------------------------------------------------------------
+// Read a block of (decompressed) data from the file
+uint64 CFastqReader::ReadData(uchar *buf, uint64 size)
+{
+	if(mode == m_plain)
+	{
+		uint64 readed = fread(buf, 1, MIN(size, range_end - range_pos), in);
+		range_pos += readed;
+		return readed;
+	}
+	else if(mode == m_gzip)
+		return gzread(in_gzip, buf, (int) size);
+	else if(mode == m_gzip_blocks)
+		return in_gzip_blocks->Read(buf, size);
+	else if(mode == m_gzip_spec)
+		return in_gzip_spec->Read(buf, size);
+	else if(mode == m_bzip2)
+		return BZ2_bzRead(&bzerror, in_bzip2, buf, (int) size);
+
+	return 0;				// Never should be here
 }
 
 //----------------------------------------------------------------------------------
 // Skip to next EOL from the current position in a buffer
 bool CFastqReader::SkipNextEOL(uchar *part, int64 &pos, int64 max_pos)
 {
+	if(pos >= max_pos-2)
+		return false;
+
 	int64 i;
-	for(i = pos; i < max_pos-2; ++i)
-		if((part[i] == '\n' || part[i] == '\r') && !(part[i+1] == '\n' || part[i+1] == '\r'))
+	for(i = pos; ; ++i)
+	{
+		i = CLineScanner::FindEOL(part, i, max_pos-2);
+		if(i >= max_pos-2)
+			return false;
+		if(!(part[i+1] == '\n' || part[i+1] == '\r'))
 			break;
-
-	if(i >= max_pos-2)
-		return false;
+	}
 
 	pos = i+1;
 
@@ -350,9 +566,13 @@ bool CFastqReader::SkipNextEOL(uchar *part, int64 &pos, int64 max_pos)
 bool CFastqReader::IsEof()
 {
 	if(mode == m_plain)
-		return feof(in) != 0;
+		return feof(in) != 0 || range_pos >= range_end;
 	else if(mode == m_gzip)
 		return gzeof(in_gzip) != 0;
+	else if(mode == m_gzip_blocks)
+		return in_gzip_blocks->Eof();
+	else if(mode == m_gzip_spec)
+		return in_gzip_spec->Eof();
 	else if(mode == m_bzip2)
 		return bzerror == BZ_STREAM_END;
 
@@ -361,6 +581,69 @@ bool CFastqReader::IsEof()
 
 
 
+//************************************************************************************************************
+// CStreamHeads - data of the streams read in stage 0
+//************************************************************************************************************
+CStreamHeads::~CStreamHeads()
+{
+	for(auto &p : heads)
+	{
+		for(auto &q : p.second.parts)
+			delete[] q.first;
+		if(p.second.fqr)
+			delete p.second.fqr;
+	}
+}
+
+//----------------------------------------------------------------------------------
+// Start storing the head of a file (false if it is already stored, e.g., the file name is given twice)
+bool CStreamHeads::Register(const string &file_name)
+{
+	lock_guard<mutex> lck(mtx);
+	if(heads.count(file_name))
+		return false;
+	heads[file_name];
+
+	return true;
+}
+
+//----------------------------------------------------------------------------------
+// Store a copy of a part read from the stream
+void CStreamHeads::AddPart(const string &file_name, uchar *part, uint64 size)
+{
+	uchar *copy = new uchar[size];
+	A_memcpy(copy, part, size);
+
+	lock_guard<mutex> lck(mtx);
+	heads[file_name].parts.push_back(make_pair(copy, size));
+}
+
+//----------------------------------------------------------------------------------
+// Store the reader positioned after the parts read from the stream
+void CStreamHeads::SetReader(const string &file_name, CFastqReader *fqr)
+{
+	lock_guard<mutex> lck(mtx);
+	heads[file_name].fqr = fqr;
+}
+
+//----------------------------------------------------------------------------------
+// Take the stored parts and reader of the stream (false if the stream was not read in stage 0)
+bool CStreamHeads::Take(const string &file_name, vector<pair<uchar *, uint64>> &parts, CFastqReader *&fqr)
+{
+	lock_guard<mutex> lck(mtx);
+	auto p = heads.find(file_name);
+	if(p == heads.end())
+		return false;
+
+	parts.swap(p->second.parts);
+	fqr = p->second.fqr;
+	heads.erase(p);
+
+	return true;
+}
+
+
+
 //************************************************************************************************************
 // CWFastqReader - wrapper for multithreading purposes
 //************************************************************************************************************
@@ -368,6 +651,7 @@ CWFastqReader::CWFastqReader(CKMCParams &Params, CKMCQueues &Queues)
 {
 	mm = Queues.mm;
 	pmm_fastq = Queues.pmm_fastq;
+	stream_heads = Queues.stream_heads;
 
 	input_files_queue = Queues.input_files_queue;
 	part_size		  = Params.fastq_buffer_size;
@@ -377,6 +661,8 @@ CWFastqReader::CWFastqReader(CKMCParams &Params, CKMCQueues &Queues)
 
 	gzip_buffer_size  = Params.gzip_buffer_size;
 	bzip2_buffer_size = Params.bzip2_buffer_size;
+	gzip_threads      = Params.n_gzip_threads;
+	max_mapped_parts  = Params.n_mapped_parts;
 
 	fqr = NULL;
 }
@@ -391,22 +677,46 @@ void CWFastqReader::operator()()
 {
 	uchar *part;
 	uint64 part_filled;
+	CMappedFile *mapped;
+	vector<pair<uchar *, uint64>> head_parts;
 	
-	while(input_files_queue->pop(file_name))
+	while(input_files_queue->pop(file_name, range_begin, range_end))
 	{
-		fqr = new CFastqReader(mm, pmm_fastq, file_type, gzip_buffer_size, bzip2_buffer_size, kmer_len);
-		fqr->SetNames(file_name);
-		fqr->SetPartSize(part_size);
-
-		if(fqr->OpenFiles())
+		if(stream_heads->Take(file_name, head_parts, fqr))
 		{
-			// Reading Fastq parts
-			while(fqr->GetPart(part, part_filled))
-				part_queue->push(part, part_filled);
+			// The beginning of a stream was read in stage 0
+			for(auto &p : head_parts)
+			{
+				pmm_fastq->reserve(part);
+				A_memcpy(part, p.first, p.second);
+				delete[] p.first;
+				part_queue->push(part, p.second, NULL);
+			}
+			head_parts.clear();
+
+			if(fqr)
+				while(fqr->GetPart(part, part_filled, mapped))
+					part_queue->push(part, part_filled, mapped);
 		}
 		else
-			cerr << "Error: Cannot open file " << file_name << "\n";
-		delete fqr;
+		{
+			fqr = new CFastqReader(mm, pmm_fastq, file_type, gzip_buffer_size, bzip2_buffer_size, gzip_threads, kmer_len);
+			fqr->SetNames(file_name);
+			fqr->SetPartSize(part_size);
+			fqr->SetMapping(max_mapped_parts, true);
+			fqr->SetRange(range_begin, range_end);
+
+			if(fqr->OpenFiles())
+			{
+				// Reading Fastq parts
+				while(fqr->GetPart(part, part_filled, mapped))
+					part_queue->push(part, part_filled, mapped);
+			}
+			else
+				cerr << "Error: Cannot open file " << file_name << "\n";
+		}
+		if(fqr)
+			delete fqr;
 	}
 	part_queue->mark_completed();
 }
@@ -420,6 +730,7 @@ CWStatsFastqReader::CWStatsFastqReader(CKMCParams &Params, CKMCQueues &Queues)
 {
 	mm = Queues.mm;
 	pmm_fastq = Queues.pmm_fastq;
+	stream_heads = Queues.stream_heads;
 
 	input_files_queue = Queues.input_files_queue;
 	part_size = Params.fastq_buffer_size;
@@ -429,6 +740,9 @@ CWStatsFastqReader::CWStatsFastqReader(CKMCParams &Params, CKMCQueues &Queues)
 
 	gzip_buffer_size = Params.gzip_buffer_size;
 	bzip2_buffer_size = Params.bzip2_buffer_size;
+	gzip_threads = Params.n_gzip_threads;
+	max_mapped_parts = Params.n_mapped_parts;
+	sample_fraction = Params.stats_fraction;
 
 	fqr = NULL;
 }
@@ -441,35 +755,127 @@ CWStatsFastqReader::~CWStatsFastqReader()
 //----------------------------------------------------------------------------------
 void CWStatsFastqReader::operator()()
 {
-	uchar *part;
-	uint64 part_filled;
+	// Compressed files and streams cannot be sampled at arbitrary positions, so every n-th part of their heads is used
+	uint32 sample_step = sample_fraction > 0 ? MAX((uint32) (1.0 / sample_fraction + 0.5), 1u) : 1;
 	bool finished = false;
-	while (input_files_queue->pop(file_name) && !finished)
+
+	while (input_files_queue->pop(file_name, range_begin, range_end) && !finished)
 	{
-		fqr = new CFastqReader(mm, pmm_fastq, file_type, gzip_buffer_size, bzip2_buffer_size, kmer_len);
-		fqr->SetNames(file_name);
-		fqr->SetPartSize(part_size);
+		bool stream = CInputFilesQueue::IsStream(file_name);
+		uint64 file_size = stream ? 0 : CInputFilesQueue::PlainFileSize(file_name);
+
+		if (file_size && sample_fraction > 0 && file_type != multiline_fasta)
+		{
+			finished = !SampleRange(file_size);
+			continue;
+		}
+
+		// Uncompressed files are cheap to read again, the parts of the other ones are kept for stage 1
+		bool keep_head = !file_size && stream_heads->Register(file_name);
+
+		fqr = NewReader();
+		fqr->SetRange(range_begin, range_end);
 
 		if (fqr->OpenFiles())
 		{
-			// Reading Fastq parts
-			while (fqr->GetPart(part, part_filled))
-			{
-				if (!stats_part_queue->push(part, part_filled))
-				{
-					finished = true;
-					pmm_fastq->free(part);
-					break;
-				}
+			finished = !ReadParts(stream ? 1 : sample_step, keep_head);
 
-			}
+			// Stage 1 continues with the reader if the file was not read entirely
+			if (keep_head)
+				stream_heads->SetReader(file_name, finished ? fqr : NULL);
+			if (!keep_head || !finished)
+				delete fqr;
 		}
 		else
+		{
 			cerr << "Error: Cannot open file " << file_name << "\n";
-		delete fqr;
+			delete fqr;
+		}
+		fqr = NULL;
 	}
 	stats_part_queue->mark_completed();
 }
 
+//----------------------------------------------------------------------------------
+CFastqReader *CWStatsFastqReader::NewReader()
+{
+	CFastqReader *r = new CFastqReader(mm, pmm_fastq, file_type, gzip_buffer_size, bzip2_buffer_size, gzip_threads, kmer_len);
+	r->SetNames(file_name);
+	r->SetPartSize(part_size);
+	r->SetMapping(max_mapped_parts, false);
+
+	return r;
+}
+
+//----------------------------------------------------------------------------------
+// Pass every sample_step-th part of the opened file to the splitters; false if enough data were read in stage 0
+bool CWStatsFastqReader::ReadParts(uint32 sample_step, bool keep_head)
+{
+	uchar *part;
+	uint64 part_filled;
+	CMappedFile *mapped;
+
+	for (uint32 i = 0; fqr->GetPart(part, part_filled, mapped); ++i)
+	{
+		// All parts read are kept, as stage 1 continues after them
+		if (keep_head)
+			stream_heads->AddPart(file_name, part, part_filled);
+
+		bool sampled = i % sample_step == 0;
+		if (sampled && stats_part_queue->push(part, part_filled, mapped))
+			continue;
+
+		bool next = !sampled && stats_part_queue->skip(part_filled);
+		if (mapped)
+			mapped->ReleaseView(part, part_filled);
+		else
+			pmm_fastq->free(part);
+		if (!next)
+			return false;
+	}
+
+	return true;
+}
+
+//----------------------------------------------------------------------------------
+// Pass evenly spaced windows of the range of an uncompressed file to the splitters; false if enough data were read
+bool CWStatsFastqReader::SampleRange(uint64 file_size)
+{
+	uint64 begin = range_begin;
+	uint64 end = MIN(range_end, file_size);
+	uint64 size = end - begin;
+
+	uint64 n_windows = MAX((uint64) (size * sample_fraction / STATS_WINDOW_SIZE), (uint64) 1);
+	uint64 stride = size / n_windows;
+	uint64 window_size = STATS_WINDOW_SIZE;
+	if (stride <= window_size)
+	{
+		n_windows = 1;
+		stride = window_size = size;
+	}
+
+	for (uint64 i = 0; i < n_windows; ++i)
+	{
+		// The windows are moved to the starts of the records by the reader
+		uint64 w_begin = begin + i * stride;
+		uint64 w_end = MIN(w_begin + window_size, end);
+
+		fqr = NewReader();
+		fqr->SetRange(w_begin, w_end);
+		bool ok = true;
+		if (fqr->OpenFiles())
+			ok = ReadParts(1, false);
+		else
+			cerr << "Error: Cannot open file " << file_name << "\n";
+		delete fqr;
+		fqr = NULL;
+
+		if (!ok)
+			return false;
+	}
+
+	return true;
+}
+
 
 // ***** EOF
@@ -13,8 +13,13 @@
 
 #include "defs.h"
 #include "params.h"
+#include "gz_block_reader.h"
+#include "gz_spec_reader.h"
+#include "mapped_file.h"
+#include "line_scanner.h"
 #include <stdio.h>
 #include <iostream>
+#include <map>
 
 #include "libs/zlib.h"
 #include "libs/bzlib.h"
@@ -26,7 +31,7 @@ using namespace std;
 // FASTA/FASTQ reader class
 //************************************************************************************************************
 class CFastqReader {
-	typedef enum {m_plain, m_gzip, m_bzip2} t_mode;
+	typedef enum {m_plain, m_gzip, m_gzip_blocks, m_gzip_spec, m_bzip2} t_mode;
 
 	CMemoryMonitor *mm;
 	CMemoryPool *pmm_fastq;
@@ -35,12 +40,22 @@ class CFastqReader {
 	input_type file_type;
 	int kmer_len;
 	t_mode mode;
+	bool stream;						// standard input or a named pipe
 
 	FILE *in;
 	gzFile_s *in_gzip;
+	CGzBlockReader *in_gzip_blocks;
+	CGzSpecReader *in_gzip_spec;
 	BZFILE *in_bzip2;
 	int bzerror;
 
+	CMappedFile *mapped;				// uncompressed file passed to the splitters without copying
+	uint32 max_mapped_parts;
+	bool mapped_free_behind;
+
+	uint64 range_begin, range_end;		// byte range of a file to process
+	uint64 range_pos;					// position of the next byte to read from the range
+
 	uint64 part_size;
 	
 	uchar *part;
@@ -48,25 +63,59 @@ class CFastqReader {
 	
 	uint32 gzip_buffer_size;
 	uint32 bzip2_buffer_size;
+	uint32 gzip_threads;
 
 	bool containsNextChromosome; //for multiline_fasta processing
 
 	bool SkipNextEOL(uchar *part, int64 &pos, int64 max_pos);
 
+	uint64 ReadData(uchar *buf, uint64 size);
+	uint64 FindRecordStart(uchar *buf, int64 pos, int64 total_filled);
+	uint64 FindRangeBoundary(uint64 pos);
+	bool GetMappedPart(uchar *&_part, uint64 &_size, CMappedFile *&_mapped);
+
 	bool IsEof();
 
 public:
-	CFastqReader(CMemoryMonitor *_mm, CMemoryPool *_pmm_fastq, input_type _file_type, uint32 _gzip_buffer_size, uint32 _bzip2_buffer_size, int _kmer_len);
+	CFastqReader(CMemoryMonitor *_mm, CMemoryPool *_pmm_fastq, input_type _file_type, uint32 _gzip_buffer_size, uint32 _bzip2_buffer_size, uint32 _gzip_threads, int _kmer_len);
 	~CFastqReader();
 
 	static uint64 OVERHEAD_SIZE;
 
 	bool SetNames(string _input_file_name);
 	bool SetPartSize(uint64 _part_size);
+	void SetMapping(uint32 _max_mapped_parts, bool _free_behind);
+	void SetRange(uint64 _range_begin, uint64 _range_end);
 	bool OpenFiles();
 
 	bool GetPartFromMultilneFasta(uchar *&_part, uint64 &_size);
-	bool GetPart(uchar *&_part, uint64 &_size);
+	bool GetPart(uchar *&_part, uint64 &_size, CMappedFile *&_mapped);
+};
+
+//************************************************************************************************************
+// CStreamHeads - data of the streams and compressed files read in stage 0
+// A stream cannot be reopened and a compressed file would be decompressed again, so stage 1 takes the stored parts
+// and continues reading with the same reader (if the file was not read entirely in stage 0).
+//************************************************************************************************************
+class CStreamHeads {
+	struct CHead {
+		vector<pair<uchar *, uint64>> parts;
+		CFastqReader *fqr;
+
+		CHead() : fqr(NULL) {};
+	};
+
+	map<string, CHead> heads;
+	mutex mtx;
+
+public:
+	CStreamHeads() {};
+	~CStreamHeads();
+
+	bool Register(const string &file_name);
+	void AddPart(const string &file_name, uchar *part, uint64 size);
+	void SetReader(const string &file_name, CFastqReader *fqr);
+	bool Take(const string &file_name, vector<pair<uchar *, uint64>> &parts, CFastqReader *&fqr);
 };
 
 //************************************************************************************************************
@@ -75,15 +124,19 @@ public:
 class CWFastqReader {
 	CMemoryMonitor *mm;
 	CMemoryPool *pmm_fastq;
+	CStreamHeads *stream_heads;
 
 	CFastqReader *fqr;
 	string file_name;
+	uint64 range_begin, range_end;
 	uint64 part_size;
 	CInputFilesQueue *input_files_queue;
 	CPartQueue *part_queue;
 	input_type file_type;
 	uint32 gzip_buffer_size;
 	uint32 bzip2_buffer_size;
+	uint32 gzip_threads;
+	uint32 max_mapped_parts;
 	int kmer_len;
 
 public:
@@ -101,16 +154,25 @@ public:
 class CWStatsFastqReader {
 	CMemoryMonitor *mm;
 	CMemoryPool *pmm_fastq;
+	CStreamHeads *stream_heads;
 
 	CFastqReader *fqr;
 	string file_name;
+	uint64 range_begin, range_end;
 	uint64 part_size;
 	CInputFilesQueue *input_files_queue;
 	CStatsPartQueue *stats_part_queue;
 	input_type file_type;
 	uint32 gzip_buffer_size;
 	uint32 bzip2_buffer_size;
+	uint32 gzip_threads;
+	uint32 max_mapped_parts;
 	int kmer_len;
+	double sample_fraction;
+
+	CFastqReader *NewReader();
+	bool ReadParts(uint32 sample_step, bool keep_head);
+	bool SampleRange(uint64 file_size);
 
 public:
 	CWStatsFastqReader(CKMCParams &Params, CKMCQueues &Queues);
@@ -0,0 +1,478 @@
+#include "stdafx.h"
+/*
+  This file is a part of KMC software distributed under GNU GPL 3 licence.
+  The homepage of the KMC project is http://sun.aei.polsl.pl/kmc
+
+  Authors: Sebastian Deorowicz, Agnieszka Debudaj-Grabysz, Marek Kokot
+
+  Version: 2.0
+  Date   : 2014-07-04
+*/
+
+#include <algorithm>
+#include <string.h>
+#include "gz_block_reader.h"
+#include "libs/asmlib.h"
+
+//************************************************************************************************************
+// CGzBlockReader - parallel decompression of multi-member gzip files
+//************************************************************************************************************
+
+//----------------------------------------------------------------------------------
+// Constructor
+// Parameters:
+//    * _n_threads - no. of decompression threads
+CGzBlockReader::CGzBlockReader(uint32 _n_threads)
+{
+	n_threads = MAX(1u, _n_threads);
+	max_jobs  = 2 * n_threads + 1;
+
+	layout = gl_single;
+	in     = NULL;
+
+	in_buf_filled = 0;
+	in_eof        = false;
+
+	out_pos  = 0;
+	eof      = false;
+	finished = false;
+
+	memset(&cont_strm, 0, sizeof(cont_strm));
+	cont_active        = false;
+	cont_in_pos        = 0;
+	cont_member_header = true;
+}
+
+//----------------------------------------------------------------------------------
+// Destructor - stop the workers and close the file
+CGzBlockReader::~CGzBlockReader()
+{
+	{
+		lock_guard<mutex> lck(mtx);
+		finished = true;
+	}
+	cv_to_do.notify_all();
+	for(auto &t : workers)
+		t.join();
+
+	for(auto job : jobs)
+		delete job;
+	for(auto job : free_jobs)
+		delete job;
+
+	if(in)
+	{
+		inflateEnd(&cont_strm);
+		fclose(in);
+	}
+}
+
+//----------------------------------------------------------------------------------
+// Check whether a gzip member header (with sensible XFL and OS fields) starts at p
+bool CGzBlockReader::IsMemberHeader(const uchar *p, uint64 avail)
+{
+	return avail >= 10 && p[0] == 0x1f && p[1] == 0x8b && p[2] == 8 && (p[3] & 0xe0) == 0 &&
+		(p[8] == 0 || p[8] == 2 || p[8] == 4) && (p[9] <= 13 || p[9] == 255);
+}
+
+//----------------------------------------------------------------------------------
+// Return the total size of a BGZF block starting at p (0 if it is not a BGZF block)
+int64 CGzBlockReader::BgzfBlockSize(const uchar *p, uint64 avail)
+{
+	if(avail < 18 || !IsMemberHeader(p, avail) || !(p[3] & 4))
+		return 0;
+
+	uint32 xlen = p[10] + (p[11] << 8);
+	if(avail < 12 + (uint64) xlen)
+		return 0;
+
+	// Look for 'BC' subfield containing the block size
+	for(uint32 i = 0; i + 4 <= xlen; )
+	{
+		const uchar *sf = p + 12 + i;
+		uint32 slen = sf[2] + (sf[3] << 8);
+		if(sf[0] == 'B' && sf[1] == 'C' && slen == 2 && i + 6 <= xlen)
+			return (sf[4] + (sf[5] << 8)) + 1;
+		i += 4 + slen;
+	}
+
+	return 0;
+}
+
+//----------------------------------------------------------------------------------
+// Recognize the layout of a gzip file by looking at its beginning
+CGzBlockReader::t_layout CGzBlockReader::CheckLayout(const string &file_name)
+{
+	FILE *f = fopen(file_name.c_str(), "rb");
+	if(!f)
+		return gl_single;
+
+	vector<uchar> buf(MAX_SCAN_SIZE);
+	uint64 size = fread(buf.data(), 1, buf.size(), f);
+	fclose(f);
+
+	if(!IsMemberHeader(buf.data(), size))
+		return gl_single;
+	if(BgzfBlockSize(buf.data(), size) > 0)
+		return gl_bgzf;
+
+	for(uchar *p = buf.data() + 1; p < buf.data() + size; ++p)
+	{
+		p = (uchar*) memchr(p, 0x1f, buf.data() + size - p);
+		if(!p)
+			break;
+		if(IsMemberHeader(p, buf.data() + size - p))
+			return gl_members;
+	}
+
+	return gl_single;
+}
+
+//----------------------------------------------------------------------------------
+// Estimate the amount of memory used by a single reader
+uint64 CGzBlockReader::MemoryUsage(uint32 _n_threads)
+{
+	return MAX_SCAN_SIZE + JOB_SIZE + (2 * MAX(1u, _n_threads) + 1) * 9 * JOB_SIZE;
+}
+
+//----------------------------------------------------------------------------------
+// Open the file and start the decompression threads
+bool CGzBlockReader::Open(const string &file_name, t_layout _layout)
+{
+	if(in)
+		return false;
+
+	if((in = fopen(file_name.c_str(), "rb")) == NULL)
+		return false;
+
+	if(inflateInit2(&cont_strm, 15 + 16) != Z_OK)
+	{
+		fclose(in);
+		in = NULL;
+		return false;
+	}
+
+	layout = _layout;
+	in_buf.resize(MAX_SCAN_SIZE + JOB_SIZE);
+
+	for(uint32 i = 0; i < n_threads; ++i)
+		workers.push_back(thread(&CGzBlockReader::WorkerLoop, this));
+
+	return true;
+}
+
+//----------------------------------------------------------------------------------
+// Read compressed data to have at least min_filled bytes in the input buffer
+void CGzBlockReader::FillInBuf(uint64 min_filled)
+{
+	min_filled = MIN(min_filled, (uint64) in_buf.size());
+	while(!in_eof && in_buf_filled < min_filled)
+	{
+		uint64 readed = fread(in_buf.data() + in_buf_filled, 1, in_buf.size() - in_buf_filled, in);
+		in_buf_filled += readed;
+		if(!readed)
+			in_eof = true;
+	}
+}
+
+//----------------------------------------------------------------------------------
+// Find a position where the next job ends (at the BGZF block or candidate member boundary)
+bool CGzBlockReader::FindCut(uint64 &cut)
+{
+	FillInBuf(2 * JOB_SIZE);
+	if(!in_buf_filled)
+		return false;
+
+	if(layout == gl_bgzf)
+	{
+		uint64 pos = 0;
+		while(pos < JOB_SIZE)
+		{
+			int64 block_size = BgzfBlockSize(in_buf.data() + pos, in_buf_filled - pos);
+			if(block_size <= 0 || pos + block_size > in_buf_filled)
+				break;
+			pos += block_size;
+		}
+		if(pos)
+		{
+			cut = pos;
+			return true;
+		}
+		layout = gl_members;			// Not a BGZF block - continue as general multi-member file
+	}
+
+	uint64 scan_from = MIN(JOB_SIZE, in_buf_filled);
+	while(true)
+	{
+		uchar *end = in_buf.data() + in_buf_filled;
+		for(uchar *p = in_buf.data() + scan_from; p < end; ++p)
+		{
+			p = (uchar*) memchr(p, 0x1f, end - p);
+			if(!p)
+				break;
+			if(end - p < 10 && !in_eof)
+				break;
+			if(IsMemberHeader(p, end - p))
+			{
+				cut = p - in_buf.data();
+				return true;
+			}
+		}
+
+		// No candidate - the job will be decoded sequentially if it does not end at a member boundary
+		if(in_eof || in_buf_filled == in_buf.size())
+		{
+			cut = in_buf_filled;
+			return true;
+		}
+
+		scan_from = MAX(scan_from, in_buf_filled - 9);
+		FillInBuf(in_buf_filled + JOB_SIZE);
+	}
+}
+
+//----------------------------------------------------------------------------------
+// Cut the compressed data into jobs and pass them to the workers
+void CGzBlockReader::CreateJobs()
+{
+	uint64 cut;
+
+	while(jobs.size() < max_jobs && FindCut(cut))
+	{
+		CJob *job;
+		if(free_jobs.empty())
+			job = new CJob;
+		else
+		{
+			job = free_jobs.front();
+			free_jobs.pop_front();
+		}
+
+		job->in.assign(in_buf.begin(), in_buf.begin() + cut);
+		copy(in_buf.begin() + cut, in_buf.begin() + in_buf_filled, in_buf.begin());
+		in_buf_filled -= cut;
+
+		job->out_size = 0;
+		job->started  = false;
+		job->done     = false;
+		job->ok       = false;
+		jobs.push_back(job);
+
+		{
+			lock_guard<mutex> lck(mtx);
+			jobs_to_do.push_back(job);
+		}
+		cv_to_do.notify_one();
+	}
+}
+
+//----------------------------------------------------------------------------------
+// Remove the front job (waiting for its worker if necessary)
+void CGzBlockReader::PopJob()
+{
+	CJob *job = jobs.front();
+	jobs.pop_front();
+
+	{
+		unique_lock<mutex> lck(mtx);
+		if(!job->started)
+			jobs_to_do.remove(job);
+		else
+			cv_done.wait(lck, [job]{return job->done;});
+	}
+
+	free_jobs.push_back(job);
+	out_pos = 0;
+}
+
+//----------------------------------------------------------------------------------
+// Decompression thread
+void CGzBlockReader::WorkerLoop()
+{
+	while(true)
+	{
+		CJob *job;
+		{
+			unique_lock<mutex> lck(mtx);
+			cv_to_do.wait(lck, [this]{return !this->jobs_to_do.empty() || this->finished;});
+			if(finished)
+				return;
+
+			job = jobs_to_do.front();
+			jobs_to_do.pop_front();
+			job->started = true;
+		}
+
+		Decode(job);
+
+		{
+			lock_guard<mutex> lck(mtx);
+			job->done = true;
+		}
+		cv_done.notify_all();
+	}
+}
+
+//----------------------------------------------------------------------------------
+// Inflate all members of a job; the job is ok only if the last member ends exactly at the job end
+void CGzBlockReader::Decode(CJob *job)
+{
+	z_stream strm;
+	memset(&strm, 0, sizeof(strm));
+	if(inflateInit2(&strm, 15 + 16) != Z_OK)
+		return;
+
+	if(job->out.size() < 4 * job->in.size())
+		job->out.resize(MIN(MAX_JOB_OUT_SIZE, MAX((uint64) 1 << 16, 4 * (uint64) job->in.size())));
+
+	strm.next_in  = job->in.data();
+	strm.avail_in = (uInt) job->in.size();
+
+	uint64 out_size = 0;
+	while(true)
+	{
+		if(out_size == job->out.size())
+		{
+			if(out_size >= MAX_JOB_OUT_SIZE)
+				break;					// Too large output - the job will be decoded sequentially
+			job->out.resize(MIN(MAX_JOB_OUT_SIZE, 2 * out_size));
+		}
+
+		strm.next_out  = job->out.data() + out_size;
+		strm.avail_out = (uInt) (job->out.size() - out_size);
+
+		int ret = inflate(&strm, Z_NO_FLUSH);
+		out_size = job->out.size() - strm.avail_out;
+
+		if(ret == Z_STREAM_END)
+		{
+			if(!strm.avail_in)
+			{
+				job->ok = true;
+				break;
+			}
+			inflateReset(&strm);
+		}
+		else if(ret != Z_OK && ret != Z_BUF_ERROR)
+			break;
+		else if(!strm.avail_in && strm.avail_out)
+			break;						// The job ends inside a member
+	}
+
+	job->out_size = out_size;
+	inflateEnd(&strm);
+}
+
+//----------------------------------------------------------------------------------
+// Inflate sequentially from the front job until a member ends exactly at a job boundary
+uint64 CGzBlockReader::DecodeSequential(uchar *buf, uint64 size)
+{
+	uint64 produced = 0;
+
+	while(produced < size && cont_active)
+	{
+		CJob *job = jobs.front();
+		uint64 avail_in  = job->in.size() - cont_in_pos;
+		uint64 avail_out = MIN(size - produced, (uint64) 1 << 30);
+
+		cont_strm.next_in   = job->in.data() + cont_in_pos;
+		cont_strm.avail_in  = (uInt) avail_in;
+		cont_strm.next_out  = buf + produced;
+		cont_strm.avail_out = (uInt) avail_out;
+
+		int ret = inflate(&cont_strm, Z_NO_FLUSH);
+		cont_in_pos += avail_in - cont_strm.avail_in;
+		produced    += avail_out - cont_strm.avail_out;
+
+		if(ret == Z_STREAM_END)
+		{
+			inflateReset(&cont_strm);
+			if(cont_in_pos == job->in.size())
+			{
+				PopJob();
+				cont_active = false;		// The next job starts at a member boundary
+			}
+			else
+				cont_member_header = job->in.size() - cont_in_pos < 2 ||
+					(job->in[cont_in_pos] == 0x1f && job->in[cont_in_pos+1] == 0x8b);
+		}
+		else if(ret == Z_OK || ret == Z_BUF_ERROR)
+		{
+			if(cont_in_pos == job->in.size())
+			{
+				// The member continues in the next job
+				PopJob();
+				cont_in_pos = 0;
+				CreateJobs();
+				if(jobs.empty())
+				{
+					cout << "Error: Unexpected end of gzip file!\n";
+					exit(1);
+				}
+			}
+		}
+		else if(!cont_member_header)
+		{
+			// Trailing garbage after the last member is ignored (as in gzread)
+			cont_active = false;
+			eof = true;
+		}
+		else
+		{
+			cout << "Error: Corrupted gzip file!\n";
+			exit(1);
+		}
+	}
+
+	return produced;
+}
+
+//----------------------------------------------------------------------------------
+// Read decompressed data (in the file order)
+uint64 CGzBlockReader::Read(uchar *buf, uint64 size)
+{
+	uint64 filled = 0;
+
+	while(filled < size && !eof)
+	{
+		CreateJobs();
+		if(jobs.empty())
+		{
+			eof = true;
+			break;
+		}
+
+		if(cont_active)
+		{
+			filled += DecodeSequential(buf + filled, size - filled);
+			continue;
+		}
+
+		CJob *job = jobs.front();
+		{
+			unique_lock<mutex> lck(mtx);
+			cv_done.wait(lck, [job]{return job->done;});
+		}
+
+		if(!job->ok)
+		{
+			// The job cannot be decoded independently - switch to sequential decompression
+			inflateReset(&cont_strm);
+			cont_active        = true;
+			cont_in_pos        = 0;
+			cont_member_header = job->in.size() < 2 || (job->in[0] == 0x1f && job->in[1] == 0x8b);
+			continue;
+		}
+
+		uint64 n = MIN(size - filled, job->out_size - out_pos);
+		A_memcpy(buf + filled, job->out.data() + out_pos, n);
+		filled  += n;
+		out_pos += n;
+		if(out_pos == job->out_size)
+			PopJob();
+	}
+
+	return filled;
+}
+
+// ***** EOF
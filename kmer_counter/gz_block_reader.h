@@ -0,0 +1,99 @@
+/*
+  This file is a part of KMC software distributed under GNU GPL 3 licence.
+  The homepage of the KMC project is http://sun.aei.polsl.pl/kmc
+
+  Authors: Sebastian Deorowicz, Agnieszka Debudaj-Grabysz, Marek Kokot
+
+  Version: 2.0
+  Date   : 2014-07-04
+*/
+
+#ifndef _GZ_BLOCK_READER_H
+#define _GZ_BLOCK_READER_H
+
+#include "defs.h"
+#include "queues.h"
+#include <stdio.h>
+#include <string>
+#include <vector>
+#include <list>
+
+#include "libs/zlib.h"
+
+using namespace std;
+
+//************************************************************************************************************
+// CGzBlockReader - parallel decompression of gzip files consisting of many members (BGZF, concatenated gzip)
+// The compressed stream is cut at (candidate) member boundaries into jobs that are inflated by worker threads.
+// The output of a job is used only if its start was verified, i.e., the preceding data ended exactly there
+// with a complete member. Otherwise the data are inflated sequentially until a job boundary is verified again.
+//************************************************************************************************************
+class CGzBlockReader {
+public:
+	typedef enum {gl_single, gl_bgzf, gl_members} t_layout;
+
+private:
+	struct CJob {
+		vector<uchar> in;				// compressed data
+		vector<uchar> out;				// decompressed data
+		uint64 out_size;
+		bool started;
+		bool done;
+		bool ok;						// all members inside the job are complete and the last one ends at the job end
+	};
+
+	static const uint64 JOB_SIZE = 1 << 20;
+	static const uint64 MAX_JOB_OUT_SIZE = 32 << 20;
+	static const uint64 MAX_SCAN_SIZE = 8 * JOB_SIZE;
+
+	t_layout layout;
+	FILE *in;
+	uint32 n_threads;
+	uint32 max_jobs;
+
+	vector<uchar> in_buf;				// compressed data not assigned to any job yet
+	uint64 in_buf_filled;
+	bool in_eof;
+
+	list<CJob*> jobs;					// jobs in the file order
+	list<CJob*> jobs_to_do;
+	list<CJob*> free_jobs;				// jobs to reuse (keeps their buffers allocated)
+	uint64 out_pos;						// position in the output of the front job
+	bool eof;
+	bool finished;
+
+	z_stream cont_strm;					// sequential decoding (job boundary not verified)
+	bool cont_active;
+	uint64 cont_in_pos;
+	bool cont_member_header;
+
+	vector<thread> workers;
+	mutex mtx;
+	condition_variable cv_to_do, cv_done;
+
+	static bool IsMemberHeader(const uchar *p, uint64 avail);
+	static int64 BgzfBlockSize(const uchar *p, uint64 avail);
+	static void Decode(CJob *job);
+
+	void WorkerLoop();
+	void FillInBuf(uint64 min_filled);
+	bool FindCut(uint64 &cut);
+	void CreateJobs();
+	void PopJob();
+	uint64 DecodeSequential(uchar *buf, uint64 size);
+
+public:
+	CGzBlockReader(uint32 _n_threads);
+	~CGzBlockReader();
+
+	static t_layout CheckLayout(const string &file_name);
+	static uint64 MemoryUsage(uint32 _n_threads);
+
+	bool Open(const string &file_name, t_layout _layout);
+	uint64 Read(uchar *buf, uint64 size);
+	bool Eof() { return eof; }
+};
+
+#endif
+
+// ***** EOF
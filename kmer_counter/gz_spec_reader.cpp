@@ -0,0 +1,993 @@
+#include "stdafx.h"
+/*
+  This file is a part of KMC software distributed under GNU GPL 3 licence.
+  The homepage of the KMC project is http://sun.aei.polsl.pl/kmc
+
+  Authors: Sebastian Deorowicz, Agnieszka Debudaj-Grabysz, Marek Kokot
+
+  Version: 2.0
+  Date   : 2014-07-04
+*/
+
+#include <algorithm>
+#include <string.h>
+#include "gz_spec_reader.h"
+#include "libs/asmlib.h"
+
+//************************************************************************************************************
+// CInflater - deflate decoder producing marked output
+//************************************************************************************************************
+const uint16 CInflater::len_base[29] = {3, 4, 5, 6, 7, 8, 9, 10, 11, 13, 15, 17, 19, 23, 27, 31, 35, 43, 51, 59, 67, 83, 99, 115, 131, 163, 195, 227, 258};
+const uint16 CInflater::len_extra[29] = {0, 0, 0, 0, 0, 0, 0, 0, 1, 1, 1, 1, 2, 2, 2, 2, 3, 3, 3, 3, 4, 4, 4, 4, 5, 5, 5, 5, 0};
+const uint16 CInflater::dist_base[30] = {1, 2, 3, 4, 5, 7, 9, 13, 17, 25, 33, 49, 65, 97, 129, 193, 257, 385, 513, 769, 1025, 1537, 2049, 3073, 4097, 6145, 8193, 12289, 16385, 24577};
+const uint16 CInflater::dist_extra[30] = {0, 0, 0, 0, 1, 1, 2, 2, 3, 3, 4, 4, 5, 5, 6, 6, 7, 7, 8, 8, 9, 9, 10, 10, 11, 11, 12, 12, 13, 13};
+const uchar CInflater::cl_order[19] = {16, 17, 18, 0, 8, 7, 9, 6, 10, 5, 11, 4, 12, 3, 13, 2, 14, 1, 15};
+
+//----------------------------------------------------------------------------------
+// Fill the bit buffer with at least 56 bits (zeros are appended after the end of data)
+inline void CInflater::Refill()
+{
+	if(pos + 8 <= size)
+	{
+		uint64 w;
+		memcpy(&w, data + pos, 8);
+		bit_buf |= w << bit_cnt;
+		pos += (63 - bit_cnt) >> 3;
+		bit_cnt |= 56;
+	}
+	else
+		for(; bit_cnt <= 56; bit_cnt += 8, ++pos)
+			if(pos < size)
+				bit_buf |= (uint64) data[pos] << bit_cnt;
+}
+
+//----------------------------------------------------------------------------------
+inline uint32 CInflater::GetBits(uint32 n)
+{
+	if(bit_cnt < n)
+		Refill();
+	uint32 r = (uint32) (bit_buf & ((1ull << n) - 1));
+	bit_buf >>= n;
+	bit_cnt -= n;
+
+	return r;
+}
+
+//----------------------------------------------------------------------------------
+inline bool CInflater::DecodeSymbol(const CHuffTable &t, uint32 &sym)
+{
+	if(bit_cnt < 15)
+		Refill();
+	uint16 e = t.table[bit_buf & ((1u << t.bits) - 1)];
+	uint32 len = e & 15;
+	if(!len)
+		return false;
+	bit_buf >>= len;
+	bit_cnt -= len;
+	sym = e >> 4;
+
+	return true;
+}
+
+//----------------------------------------------------------------------------------
+void CInflater::Seek(uint64 bit)
+{
+	pos     = bit >> 3;
+	bit_buf = 0;
+	bit_cnt = 0;
+	Refill();
+	bit_buf >>= bit & 7;
+	bit_cnt -= bit & 7;
+}
+
+//----------------------------------------------------------------------------------
+// Build a decoding table of canonical Huffman code (incomplete codes are allowed only for a single code)
+bool CInflater::BuildTable(const uchar *lens, uint32 n, CHuffTable &t, bool allow_incomplete)
+{
+	uint32 count[16] = {0};
+	for(uint32 i = 0; i < n; ++i)
+		count[lens[i]]++;
+	count[0] = 0;
+
+	uint32 max_len = 15;
+	while(max_len && !count[max_len])
+		--max_len;
+	if(!max_len)
+	{
+		t.bits = 1;
+		t.table.assign(2, 0);
+		return allow_incomplete;
+	}
+
+	int32 left = 1;
+	for(uint32 i = 1; i <= 15; ++i)
+	{
+		left = (left << 1) - count[i];
+		if(left < 0)
+			return false;
+	}
+	if(left > 0 && !(allow_incomplete && max_len == 1))
+		return false;
+
+	uint32 next_code[16];
+	uint32 code = 0;
+	next_code[0] = 0;
+	for(uint32 i = 1; i <= 15; ++i)
+	{
+		code = (code + count[i-1]) << 1;
+		next_code[i] = code;
+	}
+
+	t.bits = max_len;
+	t.table.assign(1u << max_len, 0);
+	for(uint32 sym = 0; sym < n; ++sym)
+	{
+		uint32 len = lens[sym];
+		if(!len)
+			continue;
+		uint32 c = next_code[len]++;
+		uint32 rev = 0;
+		for(uint32 i = 0; i < len; ++i)
+			rev = (rev << 1) | ((c >> i) & 1);
+		for(uint32 r = rev; r < (1u << max_len); r += 1u << len)
+			t.table[r] = (uint16) ((sym << 4) | len);
+	}
+
+	return true;
+}
+
+//----------------------------------------------------------------------------------
+// Read the code tables of a dynamic Huffman block
+bool CInflater::ReadDynamicTables()
+{
+	uint32 hlit  = GetBits(5) + 257;
+	uint32 hdist = GetBits(5) + 1;
+	uint32 hclen = GetBits(4) + 4;
+	if(hlit > 286 || hdist > 30)
+		return false;
+
+	uchar cl_lens[19] = {0};
+	for(uint32 i = 0; i < hclen; ++i)
+		cl_lens[cl_order[i]] = (uchar) GetBits(3);
+	if(!BuildTable(cl_lens, 19, cl_table, false))
+		return false;
+
+	uchar lens[286 + 30] = {0};
+	for(uint32 i = 0; i < hlit + hdist; )
+	{
+		uint32 sym;
+		if(!DecodeSymbol(cl_table, sym))
+			return false;
+		if(sym < 16)
+		{
+			lens[i++] = (uchar) sym;
+			continue;
+		}
+
+		uint32 rep;
+		uchar val = 0;
+		if(sym == 16)
+		{
+			if(!i)
+				return false;
+			val = lens[i-1];
+			rep = 3 + GetBits(2);
+		}
+		else if(sym == 17)
+			rep = 3 + GetBits(3);
+		else
+			rep = 11 + GetBits(7);
+		if(i + rep > hlit + hdist)
+			return false;
+		while(rep--)
+			lens[i++] = val;
+	}
+
+	if(!lens[256] || Overrun())
+		return false;
+
+	return BuildTable(lens, hlit, lit_table, true) && BuildTable(lens + hlit, hdist, dist_table, true);
+}
+
+//----------------------------------------------------------------------------------
+void CInflater::SetFixedTables()
+{
+	uchar lens[288];
+	fill(lens, lens + 144, 8);
+	fill(lens + 144, lens + 256, 9);
+	fill(lens + 256, lens + 280, 7);
+	fill(lens + 280, lens + 288, 8);
+	BuildTable(lens, 288, lit_table, true);
+
+	fill(lens, lens + 30, 5);
+	BuildTable(lens, 30, dist_table, true);
+}
+
+//----------------------------------------------------------------------------------
+bool CInflater::ReadBlockHeader(uint32 &type)
+{
+	last_block = GetBits(1) != 0;
+	type = GetBits(2);
+
+	if(type == 2)
+		return ReadDynamicTables();
+	if(type == 1)
+		SetFixedTables();
+
+	return type != 3;
+}
+
+//----------------------------------------------------------------------------------
+// Decode the data of a Huffman block; in the MARKED mode references before the chunk start produce markers
+template<typename T, bool MARKED> bool CInflater::DecodeHuffman(vector<T> &out, uint64 &out_size, uint64 &marker_end)
+{
+	uint64 o = out_size;
+	T *p = out.data();
+	uint64 cap = out.size();
+
+	while(true)
+	{
+		if(o + 258 > cap)
+		{
+			out.resize(MAX(2 * cap, (uint64) 1 << 20));
+			p = out.data();
+			cap = out.size();
+		}
+
+		Refill();
+		if(Overrun())
+			return false;
+
+		uint32 sym;
+		if(!DecodeSymbol(lit_table, sym))
+			return false;
+		if(sym < 256)
+		{
+			p[o++] = (T) sym;
+			continue;
+		}
+		if(sym == 256)
+			break;
+
+		sym -= 257;
+		if(sym >= 29)
+			return false;
+		uint32 len = len_base[sym] + GetBits(len_extra[sym]);
+
+		uint32 dsym;
+		if(!DecodeSymbol(dist_table, dsym) || dsym >= 30)
+			return false;
+		uint32 dist = dist_base[dsym] + GetBits(dist_extra[dsym]);
+
+		if(MARKED)
+		{
+			int64 src = (int64) o - dist;
+			if(src < -(int64) CInflateChunk::WINDOW_SIZE)
+				return false;
+			for(uint32 i = 0; i < len; ++i, ++src)
+			{
+				T v = src < 0 ? (T) (256 + CInflateChunk::WINDOW_SIZE + src) : p[src];
+				if(v >= 256)
+					marker_end = o + 1;
+				p[o++] = v;
+			}
+		}
+		else
+		{
+			if(dist > o)
+				return false;
+			T *s = p + o - dist;
+			T *d = p + o;
+			if(dist >= len)
+				memcpy(d, s, len * sizeof(T));
+			else
+				for(uint32 i = 0; i < len; ++i)
+					d[i] = s[i];
+			o += len;
+		}
+	}
+
+	out_size = o;
+
+	return true;
+}
+
+//----------------------------------------------------------------------------------
+template<typename T> bool CInflater::DecodeStored(vector<T> &out, uint64 &out_size)
+{
+	Seek((BitPos() + 7) & ~7ull);
+	uint32 len  = GetBits(16);
+	uint32 nlen = GetBits(16);
+	if(len != (~nlen & 0xffff))
+		return false;
+
+	uint64 byte_pos = BitPos() / 8;
+	if(byte_pos + len > size)
+	{
+		Seek((size + 1) * 8);
+		return false;
+	}
+
+	if(out_size + len > out.size())
+		out.resize(MAX(2 * out.size(), out_size + len + (1 << 20)));
+	for(uint32 i = 0; i < len; ++i)
+		out[out_size++] = data[byte_pos + i];
+	Seek((byte_pos + len) * 8);
+
+	return true;
+}
+
+//----------------------------------------------------------------------------------
+bool CInflater::IsDynamicBlockAt(uint64 bit)
+{
+	if(((bit + 2) >> 3) >= size)
+		return false;
+
+	return ((data[(bit + 1) >> 3] >> ((bit + 1) & 7)) & 1) == 0 && ((data[(bit + 2) >> 3] >> ((bit + 2) & 7)) & 1) == 1;
+}
+
+//----------------------------------------------------------------------------------
+// Decode blocks starting at the given bit up to the stop position
+// Returns false on error; then overrun tells whether the data ended and chunk->end_bit is the last block end reached
+bool CInflater::DecodeFrom(CInflateChunk *chunk, uint64 bit, bool &overrun)
+{
+	Seek(bit);
+	chunk->marked_size = 0;
+	chunk->plain_size  = 0;
+	chunk->end_bit     = bit;
+	chunk->final_block = false;
+	overrun = false;
+
+	uint64 marker_end = 0;
+	bool plain_mode = false;
+
+	while(true)
+	{
+		uint32 type;
+		bool ok = ReadBlockHeader(type);
+		if(ok)
+		{
+			if(type == 0)
+				ok = plain_mode ? DecodeStored(chunk->plain, chunk->plain_size) : DecodeStored(chunk->marked, chunk->marked_size);
+			else if(plain_mode)
+				ok = DecodeHuffman<uchar, false>(chunk->plain, chunk->plain_size, marker_end);
+			else
+				ok = DecodeHuffman<uint16, true>(chunk->marked, chunk->marked_size, marker_end);
+		}
+		if(!ok || Overrun())
+		{
+			overrun = Overrun();
+			return false;
+		}
+
+		uint64 b = BitPos();
+		chunk->end_bit = b;
+		if(last_block)
+		{
+			chunk->final_block = true;
+			return true;
+		}
+
+		// Switch to plain output when the last WINDOW_SIZE symbols contain no markers
+		if(!plain_mode && chunk->marked_size - marker_end >= CInflateChunk::WINDOW_SIZE)
+		{
+			if(chunk->plain.size() < CInflateChunk::WINDOW_SIZE + (1 << 20))
+				chunk->plain.resize(CInflateChunk::WINDOW_SIZE + (1 << 20));
+			copy(chunk->marked.begin() + (chunk->marked_size - CInflateChunk::WINDOW_SIZE), chunk->marked.begin() + chunk->marked_size, chunk->plain.begin());
+			chunk->plain_size = CInflateChunk::WINDOW_SIZE;
+			plain_mode = true;
+		}
+
+		if(chunk->marked_size + chunk->plain_size >= MAX_CHUNK_OUT_SIZE)
+			return true;
+		if(b >= chunk->stop_bit && IsDynamicBlockAt(b))
+			return true;
+	}
+}
+
+//----------------------------------------------------------------------------------
+// Find the first block of a chunk (unless known) and decode the chunk
+void CInflater::Decode(CInflateChunk *chunk)
+{
+	data = chunk->in.data();
+	size = chunk->in.size();
+	chunk->ok = false;
+
+	bool overrun;
+	if(chunk->known_start)
+	{
+		chunk->start_bit = chunk->search_bit;
+		chunk->ok = DecodeFrom(chunk, chunk->search_bit, overrun) || (overrun && chunk->end_bit > chunk->start_bit);
+	}
+	else
+	{
+		uint64 end_bit = MIN(chunk->stop_bit, size * 8);
+		for(uint64 bit = chunk->search_bit; bit < end_bit && !chunk->ok; ++bit)
+		{
+			// Quick check of BTYPE (dynamic), HLIT and HDIST
+			uint64 byte_pos = bit >> 3;
+			if(byte_pos + 8 > size)
+				break;
+			uint64 w;
+			memcpy(&w, data + byte_pos, 8);
+			w >>= bit & 7;
+			if(((w >> 1) & 3) != 2 || ((w >> 3) & 31) > 29 || ((w >> 8) & 31) > 29)
+				continue;
+
+			Seek(bit + 3);
+			if(!ReadDynamicTables())
+				continue;
+
+			chunk->start_bit = bit;
+			chunk->ok = DecodeFrom(chunk, bit, overrun) || (overrun && chunk->end_bit > bit);
+		}
+	}
+
+	if(chunk->ok)
+	{
+		chunk->start_bit += chunk->in_offset * 8;
+		chunk->end_bit   += chunk->in_offset * 8;
+	}
+}
+
+
+
+//************************************************************************************************************
+// CGzSpecReader - parallel decompression of a single gzip stream
+//************************************************************************************************************
+
+//----------------------------------------------------------------------------------
+// Constructor
+// Parameters:
+//    * _n_threads - no. of decompression threads
+CGzSpecReader::CGzSpecReader(uint32 _n_threads)
+{
+	n_threads = MAX(1u, _n_threads);
+	max_jobs  = n_threads + 2;
+
+	in        = NULL;
+	in_read   = 0;
+	in_eof    = false;
+	next_job_offset = 0;
+	finished  = false;
+
+	expected_bit = 0;
+	member_size  = 0;
+	member_crc   = crc32(0L, Z_NULL, 0);
+	window.resize(CInflateChunk::WINDOW_SIZE);
+	window_size  = 0;
+
+	out_buf_size   = 0;
+	out_buf_pos    = 0;
+	out_plain      = NULL;
+	out_plain_size = 0;
+	out_job        = NULL;
+
+	memset(&fb_strm, 0, sizeof(fb_strm));
+	fb_active = false;
+	fb_in_pos = 0;
+
+	eof = false;
+}
+
+//----------------------------------------------------------------------------------
+// Destructor - stop the workers and close the file
+CGzSpecReader::~CGzSpecReader()
+{
+	{
+		lock_guard<mutex> lck(mtx);
+		finished = true;
+	}
+	cv_to_do.notify_all();
+	for(auto &t : workers)
+		t.join();
+
+	for(auto job : jobs)
+		delete job;
+	for(auto job : free_jobs)
+		delete job;
+	if(out_job)
+		delete out_job;
+
+	if(in)
+	{
+		inflateEnd(&fb_strm);
+		fclose(in);
+	}
+}
+
+//----------------------------------------------------------------------------------
+// Estimate the amount of memory used by a single reader
+uint64 CGzSpecReader::MemoryUsage(uint32 _n_threads)
+{
+	if(_n_threads < 2)
+		return 0;
+
+	return (_n_threads + 2) * 7 * CHUNK_SIZE + (_n_threads + 4) * CHUNK_SIZE + FALLBACK_STEP;
+}
+
+//----------------------------------------------------------------------------------
+// Open the file and start the decompression threads
+bool CGzSpecReader::Open(const string &file_name)
+{
+	if(in)
+		return false;
+
+	if((in = fopen(file_name.c_str(), "rb")) == NULL)
+		return false;
+
+	uint64 header_end;
+	if(inflateInit2(&fb_strm, -15) != Z_OK || !ParseHeader(0, header_end))
+	{
+		fclose(in);
+		in = NULL;
+		return false;
+	}
+	expected_bit = header_end * 8;
+
+	for(uint32 i = 0; i < n_threads; ++i)
+		workers.push_back(thread(&CGzSpecReader::WorkerLoop, this));
+
+	return true;
+}
+
+//----------------------------------------------------------------------------------
+// Decompression thread
+void CGzSpecReader::WorkerLoop()
+{
+	CInflater inflater;
+
+	while(true)
+	{
+		CInflateChunk *job;
+		{
+			unique_lock<mutex> lck(mtx);
+			cv_to_do.wait(lck, [this]{return !this->jobs_to_do.empty() || this->finished;});
+			if(finished)
+				return;
+
+			job = jobs_to_do.front();
+			jobs_to_do.pop_front();
+			job->started = true;
+		}
+
+		inflater.Decode(job);
+
+		{
+			lock_guard<mutex> lck(mtx);
+			job->done = true;
+		}
+		cv_done.notify_all();
+	}
+}
+
+//----------------------------------------------------------------------------------
+// Read the next CHUNK_SIZE bytes of compressed data
+bool CGzSpecReader::ReadRawChunk()
+{
+	if(in_eof)
+		return false;
+
+	shared_ptr<CRawChunk> chunk(new CRawChunk);
+	chunk->offset = in_read;
+	chunk->data.resize(CHUNK_SIZE);
+	uint64 readed = fread(chunk->data.data(), 1, CHUNK_SIZE, in);
+	if(readed < CHUNK_SIZE)
+		in_eof = true;
+	if(!readed)
+		return false;
+
+	chunk->data.resize(readed);
+	in_read += readed;
+	raw_chunks.push_back(chunk);
+
+	return true;
+}
+
+//----------------------------------------------------------------------------------
+bool CGzSpecReader::GetByte(uint64 offset, uchar &c)
+{
+	while(offset >= in_read)
+		if(!ReadRawChunk())
+			return false;
+
+	for(auto &p : raw_chunks)
+		if(offset >= p->offset && offset < p->offset + p->data.size())
+		{
+			c = p->data[offset - p->offset];
+			return true;
+		}
+
+	return false;
+}
+
+//----------------------------------------------------------------------------------
+// Parse the gzip member header starting at offset
+bool CGzSpecReader::ParseHeader(uint64 offset, uint64 &header_end)
+{
+	uchar h[10];
+	for(uint32 i = 0; i < 10; ++i)
+		if(!GetByte(offset + i, h[i]))
+			return false;
+	if(h[0] != 0x1f || h[1] != 0x8b || h[2] != 8 || (h[3] & 0xe0))
+		return false;
+
+	uint64 pos = offset + 10;
+	uchar c, d;
+	if(h[3] & 4)						// FEXTRA
+	{
+		if(!GetByte(pos, c) || !GetByte(pos + 1, d))
+			return false;
+		pos += 2 + c + (d << 8);
+	}
+	for(uint32 flag = 8; flag <= 16; flag <<= 1)		// FNAME, FCOMMENT
+		if(h[3] & flag)
+			do {
+				if(!GetByte(pos++, c))
+					return false;
+			} while(c);
+	if(h[3] & 2)						// FHCRC
+		pos += 2;
+
+	header_end = pos;
+
+	return true;
+}
+
+//----------------------------------------------------------------------------------
+// Cut the compressed data into chunks and pass them to the workers
+void CGzSpecReader::CreateJobs()
+{
+	// Skip the chunks already decoded by zlib
+	while(next_job_offset + CHUNK_SIZE <= expected_bit / 8)
+		next_job_offset += CHUNK_SIZE;
+
+	// Release compressed data that are not necessary anymore
+	uint64 keep_from = MIN(expected_bit / 8, next_job_offset);
+	while(!raw_chunks.empty() && raw_chunks.front()->offset + raw_chunks.front()->data.size() <= keep_from)
+		raw_chunks.pop_front();
+
+	while(jobs.size() < max_jobs)
+	{
+		while(in_read < next_job_offset + 2 * CHUNK_SIZE && ReadRawChunk())
+			;
+		if(next_job_offset >= in_read)
+			break;
+
+		CInflateChunk *job;
+		if(free_jobs.empty())
+			job = new CInflateChunk;
+		else
+		{
+			job = free_jobs.front();
+			free_jobs.pop_front();
+		}
+
+		job->in_offset = next_job_offset;
+		job->in.clear();
+		for(auto &p : raw_chunks)
+			if(p->offset >= next_job_offset && p->offset < next_job_offset + 2 * CHUNK_SIZE)
+				job->in.insert(job->in.end(), p->data.begin(), p->data.end());
+
+		// The start is known if nothing is decoded before this chunk
+		job->known_start = jobs.empty() && !fb_active && expected_bit / 8 >= next_job_offset && expected_bit / 8 < next_job_offset + CHUNK_SIZE;
+		job->search_bit  = job->known_start ? expected_bit - next_job_offset * 8 : 0;
+		job->stop_bit    = CHUNK_SIZE * 8;
+		job->started     = false;
+		job->done        = false;
+		job->ok          = false;
+		next_job_offset += CHUNK_SIZE;
+
+		jobs.push_back(job);
+		{
+			lock_guard<mutex> lck(mtx);
+			jobs_to_do.push_back(job);
+		}
+		cv_to_do.notify_one();
+	}
+}
+
+//----------------------------------------------------------------------------------
+void CGzSpecReader::WaitForJob(CInflateChunk *job)
+{
+	unique_lock<mutex> lck(mtx);
+	cv_done.wait(lck, [job]{return job->done;});
+}
+
+//----------------------------------------------------------------------------------
+// Remove the front job (waiting for its worker if necessary)
+void CGzSpecReader::PopJob()
+{
+	CInflateChunk *job = jobs.front();
+	jobs.pop_front();
+
+	{
+		unique_lock<mutex> lck(mtx);
+		if(!job->started)
+			jobs_to_do.remove(job);
+		else
+			cv_done.wait(lck, [job]{return job->done;});
+	}
+
+	free_jobs.push_back(job);
+}
+
+//----------------------------------------------------------------------------------
+void CGzSpecReader::ReleaseOutJob()
+{
+	if(out_job)
+		free_jobs.push_back(out_job);
+	out_job = NULL;
+}
+
+//----------------------------------------------------------------------------------
+// Keep the last WINDOW_SIZE bytes of output and update the size and CRC32 of the member
+void CGzSpecReader::AppendToWindow(const uchar *p, uint64 n)
+{
+	const uint64 w = CInflateChunk::WINDOW_SIZE;
+
+	if(n >= w)
+	{
+		A_memcpy(window.data(), p + n - w, w);
+		window_size = (uint32) w;
+	}
+	else if(n)
+	{
+		memmove(window.data(), window.data() + n, w - n);
+		A_memcpy(window.data() + w - n, p, n);
+		window_size = (uint32) MIN(w, window_size + n);
+	}
+	member_size += (uint32) n;
+	member_crc = crc32(member_crc, p, (uInt) n);
+}
+
+//----------------------------------------------------------------------------------
+// Use the output of a job starting exactly at the expected position
+bool CGzSpecReader::AcceptJob(CInflateChunk *job)
+{
+	const uint32 w = CInflateChunk::WINDOW_SIZE;
+
+	// Replace markers by the window contents
+	if(out_buf.size() < job->marked_size)
+		out_buf.resize(job->marked_size);
+	for(uint64 i = 0; i < job->marked_size; ++i)
+	{
+		uint32 v = job->marked[i];
+		if(v >= 256)
+		{
+			v -= 256;
+			if(v < w - window_size)
+				return false;
+			v = window[v];
+		}
+		out_buf[i] = (uchar) v;
+	}
+	out_buf_size = job->marked_size;
+	out_buf_pos  = 0;
+	AppendToWindow(out_buf.data(), out_buf_size);
+
+	if(job->plain_size > w)
+	{
+		out_plain      = job->plain.data() + w;
+		out_plain_size = job->plain_size - w;
+		AppendToWindow(out_plain, out_plain_size);
+	}
+
+	out_job = job;
+	expected_bit = job->end_bit;
+	if(job->final_block)
+		FinishMember(job->end_bit);
+
+	return true;
+}
+
+//----------------------------------------------------------------------------------
+// Check the gzip trailer and look for the next member
+void CGzSpecReader::FinishMember(uint64 end_bit)
+{
+	uint64 offset = (end_bit + 7) / 8;
+	uchar t[8];
+	for(uint32 i = 0; i < 8; ++i)
+		if(!GetByte(offset + i, t[i]))
+		{
+			cout << "Error: Unexpected end of gzip file!\n";
+			exit(1);
+		}
+
+	uint32 crc   = t[0] + (t[1] << 8) + (t[2] << 16) + ((uint32) t[3] << 24);
+	uint32 isize = t[4] + (t[5] << 8) + (t[6] << 16) + ((uint32) t[7] << 24);
+	if(crc != (uint32) member_crc || isize != member_size)
+	{
+		cout << "Error: Corrupted gzip file!\n";
+		exit(1);
+	}
+
+	// Trailing garbage after the last member is ignored (as in gzread)
+	uint64 header_end;
+	if(!ParseHeader(offset + 8, header_end))
+	{
+		eof = true;
+		return;
+	}
+
+	expected_bit = header_end * 8;
+	member_size  = 0;
+	member_crc   = crc32(0L, Z_NULL, 0);
+	window_size  = 0;
+}
+
+//----------------------------------------------------------------------------------
+// Start decoding with zlib at the expected position
+void CGzSpecReader::StartFallback()
+{
+	inflateReset(&fb_strm);
+	if(window_size)
+		inflateSetDictionary(&fb_strm, window.data() + CInflateChunk::WINDOW_SIZE - window_size, window_size);
+
+	fb_in_pos = expected_bit / 8;
+	uint32 r = expected_bit % 8;
+	if(r)
+	{
+		uchar c;
+		if(!GetByte(fb_in_pos, c))
+		{
+			cout << "Error: Unexpected end of gzip file!\n";
+			exit(1);
+		}
+		inflatePrime(&fb_strm, 8 - r, c >> r);
+		++fb_in_pos;
+	}
+
+	fb_active = true;
+}
+
+//----------------------------------------------------------------------------------
+// Check whether a job starts at the block boundary reached by zlib
+bool CGzSpecReader::CheckFallbackBoundary(uint64 bit)
+{
+	while(!jobs.empty())
+	{
+		CInflateChunk *job = jobs.front();
+		if(bit < job->in_offset * 8)
+			return false;					// The job cannot start before its range
+
+		WaitForJob(job);
+		if(job->ok && job->start_bit == bit)
+			return true;
+		if(job->ok && job->start_bit > bit)
+			return false;
+		PopJob();
+	}
+
+	return false;
+}
+
+//----------------------------------------------------------------------------------
+// Decode the next part of data with zlib (up to the block boundary where a job starts)
+void CGzSpecReader::FallbackStep()
+{
+	if(out_buf.size() < FALLBACK_STEP)
+		out_buf.resize(FALLBACK_STEP);
+
+	uint64 produced = 0;
+	while(produced < FALLBACK_STEP && fb_active)
+	{
+		shared_ptr<CRawChunk> chunk;
+		while(!chunk)
+		{
+			for(auto &p : raw_chunks)
+				if(fb_in_pos >= p->offset && fb_in_pos < p->offset + p->data.size())
+					chunk = p;
+			if(!chunk && !ReadRawChunk())
+			{
+				cout << "Error: Unexpected end of gzip file!\n";
+				exit(1);
+			}
+		}
+
+		uint64 avail_in  = chunk->offset + chunk->data.size() - fb_in_pos;
+		uint64 avail_out = FALLBACK_STEP - produced;
+		fb_strm.next_in   = chunk->data.data() + (fb_in_pos - chunk->offset);
+		fb_strm.avail_in  = (uInt) avail_in;
+		fb_strm.next_out  = out_buf.data() + produced;
+		fb_strm.avail_out = (uInt) avail_out;
+
+		int ret = inflate(&fb_strm, Z_BLOCK);
+		fb_in_pos += avail_in - fb_strm.avail_in;
+		uint64 n = avail_out - fb_strm.avail_out;
+		AppendToWindow(out_buf.data() + produced, n);
+		produced += n;
+
+		if(ret == Z_STREAM_END)
+		{
+			fb_active = false;
+			FinishMember(fb_in_pos * 8 - (fb_strm.data_type & 7));
+			break;
+		}
+		if(ret != Z_OK && ret != Z_BUF_ERROR)
+		{
+			cout << "Error: Corrupted gzip file!\n";
+			exit(1);
+		}
+		if(fb_strm.data_type & 128)
+		{
+			expected_bit = fb_in_pos * 8 - (fb_strm.data_type & 7);
+			if(CheckFallbackBoundary(expected_bit))
+				fb_active = false;
+		}
+	}
+
+	out_buf_size = produced;
+	out_buf_pos  = 0;
+}
+
+//----------------------------------------------------------------------------------
+// Read decompressed data (in the file order)
+uint64 CGzSpecReader::Read(uchar *buf, uint64 size)
+{
+	uint64 filled = 0;
+
+	while(filled < size)
+	{
+		if(out_buf_pos < out_buf_size)
+		{
+			uint64 n = MIN(size - filled, out_buf_size - out_buf_pos);
+			A_memcpy(buf + filled, out_buf.data() + out_buf_pos, n);
+			filled      += n;
+			out_buf_pos += n;
+			continue;
+		}
+		if(out_plain_size)
+		{
+			uint64 n = MIN(size - filled, out_plain_size);
+			A_memcpy(buf + filled, out_plain, n);
+			filled         += n;
+			out_plain      += n;
+			out_plain_size -= n;
+			continue;
+		}
+
+		ReleaseOutJob();
+		if(eof)
+			break;
+
+		CreateJobs();
+		if(fb_active)
+		{
+			FallbackStep();
+			continue;
+		}
+
+		// Look for a job starting exactly at the expected position
+		bool accepted = false;
+		while(!jobs.empty() && !accepted)
+		{
+			CInflateChunk *job = jobs.front();
+			if(expected_bit < job->in_offset * 8)
+				break;
+
+			WaitForJob(job);
+			if(job->ok && job->start_bit == expected_bit)
+			{
+				jobs.pop_front();
+				if(!AcceptJob(job))
+				{
+					cout << "Error: Corrupted gzip file!\n";
+					exit(1);
+				}
+				accepted = true;
+			}
+			else if(!job->ok || job->start_bit < expected_bit)
+				PopJob();
+			else
+				break;
+		}
+
+		if(!accepted && !eof)
+			StartFallback();
+	}
+
+	return filled;
+}
+
+// ***** EOF
@@ -0,0 +1,177 @@
+/*
+  This file is a part of KMC software distributed under GNU GPL 3 licence.
+  The homepage of the KMC project is http://sun.aei.polsl.pl/kmc
+
+  Authors: Sebastian Deorowicz, Agnieszka Debudaj-Grabysz, Marek Kokot
+
+  Version: 2.0
+  Date   : 2014-07-04
+*/
+
+#ifndef _GZ_SPEC_READER_H
+#define _GZ_SPEC_READER_H
+
+#include "defs.h"
+#include "queues.h"
+#include <stdio.h>
+#include <string>
+#include <vector>
+#include <list>
+#include <deque>
+#include <memory>
+
+#include "libs/zlib.h"
+
+using namespace std;
+
+//************************************************************************************************************
+// CInflateChunk - speculatively decoded part of a deflate stream
+// Back-references to the (yet unknown) 32KB window preceding the chunk are stored as markers: 256 + position
+// in the window. When the previous data are known, the markers are replaced by the window contents.
+//************************************************************************************************************
+struct CInflateChunk {
+	static const uint32 WINDOW_SIZE = 1 << 15;
+
+	vector<uchar> in;					// compressed data (the chunk range and a lookahead)
+	uint64 in_offset;					// position of in[0] in the file
+	uint64 search_bit;					// where to look for the first block (relative to in_offset)
+	uint64 stop_bit;					// decode up to the first dynamic block starting at or after this position
+	bool known_start;					// search_bit is a verified block start
+
+	bool started, done;
+	bool ok;
+	uint64 start_bit, end_bit;			// absolute bit positions of the decoded range
+	bool final_block;					// the decoded range ends with the last block of a deflate stream
+
+	vector<uint16> marked;				// output that may contain markers
+	uint64 marked_size;
+	vector<uchar> plain;				// output after the first WINDOW_SIZE bytes free of markers (preceded by these bytes)
+	uint64 plain_size;
+};
+
+//************************************************************************************************************
+// CInflater - deflate decoder producing marked output
+//************************************************************************************************************
+class CInflater {
+	struct CHuffTable {
+		vector<uint16> table;			// (symbol << 4) + code length, indexed by reversed code
+		uint32 bits;
+	};
+
+	const uchar *data;
+	uint64 size;
+	uint64 pos;							// next byte to load to the bit buffer
+	uint64 bit_buf;
+	uint32 bit_cnt;
+
+	CHuffTable lit_table, dist_table, cl_table;
+	bool last_block;
+
+	static const uint16 len_base[29], len_extra[29], dist_base[30], dist_extra[30];
+	static const uchar cl_order[19];
+
+	inline void Refill();
+	inline uint32 GetBits(uint32 n);
+	inline bool DecodeSymbol(const CHuffTable &t, uint32 &sym);
+	uint64 BitPos() { return pos * 8 - bit_cnt; }
+	bool Overrun() { return pos * 8 > size * 8 + bit_cnt; }
+	void Seek(uint64 bit);
+
+	static bool BuildTable(const uchar *lens, uint32 n, CHuffTable &t, bool allow_incomplete);
+	bool ReadDynamicTables();
+	void SetFixedTables();
+	bool ReadBlockHeader(uint32 &type);
+
+	template<typename T, bool MARKED> bool DecodeHuffman(vector<T> &out, uint64 &out_size, uint64 &last_marker);
+	template<typename T> bool DecodeStored(vector<T> &out, uint64 &out_size);
+	bool IsDynamicBlockAt(uint64 bit);
+	bool DecodeFrom(CInflateChunk *chunk, uint64 bit, bool &overrun);
+
+public:
+	static const uint64 MAX_CHUNK_OUT_SIZE = 64 << 20;
+
+	void Decode(CInflateChunk *chunk);
+};
+
+//************************************************************************************************************
+// CGzSpecReader - parallel decompression of a single gzip stream
+// The file is cut into chunks; workers find the first deflate block of a chunk and decode it speculatively.
+// A chunk is used only if it starts exactly where the previous data ended; the gaps are decoded by zlib.
+//************************************************************************************************************
+class CGzSpecReader {
+	struct CRawChunk {
+		uint64 offset;
+		vector<uchar> data;
+	};
+
+	static const uint64 CHUNK_SIZE = 4 << 20;
+	static const uint64 FALLBACK_STEP = 1 << 22;
+
+	FILE *in;
+	uint32 n_threads;
+	uint32 max_jobs;
+
+	deque<shared_ptr<CRawChunk>> raw_chunks;		// compressed data not processed by the consumer yet
+	uint64 in_read;
+	bool in_eof;
+	uint64 next_job_offset;
+
+	list<CInflateChunk*> jobs;
+	list<CInflateChunk*> jobs_to_do;
+	list<CInflateChunk*> free_jobs;
+	bool finished;
+
+	uint64 expected_bit;				// where the next output begins in the compressed stream
+	uint32 member_size;					// no. of bytes decompressed from the current member (mod 2^32)
+	uLong member_crc;					// CRC32 of the bytes decompressed from the current member
+	vector<uchar> window;				// last WINDOW_SIZE bytes of output (right-aligned)
+	uint32 window_size;
+
+	vector<uchar> out_buf;				// decompressed data ready to be read
+	uint64 out_buf_size;
+	uint64 out_buf_pos;
+	const uchar *out_plain;
+	uint64 out_plain_size;
+	CInflateChunk *out_job;
+
+	z_stream fb_strm;					// zlib stream used for the gaps between chunks
+	bool fb_active;
+	uint64 fb_in_pos;
+
+	bool eof;
+
+	vector<thread> workers;
+	mutex mtx;
+	condition_variable cv_to_do, cv_done;
+
+	void WorkerLoop();
+	bool ReadRawChunk();
+	bool GetByte(uint64 offset, uchar &c);
+	void CreateJobs();
+	void WaitForJob(CInflateChunk *job);
+	void PopJob();
+	void ReleaseOutJob();
+	void AppendToWindow(const uchar *p, uint64 n);
+	bool AcceptJob(CInflateChunk *job);
+	void StartFallback();
+	void FallbackStep();
+	bool CheckFallbackBoundary(uint64 bit);
+	void FinishMember(uint64 end_bit);
+	bool ParseHeader(uint64 offset, uint64 &header_end);
+
+public:
+	static const uint64 MIN_FILE_SIZE = 64 << 20;
+
+	CGzSpecReader(uint32 _n_threads);
+	~CGzSpecReader();
+
+	static uint64 MemoryUsage(uint32 _n_threads);
+
+	bool Open(const string &file_name);
+	uint64 Read(uchar *buf, uint64 size);
+	bool Eof() { return eof && out_buf_pos == out_buf_size && !out_plain_size; }
+};
+
+#endif
+
+// ***** EOF
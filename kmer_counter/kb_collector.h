@@ -17,6 +17,7 @@
 #include "queues.h"
 #include "radix.h"
 #include "rev_byte.h"
+#include "seq_encoder.h"
 #include <string>
 #include <algorithm>
 #include <numeric>
@@ -50,9 +51,11 @@ class CKmerBinCollector
 	uint32 kmer_bytes;
 	bool both_strands;
 
-	template<unsigned DIVIDE_FACTOR> void update_n_plus_x_recs(char* seq, uint32 n);
+	template<unsigned DIVIDE_FACTOR> static uint32 count_n_plus_x_recs(char* seq, uint32 n, uint32 kmer_len);
 
 public:
+	static uint32 CountPlusXRecs(char* seq, uint32 n, uint32 kmer_len, uint32 max_x, bool both_strands);
+
 	CKmerBinCollector(CKMCQueues& Queues, CKMCParams& Params, uint32 _buffer_size, uint32 _bin_no);
 	void PutExtendedKmer(char* seq, uint32 n);
 	void PutExtendedKmer(char* seq, char* quals, uint32 n);//for quake mode
@@ -101,8 +104,8 @@ void CKmerBinCollector::PutExtendedKmer(char* seq, uint32 n)
 	
 	
 	buffer[buffer_pos++] = n - kmer_len;		
-	for(uint32 i = 0, j = 0 ; i < n / 4 ; ++i,j+=4)
-		buffer[buffer_pos++] = (seq[j] << 6) + (seq[j + 1] << 4) + (seq[j + 2] << 2) + seq[j + 3];
+	CSeqEncoder::Pack(seq, n, buffer + buffer_pos);
+	buffer_pos += n / 4;
 	switch (n%4)
 	{
 	case 1:
@@ -119,29 +122,35 @@ void CKmerBinCollector::PutExtendedKmer(char* seq, uint32 n)
 	++n_super_kmers;
 	n_recs += n - kmer_len + 1;
 	if (max_x) ///for max_x = 0 k-mers (not k+x-mers) will be sorted
+		n_plus_x_recs += CountPlusXRecs(seq, n, kmer_len, max_x, both_strands);
+}
+
+//---------------------------------------------------------------------------------
+// Return the number of records (k+x-mers or k-mers for max_x = 0) that will be sorted for a super-k-mer
+uint32 CKmerBinCollector::CountPlusXRecs(char* seq, uint32 n, uint32 kmer_len, uint32 max_x, bool both_strands)
+{
+	if (!max_x)
+		return n - kmer_len + 1;
+	if (!both_strands)
+		return 1 + (n - kmer_len) / (max_x + 1);
+
+	switch (max_x)
 	{
-		if (!both_strands)
-			n_plus_x_recs += 1 + (n - kmer_len) / (max_x + 1);
-		else
-		{
-			switch (max_x)
-			{
-			case 1: update_n_plus_x_recs<2>(seq, n); break;
-			case 2: update_n_plus_x_recs<3>(seq, n); break;
-			case 3: update_n_plus_x_recs<4>(seq, n); break;
-			}
-			
-		}
+	case 1: return count_n_plus_x_recs<2>(seq, n, kmer_len);
+	case 2: return count_n_plus_x_recs<3>(seq, n, kmer_len);
+	case 3: return count_n_plus_x_recs<4>(seq, n, kmer_len);
 	}
+	return 0;
 }
 
 //---------------------------------------------------------------------------------
-template<unsigned DIVIDE_FACTOR> void CKmerBinCollector::update_n_plus_x_recs(char* seq, uint32 n)
+template<unsigned DIVIDE_FACTOR> uint32 CKmerBinCollector::count_n_plus_x_recs(char* seq, uint32 n, uint32 kmer_len)
 {
 	uchar kmer, rev;
 	uint32 kmer_pos = 4;
 	uint32 rev_pos = kmer_len;
 	uint32 x;
+	uint32 n_plus_x_recs = 0;
 
 	kmer = (seq[0] << 6) + (seq[1] << 4) + (seq[2] << 2) + seq[3];
 	rev = ((3 - seq[kmer_len - 1]) << 6) + ((3 - seq[kmer_len - 2]) << 4) + ((3 - seq[kmer_len - 3]) << 2) + (3 - seq[kmer_len - 4]);
@@ -186,6 +195,7 @@ template<unsigned DIVIDE_FACTOR> void CKmerBinCollector::update_n_plus_x_recs(ch
 		}
 	}
 	n_plus_x_recs += 1 + x / DIVIDE_FACTOR;
+	return n_plus_x_recs;
 }
 
 //---------------------------------------------------------------------------------
@@ -39,6 +39,7 @@ CKmerBinCompleter::CKmerBinCompleter(CKMCParams &Params, CKMCQueues &Queues)
 
 	kmer_len       = Params.kmer_len;
 	signature_len  = Params.signature_len;
+	sig_order	   = Params.sig_order;
 
 	cutoff_min     = Params.cutoff_min;
 	cutoff_max     = Params.cutoff_max;
@@ -67,7 +68,7 @@ void CKmerBinCompleter::ProcessBins()
 	uint64 counter_size = 0;
 	uint32 sig_map_size = (1 << (signature_len * 2)) + 1;
 	uint32 *sig_map = new uint32[sig_map_size];
-	fill_n(sig_map, sig_map_size, 0);
+	vector<uint32> bin_lut_pos(s_mapper->get_max_bin_no() + 1, 0);
 	uint32 lut_pos = 0;
 	if(use_quake)
 		counter_size = 4;
@@ -143,14 +144,14 @@ void CKmerBinCompleter::ProcessBins()
 		n_cutoff_min += _n_cutoff_min;
 		n_cutoff_max += _n_cutoff_max;
 		n_total      += _n_total;
-		for (uint32 i = 0; i < sig_map_size; ++i)
-		{
-			if (s_mapper->get_bin_id(i) == bin_id)
-			{
-				sig_map[i] = lut_pos;
-			}
-		}
-		++lut_pos;
+		bin_lut_pos[bin_id] = lut_pos++;
+	}
+
+	// Position of the LUT of the bin of each signature
+	for (uint32 i = 0; i < sig_map_size; ++i)
+	{
+		int32 bin_id = s_mapper->get_bin_id(i);
+		sig_map[i] = bin_id >= 0 ? bin_lut_pos[bin_id] : 0;
 	}
 	
 	// Marker at the end
@@ -173,9 +174,10 @@ void CKmerBinCompleter::ProcessBins()
 	store_uint(out_lut, cutoff_min, 4);				offset += 4;
 	store_uint(out_lut, cutoff_max, 4);				offset += 4;
 	store_uint(out_lut, n_unique - n_cutoff_min - n_cutoff_max, 8);		offset += 8;
+	store_uint(out_lut, (uint32) sig_order, 4);		offset += 4;	// signature order: 0 (lexicographic), 1 (hash)
 
 	// Space for future use
-	for(int32 i = 0; i < 7; ++i)
+	for(int32 i = 0; i < 6; ++i)
 	{
 		store_uint(out_lut, 0, 4);
 		offset += 4;
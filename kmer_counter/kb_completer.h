@@ -39,6 +39,7 @@ class CKmerBinCompleter {
 	int32 counter_max;
 	int32 kmer_len;
 	int32 signature_len;
+	signature_order sig_order;
 	bool use_quake;
 
 	bool store_uint(FILE *out, uint64 x, uint32 size);
@@ -16,6 +16,7 @@
 #include "kmer.h"
 #include "s_mapper.h"
 #include "radix.h"
+#include "libs/zlib.h"
 #include <string>
 #include <algorithm>
 #include <numeric>
@@ -43,16 +44,25 @@ template <typename KMER_T, unsigned SIZE> class CKmerBinReader {
 	int32 lut_prefix_len;
 	uint32 max_x;
 
+	int dir_id;						// the reader reads the bins from this working directory
+	uint64 read_ahead;				// total size of the next bins announced to the OS for reading
+
 	bool both_strands;
 	bool use_quake;
 
+	bool compressed;
+	z_stream z_strm;
+	vector<uchar> comp_buff;
+
 	int64 round_up_to_alignment(int64 x)
 	{
 		return (x + ALIGNMENT-1) / ALIGNMENT * ALIGNMENT;
 	}
 
+	bool ReadCompressed(CMemDiskFile *file, uchar *data, uint64 size);
+
 public:
-	CKmerBinReader(CKMCParams &Params, CKMCQueues &Queues);
+	CKmerBinReader(CKMCParams &Params, CKMCQueues &Queues, int _dir_id);
 	~CKmerBinReader();
 
 	void ProcessBins();
@@ -61,7 +71,7 @@ public:
 
 //----------------------------------------------------------------------------------
 // Assign monitors and queues
-template <typename KMER_T, unsigned SIZE> CKmerBinReader<KMER_T, SIZE>::CKmerBinReader(CKMCParams &Params, CKMCQueues &Queues)
+template <typename KMER_T, unsigned SIZE> CKmerBinReader<KMER_T, SIZE>::CKmerBinReader(CKMCParams &Params, CKMCQueues &Queues, int _dir_id)
 {
 	mm = Queues.mm;
 //	dm = Queues.dm;
@@ -81,15 +91,70 @@ template <typename KMER_T, unsigned SIZE> CKmerBinReader<KMER_T, SIZE>::CKmerBin
 	max_x = Params.max_x;
 	s_mapper	   = Queues.s_mapper;
 	lut_prefix_len = Params.lut_prefix_len;
+	dir_id		   = _dir_id;
+	read_ahead	   = Params.max_mem_stage2;
+
+	compressed = Params.tmp_compress;
+	if(compressed)
+	{
+		z_strm.zalloc = Z_NULL;
+		z_strm.zfree  = Z_NULL;
+		z_strm.opaque = Z_NULL;
+		z_strm.next_in  = Z_NULL;
+		z_strm.avail_in = 0;
+		if(inflateInit(&z_strm) != Z_OK)
+		{
+			cout << "Error: Cannot initialize decompression of temporary files\n";
+			exit(1);
+		}
+	}
 }
 
 //----------------------------------------------------------------------------------
 template <typename KMER_T, unsigned SIZE> CKmerBinReader<KMER_T, SIZE>::~CKmerBinReader()
 {
+	if(compressed)
+		inflateEnd(&z_strm);
+}
+
+//----------------------------------------------------------------------------------
+// Read a bin written in compressed chunks (see CKmerBinStorer::WriteCompressed) directly into the input buffer
+template <typename KMER_T, unsigned SIZE> bool CKmerBinReader<KMER_T, SIZE>::ReadCompressed(CMemDiskFile *file, uchar *data, uint64 size)
+{
+	uint32 header[2];
+
+	for(uint64 pos = 0; pos < size; pos += header[0])
+	{
+		if(file->Read((uchar *) header, 1, sizeof(header)) != sizeof(header) || !header[0] || pos + header[0] > size)
+			return false;
+
+		// Stored chunk
+		if(header[1] == header[0])
+		{
+			if(file->Read(data + pos, 1, header[0]) != header[0])
+				return false;
+			continue;
+		}
+
+		if(comp_buff.size() < header[1])
+			comp_buff.resize(header[1]);
+		if(file->Read(comp_buff.data(), 1, header[1]) != header[1])
+			return false;
+
+		inflateReset(&z_strm);
+		z_strm.next_in   = comp_buff.data();
+		z_strm.avail_in  = header[1];
+		z_strm.next_out  = data + pos;
+		z_strm.avail_out = header[0];
+		if(inflate(&z_strm, Z_FINISH) != Z_STREAM_END || z_strm.total_out != header[0])
+			return false;
+	}
+
+	return true;
 }
 
 //----------------------------------------------------------------------------------
-// Read all bins from temporary HDD
+// Read all bins of the working directory from temporary HDD
 template <typename KMER_T, unsigned SIZE> void CKmerBinReader<KMER_T, SIZE>::ProcessBins()
 {
 	uchar *data;
@@ -104,9 +169,13 @@ template <typename KMER_T, unsigned SIZE> void CKmerBinReader<KMER_T, SIZE>::Pro
 	uint32 buffer_size;
 	uint32 kmer_len;
 
-	bd->init_random();
-	while((bin_id = bd->get_next_random_bin()) >= 0)		// Get id of the next bin to read
+	vector<CMemDiskFile*> to_prefetch;
+	while((bin_id = bd->get_next_scheduled_bin(dir_id, read_ahead, to_prefetch)) >= 0)		// Get id of the next bin to read
 	{
+		// The next bins are read in the background, so the sorters do not wait for the disk
+		for(auto p = to_prefetch.begin(); p != to_prefetch.end(); ++p)
+			(*p)->Advise(true);
+
 		bd->read(bin_id, file, name, size, n_rec, n_plus_x_recs, buffer_size, kmer_len);
 #ifdef DEBUG_MODE
 		cout << bin_id << ":  " << name << "  " << c_disk << "  " << size << "  " << n_rec << "\n";
@@ -147,7 +216,16 @@ template <typename KMER_T, unsigned SIZE> void CKmerBinReader<KMER_T, SIZE>::Pro
 		uint64 lut_recs = 1 << (2 * lut_prefix_len);
 		uint64 lut_size = lut_recs * sizeof(uint64);
 
-		memory_bins->init(bin_id, rec_len, round_up_to_alignment(size), round_up_to_alignment(input_kmer_size), round_up_to_alignment(out_buffer_size), round_up_to_alignment(kxmer_counter_size), round_up_to_alignment(lut_size));
+		// Bins kept in memory (RAM-only and hybrid modes) are expanded by the sorters directly from their chunks,
+		// so no input file buffer is needed for them
+		bool in_memory = file != NULL && file->InMemory();
+		memory_bins->init(bin_id, rec_len, in_memory ? 0 : round_up_to_alignment(size), round_up_to_alignment(input_kmer_size), round_up_to_alignment(out_buffer_size), round_up_to_alignment(kxmer_counter_size), round_up_to_alignment(lut_size));
+
+		if(in_memory)
+		{
+			bq->push(bin_id, NULL, size, n_rec);
+			continue;				// the sorter releases the chunks
+		}
 
 		// Process the bin if it is not empty
 		if(size > 0)
@@ -161,8 +239,19 @@ template <typename KMER_T, unsigned SIZE> void CKmerBinReader<KMER_T, SIZE>::Pro
 				file->Rewind();
 
 			memory_bins->reserve(bin_id, data, CMemoryBins::mba_input_file);
-			//readed = fread(data, 1, size, file);
-			readed = file->Read(data, 1, size);
+			if(compressed)
+			{
+				if(!ReadCompressed(file, data, size))
+				{
+					cout << "Error: Corrupted file: " << name << "\n";
+					fflush(stdout);
+					exit(1);
+				}
+				readed = size;
+			}
+			else
+				//readed = fread(data, 1, size, file);
+				readed = file->Read(data, 1, size);
 			if(readed != size)
 			{
 				cout << "Error: Corrupted file: " << name << "   " << "Real size : " << readed << "   " << "Should be : " << size << "\n";
@@ -170,6 +259,9 @@ template <typename KMER_T, unsigned SIZE> void CKmerBinReader<KMER_T, SIZE>::Pro
 				exit(1);
 			}
 
+			// The data are in memory now, so the cached pages of the file can be dropped
+			file->Advise(false);
+
 			// Push bin data to a queue of bins to process
 			bq->push(bin_id, data, size, n_rec);
 		}
@@ -196,7 +288,7 @@ template <typename KMER_T, unsigned SIZE> class CWKmerBinReader {
 	CKmerBinReader<KMER_T, SIZE> *kbr;
 
 public:
-	CWKmerBinReader(CKMCParams &Params, CKMCQueues &Queues);
+	CWKmerBinReader(CKMCParams &Params, CKMCQueues &Queues, int _dir_id);
 	~CWKmerBinReader();
 
 	void operator()();
@@ -204,9 +296,9 @@ public:
 
 //----------------------------------------------------------------------------------
 // Constructor
-template <typename KMER_T, unsigned SIZE> CWKmerBinReader<KMER_T, SIZE>::CWKmerBinReader(CKMCParams &Params, CKMCQueues &Queues)
+template <typename KMER_T, unsigned SIZE> CWKmerBinReader<KMER_T, SIZE>::CWKmerBinReader(CKMCParams &Params, CKMCQueues &Queues, int _dir_id)
 {
-	kbr = new CKmerBinReader<KMER_T, SIZE>(Params, Queues);
+	kbr = new CKmerBinReader<KMER_T, SIZE>(Params, Queues, _dir_id);
 }
 
 //----------------------------------------------------------------------------------
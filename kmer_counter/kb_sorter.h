@@ -44,6 +44,8 @@ template <typename KMER_T, unsigned SIZE> class CKmerBinSorter {
 	CKmerQueue *kq;
 	CMemoryPool *pmm_prob, *pmm_radix_buf, *pmm_expand;
 	CMemoryBins *memory_bins;	
+	CTaskPool *task_pool;
+	uint32 task_slot;						// deque of the sorter in the task pool
 
 	CKXmerSet<KMER_T, SIZE> kxmer_set;	
 
@@ -51,6 +53,7 @@ template <typename KMER_T, unsigned SIZE> class CKmerBinSorter {
 	int32 bin_id;
 	
 	uchar *data;
+	vector<pair<uchar*, uint64>> chunks;		// input of the bin: data read from the file or chunks kept in memory
 	uint64 size;
 	uint64 n_rec;
 	uint64 n_plus_x_recs;
@@ -62,9 +65,6 @@ template <typename KMER_T, unsigned SIZE> class CKmerBinSorter {
 	//KMC_2 : usunac te zmienne potem
 	uint64 sum_n_rec, sum_n_plus_x_rec;
 
-	//
-	int n_omp_threads;
-
 	bool both_strands;
 	bool use_quake;
 	CSignatureMapper* s_mapper;
@@ -228,7 +228,8 @@ template <typename KMER_T, unsigned SIZE> CKmerBinSorter<KMER_T, SIZE>::CKmerBin
 	
 	lut_prefix_len = Params.lut_prefix_len;
 
-	n_omp_threads = Params.n_omp_threads[thread_no];
+	task_pool = Queues.task_pool;
+	task_slot = task_pool->ClientSlot(thread_no);
 
 	sum_n_rec = sum_n_plus_x_rec = 0;
 }
@@ -262,10 +263,18 @@ template <typename KMER_T, unsigned SIZE> void CKmerBinSorter<KMER_T, SIZE>::Pro
 		bd->read(bin_id, file, desc, tmp_size, tmp_n_rec, n_plus_x_recs, buffer_size, kmer_len);
 
 
+		chunks.clear();
+		if(file->InMemory())
+			chunks = file->Chunks();
+		else if(tmp_size)
+			chunks.push_back(make_pair(data, tmp_size));
+
 		// Uncompact the kmers - append truncate prefixes
 		//Expand(tmp_size);
 		CKmerBinSorter_Impl<KMER_T, SIZE>::Expand(*this, tmp_size);
 		memory_bins->free(bin_id, CMemoryBins::mba_input_file);
+		if(file->InMemory())
+			file->Close();
 
 		// Perfor sorting of kmers in a bin
 		Sort();
@@ -293,7 +302,6 @@ template <unsigned SIZE> inline void CKmerBinSorter_Impl<CKmer<SIZE>, SIZE>::Get
 template <unsigned SIZE> void CKmerBinSorter_Impl<CKmer<SIZE>, SIZE>::ExpandKmersAll(CKmerBinSorter<CKmer<SIZE>, SIZE>& ptr, uint64 tmp_size)
 {
 	uint64 pos = 0;
-	ptr.input_pos = 0;
 	CKmer<SIZE> kmer;
 	kmer.clear();
 	uint32 kmer_bytes = (ptr.kmer_len + 3) / 4;
@@ -350,7 +358,6 @@ template <unsigned SIZE> void CKmerBinSorter_Impl<CKmer<SIZE>, SIZE>::ExpandKmer
 	CKmer<SIZE> kmer_mask;
 	kmer_mask.set_n_1(ptr.kmer_len * 2);
 	uchar *data_p = ptr.data;
-	ptr.input_pos = 0;
 	uint32 kmer_shr = SIZE * 32 - ptr.kmer_len;
 
 	uchar additional_symbols;
@@ -588,37 +595,35 @@ template<unsigned SIZE> void CKmerBinSorter_Impl<CKmer<SIZE>, SIZE>::ExpandKxmer
 
 template <unsigned SIZE> void CKmerBinSorter_Impl<CKmer<SIZE>, SIZE>::ExpandKxmersBoth(CKmerBinSorter<CKmer<SIZE>, SIZE>& ptr, uint64 tmp_size)
 {	
-	ptr.input_pos = 0;
-	uint32 threads = ptr.n_omp_threads;
+	uint32 parts = ptr.task_pool->NoThreads();
 
-	uint64 bytes_per_thread = (tmp_size + threads - 1) / threads;
-	uint32 thread_no = 0;
-	vector<thread> exp_threads;
+	// Parts of the bin are expanded by tasks of the shared pool
+	uint64 bytes_per_part = (tmp_size + parts - 1) / parts;
+	uint32 part_no = 0;
+	CTaskGroup group;
 	uint64 start = 0;
 	uint64 pos = 0;
 	for (; pos < tmp_size; pos += 1 + (ptr.data[pos] + ptr.kmer_len + 3) / 4)
 	{
-		if ((thread_no + 1) * bytes_per_thread <= pos)
+		if ((part_no + 1) * bytes_per_part <= pos)
 		{
-			exp_threads.push_back(thread(ExpandKxmerBothParaller, std::ref(ptr), start, pos));
+			ptr.task_pool->Run(ptr.task_slot, group, std::bind(ExpandKxmerBothParaller, std::ref(ptr), start, pos));
 			start = pos;
-			++thread_no;
+			++part_no;
 		}
 	}
 	if (start < pos)
 	{
-		exp_threads.push_back(thread(ExpandKxmerBothParaller, std::ref(ptr), start, tmp_size));
+		ptr.task_pool->Run(ptr.task_slot, group, std::bind(ExpandKxmerBothParaller, std::ref(ptr), start, tmp_size));
 	}
 
-	for (auto& p : exp_threads)
-		p.join();
+	ptr.task_pool->Wait(ptr.task_slot, group);
 
 	ptr.n_plus_x_recs = ptr.input_pos;// !!!!!!!!		
 }
 
 template<unsigned SIZE> void CKmerBinSorter_Impl<CKmer<SIZE>, SIZE>::ExpandKxmersAll(CKmerBinSorter<CKmer<SIZE>, SIZE>& ptr, uint64 tmp_size)
 {
-	ptr.input_pos = 0;
 	uint64 pos = 0;
 	CKmer<SIZE> kmer_mask;
 
@@ -714,27 +719,34 @@ template <unsigned SIZE> void CKmerBinSorter_Impl<CKmer<SIZE>, SIZE>::Expand(CKm
 	ptr.buffer_input = (CKmer<SIZE> *) raw_buffer_input;
 	ptr.buffer_tmp = (CKmer<SIZE> *) raw_buffer_tmp;
 
-	if (ptr.max_x)
-	{
-		if (ptr.both_strands)
-			ExpandKxmersBoth(ptr, tmp_size);
-		else
-			ExpandKxmersAll(ptr, tmp_size);
-	}
-	else
+	// The chunks contain whole super k-mers, so they are expanded one by one
+	ptr.input_pos = 0;
+	for (auto& chunk : ptr.chunks)
 	{
-		if (ptr.both_strands)
-			ExpandKmersBoth(ptr, tmp_size);
+		ptr.data = chunk.first;
+		if (ptr.max_x)
+		{
+			if (ptr.both_strands)
+				ExpandKxmersBoth(ptr, chunk.second);
+			else
+				ExpandKxmersAll(ptr, chunk.second);
+		}
 		else
-			ExpandKmersAll(ptr, tmp_size);
+		{
+			if (ptr.both_strands)
+				ExpandKmersBoth(ptr, chunk.second);
+			else
+				ExpandKmersAll(ptr, chunk.second);
+		}
 	}
+	if (ptr.max_x && ptr.both_strands)
+		ptr.n_plus_x_recs = ptr.input_pos;
 }
 
 
 //----
 template <unsigned SIZE> void CKmerBinSorter_Impl<CKmerQuake<SIZE>, SIZE>::Expand(CKmerBinSorter<CKmerQuake<SIZE>, SIZE>& ptr, uint64 tmp_size)
 {
-	uchar *data_p = ptr.data;
 	uchar *raw_buffer_input, *raw_buffer_tmp;
 
 	ptr.memory_bins->reserve(ptr.bin_id, raw_buffer_input, CMemoryBins::mba_input_array);
@@ -752,97 +764,103 @@ template <unsigned SIZE> void CKmerBinSorter_Impl<CKmerQuake<SIZE>, SIZE>::Expan
 	kmer_mask.set_n_1(ptr.kmer_len * 2);
 
 	ptr.input_pos = 0;
-	uint64 pos = 0;
 
 	double *inv_probs;
 	ptr.pmm_prob->reserve(inv_probs);
 	double kmer_prob;
 	uchar qual, symb;
 	uint32 inv_probs_pos;
-	if (ptr.both_strands)
-		while (pos < tmp_size)
-		{
-			uchar additional_symbols = data_p[pos++];
-			inv_probs_pos = 0;
-			kmer_prob = 1.0;
-			
-			for (uint32 i = 0; i < ptr.kmer_len; ++i)
-			{
-				symb = (data_p[pos] >> 6) & 3;
-				qual = data_p[pos++] & 63;
-
-				inv_probs[inv_probs_pos++] = inv_prob_qual[qual];
+	// The chunks contain whole super k-mers, so they are expanded one by one
+	for (auto& chunk : ptr.chunks)
+	{
+		uchar *data_p = chunk.first;
+		uint64 pos = 0;
 
-				current_kmer.SHL_insert_2bits(symb);
-				kmer_rev.SHR_insert_2bits(3 - symb, kmer_len_shift);
-				kmer_prob *= prob_qual[qual];
-			}
-			current_kmer.mask(kmer_mask);			
-			if (kmer_prob >= MIN_PROB_QUAL_VALUE)
-			{
-				kmer_can = current_kmer < kmer_rev ? current_kmer : kmer_rev;
-				kmer_can.quality = (float)kmer_prob;
-				ptr.buffer_input[ptr.input_pos++].set(kmer_can);
-			}
-			for (uint32 i = 0; i < additional_symbols; ++i)
+		if (ptr.both_strands)
+			while (pos < chunk.second)
 			{
-				symb = (data_p[pos] >> 6) & 3;
-				qual = data_p[pos++] & 63;
+				uchar additional_symbols = data_p[pos++];
+				inv_probs_pos = 0;
+				kmer_prob = 1.0;
+			
+				for (uint32 i = 0; i < ptr.kmer_len; ++i)
+				{
+					symb = (data_p[pos] >> 6) & 3;
+					qual = data_p[pos++] & 63;
 
-				current_kmer.SHL_insert_2bits(symb);
-				current_kmer.mask(kmer_mask);
-				kmer_rev.SHR_insert_2bits(3 - symb, kmer_len_shift);
-				
-				kmer_prob *= prob_qual[qual] * inv_probs[inv_probs_pos - ptr.kmer_len];
-				inv_probs[inv_probs_pos++] = inv_prob_qual[qual];
+					inv_probs[inv_probs_pos++] = inv_prob_qual[qual];
+
+					current_kmer.SHL_insert_2bits(symb);
+					kmer_rev.SHR_insert_2bits(3 - symb, kmer_len_shift);
+					kmer_prob *= prob_qual[qual];
+				}
+				current_kmer.mask(kmer_mask);			
 				if (kmer_prob >= MIN_PROB_QUAL_VALUE)
 				{
 					kmer_can = current_kmer < kmer_rev ? current_kmer : kmer_rev;
 					kmer_can.quality = (float)kmer_prob;
 					ptr.buffer_input[ptr.input_pos++].set(kmer_can);
 				}
-			}
-		}
-	else
-		while (pos < tmp_size)
-		{
-			uchar additional_symbols = data_p[pos++];
-			inv_probs_pos = 0;
-			kmer_prob = 1.0;
+				for (uint32 i = 0; i < additional_symbols; ++i)
+				{
+					symb = (data_p[pos] >> 6) & 3;
+					qual = data_p[pos++] & 63;
 
-			for (uint32 i = 0; i < ptr.kmer_len; ++i)
+					current_kmer.SHL_insert_2bits(symb);
+					current_kmer.mask(kmer_mask);
+					kmer_rev.SHR_insert_2bits(3 - symb, kmer_len_shift);
+				
+					kmer_prob *= prob_qual[qual] * inv_probs[inv_probs_pos - ptr.kmer_len];
+					inv_probs[inv_probs_pos++] = inv_prob_qual[qual];
+					if (kmer_prob >= MIN_PROB_QUAL_VALUE)
+					{
+						kmer_can = current_kmer < kmer_rev ? current_kmer : kmer_rev;
+						kmer_can.quality = (float)kmer_prob;
+						ptr.buffer_input[ptr.input_pos++].set(kmer_can);
+					}
+				}
+			}
+		else
+			while (pos < chunk.second)
 			{
-				symb = (data_p[pos] >> 6) & 3;
-				qual = data_p[pos++] & 63;
+				uchar additional_symbols = data_p[pos++];
+				inv_probs_pos = 0;
+				kmer_prob = 1.0;
 
-				inv_probs[inv_probs_pos++] = inv_prob_qual[qual];
+				for (uint32 i = 0; i < ptr.kmer_len; ++i)
+				{
+					symb = (data_p[pos] >> 6) & 3;
+					qual = data_p[pos++] & 63;
 
-				current_kmer.SHL_insert_2bits(symb);
-				kmer_prob *= prob_qual[qual];
-			}
-			current_kmer.mask(kmer_mask);
-			if (kmer_prob >= MIN_PROB_QUAL_VALUE)
-			{
-				current_kmer.quality = (float)kmer_prob;
-				ptr.buffer_input[ptr.input_pos++].set(current_kmer);
-			}
-			for (uint32 i = 0; i < additional_symbols; ++i)
-			{
-				symb = (data_p[pos] >> 6) & 3;
-				qual = data_p[pos++] & 63;
+					inv_probs[inv_probs_pos++] = inv_prob_qual[qual];
 
-				current_kmer.SHL_insert_2bits(symb);
+					current_kmer.SHL_insert_2bits(symb);
+					kmer_prob *= prob_qual[qual];
+				}
 				current_kmer.mask(kmer_mask);
-
-				kmer_prob *= prob_qual[qual] * inv_probs[inv_probs_pos - ptr.kmer_len];
-				inv_probs[inv_probs_pos++] = inv_prob_qual[qual];
 				if (kmer_prob >= MIN_PROB_QUAL_VALUE)
 				{
 					current_kmer.quality = (float)kmer_prob;
 					ptr.buffer_input[ptr.input_pos++].set(current_kmer);
 				}
+				for (uint32 i = 0; i < additional_symbols; ++i)
+				{
+					symb = (data_p[pos] >> 6) & 3;
+					qual = data_p[pos++] & 63;
+
+					current_kmer.SHL_insert_2bits(symb);
+					current_kmer.mask(kmer_mask);
+
+					kmer_prob *= prob_qual[qual] * inv_probs[inv_probs_pos - ptr.kmer_len];
+					inv_probs[inv_probs_pos++] = inv_prob_qual[qual];
+					if (kmer_prob >= MIN_PROB_QUAL_VALUE)
+					{
+						current_kmer.quality = (float)kmer_prob;
+						ptr.buffer_input[ptr.input_pos++].set(current_kmer);
+					}
+				}
 			}
-		}
+	}
 	ptr.pmm_prob->free(inv_probs);
 }
 
@@ -871,7 +889,7 @@ template <typename KMER_T, unsigned SIZE> void CKmerBinSorter<KMER_T, SIZE>::Sor
 		uint64 *_buffer_input = (uint64*)buffer_input;
 		uint64 *_buffer_tmp = (uint64*)buffer_tmp;
 
-		RadixSort_buffer(pmm_radix_buf, _buffer_input, _buffer_tmp, sort_rec, rec_len, n_omp_threads);
+		RadixSort_buffer(pmm_radix_buf, _buffer_input, _buffer_tmp, sort_rec, rec_len, task_pool, task_slot);
 
 		if (rec_len % 2)
 			buffer = (KMER_T*)_buffer_tmp;
@@ -883,7 +901,7 @@ template <typename KMER_T, unsigned SIZE> void CKmerBinSorter<KMER_T, SIZE>::Sor
 		uint32 *_buffer_input = (uint32*)buffer_input;
 		uint32 *_buffer_tmp = (uint32*)buffer_tmp;
 
-		RadixSort_uint8(_buffer_input, _buffer_tmp, sort_rec, sizeof(KMER_T), offsetof(KMER_T, data), SIZE*sizeof(typename KMER_T::data_t), rec_len, n_omp_threads);
+		RadixSort_uint8(_buffer_input, _buffer_tmp, sort_rec, sizeof(KMER_T), offsetof(KMER_T, data), SIZE*sizeof(typename KMER_T::data_t), rec_len, task_pool, task_slot);
 		if (rec_len % 2)
 			buffer = (KMER_T*)_buffer_tmp;
 		else
@@ -14,6 +14,10 @@
 #include <boost/lexical_cast.hpp>
 #include "kb_storer.h"
 
+#ifndef WIN32
+#include <sys/resource.h>
+#endif
+
 using namespace std;
 
 extern uint64 total_reads;
@@ -30,10 +34,15 @@ CKmerBinStorer::CKmerBinStorer(CKMCParams &Params, CKMCQueues &Queues)
 	mm					= Queues.mm;
 	n_bins			    = Params.n_bins;
 	q_part			    = Queues.bpq;
+	q_flush				= Queues.bfq;
 	bd                  = Queues.bd;
-	working_directory = Params.working_directory;
+	working_directories = Params.working_directories;
+	bin_dirs			= Params.bin_dirs;
 
 	mem_mode			= Params.mem_mode;
+	direct_io			= Params.direct_io;
+	tmp_stores			= Queues.tmp_stores;
+	spiller				= Queues.spiller;
 
 	s_mapper			= Queues.s_mapper;
 
@@ -45,7 +54,6 @@ CKmerBinStorer::CKmerBinStorer(CKMCParams &Params, CKMCQueues &Queues)
 	max_mem_buffer         = Params.max_mem_storer;
 
 	max_mem_single_package = Params.max_mem_storer_pkg;
-	tmp_buff = new uchar[max_mem_single_package*2]; 
 	
 	buffer = new elem_t*[n_bins];
 	for(int i = 0; i < n_bins; ++i)
@@ -81,8 +89,6 @@ void CKmerBinStorer::Release()
 
 	delete[] buf_sizes;
 	buf_sizes = NULL;
-	
-	delete [] tmp_buff;
 
 	cout << "\n";
 }
@@ -111,6 +117,7 @@ string CKmerBinStorer::GetName(int n)
 	while(s_tmp.length() < 5)
 		s_tmp = string("0") + s_tmp;
 	
+	string &working_directory = working_directories[bin_dirs[n]];
 	if (*working_directory.rbegin() != '/' && *working_directory.rbegin() != '\\')
 		working_directory += "/";
 	return working_directory + "kmc_" + s_tmp + ".bin";
@@ -143,34 +150,20 @@ void CKmerBinStorer::CheckBuffer()
 }
 
 //----------------------------------------------------------------------------------
-// Send bin to temp file
+// Send bin to temp file (the parts are passed to a writer)
 void CKmerBinStorer::PutBinToTmpFile(uint32 n)
 {
 	if(buf_sizes[n])
 	{
-		uint64 w;
-		uint64 tmp_buff_pos = 0;
-		uint32 size;
-		uchar* buf;
 		for(auto p = buffer[n]->begin() ; p != buffer[n]->end() ; ++p)
-		{
-			buf = get<0>(*p);
-			size = get<1>(*p);
-			A_memcpy(tmp_buff + tmp_buff_pos, buf, size);
-			tmp_buff_pos += size;
-			pmm_bins->free(buf);
-		}
+			total_size += get<1>(*p);
 
-		w = files[n]->Write(tmp_buff, 1, tmp_buff_pos);
-		if(w != tmp_buff_pos)
-		{
-			cout<<"Error while writing to temporary file " << n;
-			exit(1);
-		}
-		total_size += w;		
+		q_flush->push(n, files[n], buffer[n]);
+		buffer[n] = new elem_t;
 		buffer_size_bytes -= buf_sizes[n];
 	}
-	buffer[n]->clear();
+	else
+		buffer[n]->clear();
 }
 //
 
@@ -181,10 +174,40 @@ bool CKmerBinStorer::OpenFiles()
 {
 	string f_name;
 
+	// All bin files are open at the same time, so the limit of open files may need to be raised
+	if(!mem_mode && tmp_stores.empty())
+	{
+		uint32 n_files = n_bins + 64;
+#ifdef WIN32
+		if(n_files > 8192 || _setmaxstdio(n_files) < 0)
+		{
+			cout << "Error: Cannot open " << n_bins << " temporary files; use smaller number of bins (-n)\n";
+			exit(1);
+		}
+#else
+		struct rlimit rl;
+		if(getrlimit(RLIMIT_NOFILE, &rl) == 0 && rl.rlim_cur != RLIM_INFINITY && rl.rlim_cur < n_files)
+		{
+			rl.rlim_cur = (rl.rlim_max == RLIM_INFINITY) ? n_files : MIN((rlim_t) n_files, rl.rlim_max);
+			setrlimit(RLIMIT_NOFILE, &rl);
+			if(rl.rlim_cur < n_files)
+			{
+				cout << "Error: Cannot open " << n_bins << " temporary files (limit: " << rl.rlim_cur << "); use smaller number of bins (-n)\n";
+				exit(1);
+			}
+		}
+#endif
+	}
+
 	files     = new CMemDiskFile*[n_bins];
 	for (int i = 0 ; i < n_bins ; ++i)
 	{
-		files[i] = new CMemDiskFile(mem_mode);
+		if(!tmp_stores.empty())
+			files[i] = new CMemDiskFile(tmp_stores[bin_dirs[i]]);
+		else if(spiller)
+			files[i] = new CMemDiskFile(spiller);
+		else
+			files[i] = new CMemDiskFile(mem_mode, direct_io);
 	}
 	buf_sizes = new uint64[n_bins];
 
@@ -234,8 +257,238 @@ void CKmerBinStorer::ProcessQueue()
 
 	// Move all remaining parts to queue
 	ReleaseBuffer();
+	q_flush->mark_completed();
+
+
+}
+
+
+//************************************************************************************************************
+// CKmerBinWriter - writer of temporary files
+//************************************************************************************************************
+
+//----------------------------------------------------------------------------------
+// Constructor
+CKmerBinWriter::CKmerBinWriter(CKMCParams &Params, CKMCQueues &Queues, int _writer_id)
+{
+	pmm_bins	= Queues.pmm_bins;
+	q_flush		= Queues.bfq;
+	writer_id	= _writer_id;
+	compress	= Params.tmp_compress;
+
+	total_size	= 0;
+
+	// Uncompressed parts are written directly from the pool, so the buffer is needed only for compression and direct I/O
+	buff_raw = buff = NULL;
+	if(compress || Params.direct_io)
+	{
+		buff_raw = new uchar[TMP_WRITE_BUFFER_SIZE + DIRECT_IO_ALIGNMENT];
+		buff	 = buff_raw + DIRECT_IO_ALIGNMENT - ((uint64) buff_raw) % DIRECT_IO_ALIGNMENT;
+	}
+
+	// Chunks are compressed by the fastest zlib level; each starts with its raw and compressed sizes
+	comp_buff = NULL;
+	comp_buff_size = 0;
+	if(compress)
+	{
+		z_strm.zalloc = Z_NULL;
+		z_strm.zfree  = Z_NULL;
+		z_strm.opaque = Z_NULL;
+		if(deflateInit(&z_strm, 1) != Z_OK)
+		{
+			cout << "Error: Cannot initialize compression of temporary files\n";
+			exit(1);
+		}
+		comp_buff_size = 2 * sizeof(uint32) + deflateBound(&z_strm, TMP_CHUNK_SIZE);
+		comp_buff = new uchar[comp_buff_size];
+	}
+}
+
+//----------------------------------------------------------------------------------
+// Destructor
+CKmerBinWriter::~CKmerBinWriter()
+{
+	delete[] buff_raw;
+
+	if(compress)
+	{
+		deflateEnd(&z_strm);
+		delete[] comp_buff;
+	}
+}
+
+//----------------------------------------------------------------------------------
+// Write the packages of the bins assigned to the writer
+void CKmerBinWriter::ProcessQueue()
+{
+	int32 bin_id;
+	CMemDiskFile *file;
+	CBinFlushQueue::package_t *package;
+
+	while(q_flush->pop(writer_id, bin_id, file, package))
+	{
+		if(compress)
+			WriteGathered(bin_id, file, package);
+		else if(file->DirectIO())
+			WriteDirect(bin_id, file, package);
+		else
+			WriteParts(bin_id, file, package);
+
+		for(auto p = package->begin(); p != package->end(); ++p)
+			pmm_bins->free(get<0>(*p));
+		delete package;
+	}
+}
+
+//----------------------------------------------------------------------------------
+// The parts are gathered in the buffer and compressed in large blocks
+void CKmerBinWriter::WriteGathered(int32 bin_id, CMemDiskFile *file, CBinFlushQueue::package_t *package)
+{
+	uint64 buff_pos = 0;
+	for(auto p = package->begin(); p != package->end(); ++p)
+	{
+		uint32 size = get<1>(*p);
+		if(buff_pos + size > TMP_WRITE_BUFFER_SIZE)
+		{
+			total_size += WriteCompressed(bin_id, file, buff, buff_pos);
+			buff_pos = 0;
+		}
+		A_memcpy(buff + buff_pos, get<0>(*p), size);
+		buff_pos += size;
+	}
+	if(buff_pos)
+		total_size += WriteCompressed(bin_id, file, buff, buff_pos);
+}
+
+//----------------------------------------------------------------------------------
+// The parts are written by a single gather write straight from the pool
+void CKmerBinWriter::WriteParts(int32 bin_id, CMemDiskFile *file, CBinFlushQueue::package_t *package)
+{
+	uint64 size = 0;
+	parts.clear();
+	for(auto p = package->begin(); p != package->end(); ++p)
+	{
+		parts.push_back(make_pair(get<0>(*p), (uint64) get<1>(*p)));
+		size += get<1>(*p);
+	}
+
+	if(file->WriteParts(parts) != size)
+	{
+		cout<<"Error while writing to temporary file " << bin_id;
+		exit(1);
+	}
+	total_size += size;
+}
+
+//----------------------------------------------------------------------------------
+// Direct writes need aligned data, so the parts are gathered in the (aligned) buffer after the tail left
+// by the previous package of the bin; the unaligned end of the package becomes a new tail
+void CKmerBinWriter::WriteDirect(int32 bin_id, CMemDiskFile *file, CBinFlushQueue::package_t *package)
+{
+	uint64 buff_pos = file->TakeTail(buff);
+	uint64 n_missing = 0;						// bytes not written
+
+	for(auto p = package->begin(); p != package->end(); ++p)
+	{
+		uchar *buf  = get<0>(*p);
+		uint64 size = get<1>(*p);
+		total_size += size;
+		while(size)
+		{
+			uint64 n = MIN(size, TMP_WRITE_BUFFER_SIZE - buff_pos);
+			A_memcpy(buff + buff_pos, buf, n);
+			buff_pos += n;
+			buf		 += n;
+			size	 -= n;
+			if(buff_pos == TMP_WRITE_BUFFER_SIZE)
+			{
+				n_missing += TMP_WRITE_BUFFER_SIZE - file->WriteDirect(buff, TMP_WRITE_BUFFER_SIZE);
+				buff_pos = 0;
+			}
+		}
+	}
+
+	uint64 aligned = buff_pos / DIRECT_IO_ALIGNMENT * DIRECT_IO_ALIGNMENT;
+	if(aligned)
+		n_missing += aligned - file->WriteDirect(buff, aligned);
+	file->PutTail(buff + aligned, (uint32) (buff_pos - aligned));
+
+	if(n_missing)
+	{
+		cout<<"Error while writing to temporary file " << bin_id;
+		exit(1);
+	}
+}
+
+//----------------------------------------------------------------------------------
+// Write data in compressed chunks: raw size, compressed size (equal to the raw one if the chunk is stored), data.
+// Returns the number of bytes written
+uint64 CKmerBinWriter::WriteCompressed(int32 bin_id, CMemDiskFile *file, uchar *data, uint64 size)
+{
+	uint64 written = 0;
+	uint32 *header = (uint32 *) comp_buff;
+	uint32 chunk_size;
+
+	for(uint64 pos = 0; pos < size; pos += chunk_size)
+	{
+		chunk_size = (uint32) MIN((uint64) TMP_CHUNK_SIZE, size - pos);
+		header[0] = chunk_size;
 
+		deflateReset(&z_strm);
+		z_strm.next_in   = data + pos;
+		z_strm.avail_in  = header[0];
+		z_strm.next_out  = comp_buff + 2 * sizeof(uint32);
+		z_strm.avail_out = (uInt) (comp_buff_size - 2 * sizeof(uint32));
+		bool packed = deflate(&z_strm, Z_FINISH) == Z_STREAM_END && z_strm.total_out < header[0];
 
+		uint64 w;
+		if(packed)
+		{
+			header[1] = (uint32) z_strm.total_out;
+			w = file->Write(comp_buff, 1, 2 * sizeof(uint32) + header[1]);
+		}
+		else
+		{
+			header[1] = header[0];
+			w = file->Write(comp_buff, 1, 2 * sizeof(uint32));
+			w += file->Write(data + pos, 1, header[0]);
+		}
+
+		if(w != 2 * sizeof(uint32) + header[1])
+		{
+			cout<<"Error while writing to temporary file " << bin_id;
+			exit(1);
+		}
+		written += w;
+	}
+
+	return written;
+}
+
+
+//************************************************************************************************************
+// CWKmerBinWriter - wrapper
+//************************************************************************************************************
+
+//----------------------------------------------------------------------------------
+// Constructor
+CWKmerBinWriter::CWKmerBinWriter(CKMCParams &Params, CKMCQueues &Queues, int _writer_id)
+{
+	kbw = new CKmerBinWriter(Params, Queues, _writer_id);
+}
+
+//----------------------------------------------------------------------------------
+// Destructor
+CWKmerBinWriter::~CWKmerBinWriter()
+{
+	delete kbw;
+}
+
+//----------------------------------------------------------------------------------
+// Execution
+void CWKmerBinWriter::operator()()
+{
+	kbw->ProcessQueue();
 }
 
 
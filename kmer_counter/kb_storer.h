@@ -15,6 +15,7 @@
 #include "params.h"
 #include "kmer.h"
 #include "radix.h"
+#include "libs/zlib.h"
 #include <string>
 #include <algorithm>
 #include <numeric>
@@ -32,23 +33,27 @@ class CKmerBinStorer {
 
 	uint64 total_size; 
 	CMemoryPool *pmm_bins;
-	string working_directory;
+	vector<string> working_directories;
+	vector<uint32> bin_dirs;
 	int n_bins;
 	CBinPartQueue *q_part;
+	CBinFlushQueue *q_flush;
 	CBinDesc *bd;
 	uint64 buffer_size_bytes;
 	uint64 max_mem_buffer;
 	uint64 max_mem_single_package;
 
 	CSignatureMapper *s_mapper;
-	uchar* tmp_buff;
 	CMemDiskFile** files;
 	uint64 *buf_sizes;
 	uint64 max_buf_size;
 	uint32 max_buf_size_id;
 	bool mem_mode;
+	bool direct_io;
+	vector<CTmpStore*> tmp_stores;
+	CMemDiskSpiller *spiller;
 
-	typedef list<tuple<uchar *, uint32, uint32>> elem_t; 
+	typedef CBinFlushQueue::package_t elem_t; 
 	elem_t** buffer;
 
 	void Release();
@@ -69,6 +74,57 @@ public:
 	void ProcessQueue();
 };
 
+//************************************************************************************************************
+// CKmerBinWriter - writer of packages of bins to temporary files
+// Several writers work in parallel to the storer; each of them writes the bins assigned to it by CBinFlushQueue.
+//************************************************************************************************************
+class CKmerBinWriter {
+	CMemoryPool *pmm_bins;
+	CBinFlushQueue *q_flush;
+	int writer_id;
+
+	uint64 total_size;
+	uchar *buff_raw, *buff;
+	vector<CMemDiskFile::elem_t> parts;
+
+	bool compress;
+	z_stream z_strm;
+	uchar *comp_buff;
+	uint64 comp_buff_size;
+
+	void WriteGathered(int32 bin_id, CMemDiskFile *file, CBinFlushQueue::package_t *package);
+	void WriteParts(int32 bin_id, CMemDiskFile *file, CBinFlushQueue::package_t *package);
+	void WriteDirect(int32 bin_id, CMemDiskFile *file, CBinFlushQueue::package_t *package);
+	uint64 WriteCompressed(int32 bin_id, CMemDiskFile *file, uchar *data, uint64 size);
+
+public:
+	void GetTotal(uint64& _total)
+	{
+		_total = total_size;
+	}
+	CKmerBinWriter(CKMCParams &Params, CKMCQueues &Queues, int _writer_id);
+	~CKmerBinWriter();
+
+	void ProcessQueue();
+};
+
+//************************************************************************************************************
+// CWKmerBinWriter - wrapper for multithreading purposes
+//************************************************************************************************************
+class CWKmerBinWriter {
+	CKmerBinWriter *kbw;
+
+public:
+	void GetTotal(uint64& _total)
+	{
+		kbw->GetTotal(_total);
+	}
+	CWKmerBinWriter(CKMCParams &Params, CKMCQueues &Queues, int _writer_id);
+	~CWKmerBinWriter();
+
+	void operator()();
+};
+
 //************************************************************************************************************
 // CWKmerBinStorer - wrapper for multithreading purposes
 //************************************************************************************************************
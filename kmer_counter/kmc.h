@@ -55,7 +55,7 @@ template <typename KMER_T, unsigned SIZE, bool QUAKE_MODE> class CKMC {
 	vector<thread> gr1_1, gr1_2, gr1_3, gr1_4, gr1_5;		// thread groups for 1st stage
 	vector<thread> gr2_1, gr2_2, gr2_3;						// thread groups for 2nd stage
 
-	uint64 n_unique, n_cutoff_min, n_cutoff_max, n_total, n_reads, tmp_size, n_total_super_kmers;
+	uint64 n_unique, n_cutoff_min, n_cutoff_max, n_total, n_reads, tmp_size, tmp_size_written, n_total_super_kmers;
 
 	// Threads
 	vector<CWStatsFastqReader*> w_stats_fastqs;
@@ -63,13 +63,16 @@ template <typename KMER_T, unsigned SIZE, bool QUAKE_MODE> class CKMC {
 	vector<CWFastqReader*> w_fastqs;
 	vector<CWSplitter<QUAKE_MODE>*> w_splitters;
 	CWKmerBinStorer *w_storer;
+	vector<CWKmerBinWriter*> w_writers;
 
-	CWKmerBinReader<KMER_T, SIZE>* w_reader;
+	vector<CWKmerBinReader<KMER_T, SIZE>*> w_readers;
 	vector<CWKmerBinSorter<KMER_T, SIZE>*> w_sorters;
 	CWKmerBinCompleter *w_completer;
 
 	void SetThreads1Stage();
 	void SetThreads2Stage(vector<int64>& sorted_sizes);
+	void SetBinDirectories(uint32 *stats);
+	void CreateTmpStores(uint32 *stats);
 	
 	bool AdjustMemoryLimits();
 	void AdjustMemoryLimitsStage2();
@@ -83,7 +86,7 @@ public:
 	
 	void SetParams(CKMCParams &_Params);
 	bool Process();
-	void GetStats(double &time1, double &time2, uint64 &_n_unique, uint64 &_n_cutoff_min, uint64 &_n_cutoff_max, uint64 &_n_total, uint64 &_n_reads, uint64 &_tmp_size, uint64& _n_total_super_kmers);
+	void GetStats(double &time1, double &time2, uint64 &_n_unique, uint64 &_n_cutoff_min, uint64 &_n_cutoff_max, uint64 &_n_total, uint64 &_n_reads, uint64 &_tmp_size, uint64 &_tmp_size_written, uint64& _n_total_super_kmers);
 };
 
 
@@ -99,7 +102,12 @@ template <typename KMER_T, unsigned SIZE, bool QUAKE_MODE> CKMC<KMER_T, SIZE, QU
 	Params.kmer_len      = 0;
 	Params.n_readers     = 1;
 	Params.n_splitters   = 1;
+	Params.n_stats_splitters = 1;
 	Params.n_sorters     = 1;
+	Params.n_gzip_threads = 1;
+	Params.n_mapped_parts = 0;
+	Params.input_range_size = 0;
+	Params.stats_fraction = 0.0;
 	//Params.n_omp_threads = 1;
 	Queues.s_mapper = NULL;
 }
@@ -125,6 +133,9 @@ template <typename KMER_T, unsigned SIZE, bool QUAKE_MODE> void CKMC<KMER_T, SIZ
 	// Technical parameters related to temporary files
 	
 	Params.signature_len	 = Params.p_p1;
+	Params.sig_order		 = Params.p_signature_order;
+	Params.n_bins_max		 = Params.p_n_bins;
+	Params.cost_packing		 = Params.p_cost_packing;
 	Params.bin_part_size     = 1 << 16; 
 	
 	
@@ -137,6 +148,11 @@ template <typename KMER_T, unsigned SIZE, bool QUAKE_MODE> void CKMC<KMER_T, SIZ
 	Params.lowest_quality = Params.p_quality;
 	Params.both_strands   = Params.p_both_strands;
 	Params.mem_mode		  = Params.p_mem_mode;
+	Params.hybrid_mode	  = Params.p_hybrid_mem && !Params.mem_mode;
+	Params.hybrid_mem	  = (uint64) Params.p_hybrid_mem << 30;
+	Params.tmp_compress	  = Params.p_tmp_compress && !Params.mem_mode && !Params.hybrid_mode;
+	Params.tmp_store	  = Params.p_tmp_store && !Params.mem_mode && !Params.hybrid_mode;
+	Params.direct_io	  = Params.p_direct_io && !Params.mem_mode && !Params.hybrid_mode && !Params.tmp_compress && !Params.tmp_store;
 	
 	// Technical parameters related to no. of threads and memory usage
 	if(Params.p_sf && Params.p_sp && Params.p_so && Params.p_sr)
@@ -155,12 +171,21 @@ template <typename KMER_T, unsigned SIZE, bool QUAKE_MODE> void CKMC<KMER_T, SIZ
 			Params.n_threads = thread::hardware_concurrency();
 		SetThreads1Stage();
 	}
+	if(Params.p_sz)
+		Params.n_gzip_threads = NORM(Params.p_sz, MIN_SZ, MAX_SZ);
+	Params.n_writers = Params.p_sw ? NORM(Params.p_sw, MIN_SW, MAX_SW) : 1;
+	Params.n_bin_readers = Params.p_sb ? NORM(Params.p_sb, MIN_SB, MAX_SB) : 2;
+	Params.stats_fraction = Params.p_sa;
 
 	//Params.max_mem_size  = NORM(((uint64) Params.p_m) << 30, (uint64) MIN_MEM << 30, 1024ull << 30);
 	Params.max_mem_size = NORM(((uint64)Params.p_m) * 1000000000ull, (uint64)MIN_MEM * 1000000000ull, 1024ull * 1000000000ull);
 
 	Params.file_type		= Params.p_file_type;
 
+	// Many readers can share large uncompressed files (multi line FASTA records cannot be split)
+	if(Params.n_readers > 1 && Params.file_type != multiline_fasta)
+		Params.input_range_size = INPUT_RANGE_SIZE;
+
 	Params.KMER_T_size = sizeof(KMER_T);
 
 	initialized = true; 
@@ -176,15 +201,22 @@ template <typename KMER_T, unsigned SIZE, bool QUAKE_MODE> void CKMC<KMER_T, SIZ
 		int cores = Params.n_threads;
 		bool gz_bz2 = false;
 		vector<uint64> file_sizes;
+		int32 n_streams = 0;
 		
 		for (auto& p : Params.input_file_names)
 		{
-			string ext(p.end() - 3, p.end());
+			string ext(p.end() - MIN(p.size(), (size_t) 3), p.end());
 			if (ext == ".gz" || ext == ".bz2")
 			{
 				gz_bz2 = true;
 				//break;
 			}
+			// Streams have no size and cannot be opened twice
+			if (CInputFilesQueue::IsStream(p))
+			{
+				++n_streams;
+				continue;
+			}
 			FILE* tmp = my_fopen(p.c_str(), "rb");
 			if (!tmp)
 			{
@@ -198,15 +230,24 @@ template <typename KMER_T, unsigned SIZE, bool QUAKE_MODE> void CKMC<KMER_T, SIZ
 		if (gz_bz2)
 		{
 			sort(file_sizes.begin(), file_sizes.end(), greater<uint64>());
-			uint64 file_size_threshold = (uint64)(file_sizes.front() * 0.05);
-			int32 n_allowed_files = 0;
+			uint64 file_size_threshold = file_sizes.empty() ? 0 : (uint64)(file_sizes.front() * 0.05);
+			int32 n_allowed_files = n_streams;
 			for(auto& p : file_sizes)
 			if (p > file_size_threshold)
 				++n_allowed_files;
 			Params.n_readers = MIN(n_allowed_files, MAX(1, cores / 2));
+
+			// Few large files: the remaining half of cores inflates multi-member gzip files in parallel
+			Params.n_gzip_threads = MAX(1, (cores / 2) / Params.n_readers);
 		}
 		else
-			Params.n_readers = 1;
+		{
+			// Uncompressed files are read in byte ranges, so even a single large file can have many readers
+			uint64 n_ranges = n_streams;
+			for(auto& p : file_sizes)
+				n_ranges += Params.p_file_type == multiline_fasta ? 1 : MAX(1, (p + INPUT_RANGE_SIZE - 1) / INPUT_RANGE_SIZE);
+			Params.n_readers = (int) MIN(n_ranges, (uint64) MAX(1, cores / 4));
+		}
 		Params.n_splitters = MAX(1, cores - Params.n_readers);
 	}
 }
@@ -230,8 +271,79 @@ template<typename KMER_T, unsigned SIZE, bool QUAKE_MODE> void CKMC<KMER_T, SIZE
 				Params.n_omp_threads[i%Params.n_sorters]++;
 		}
 	}
+
+	// The threads are not tied to the sorters; they form a single pool
+	Params.n_sort_threads = MAX(accumulate(Params.n_omp_threads.begin(), Params.n_omp_threads.end(), 0), Params.n_sorters);
+}
+
+//----------------------------------------------------------------------------------
+// Assign bins to the working directories (LPT on the no. of k-mers estimated in stage 0),
+// so that the directories (disks) get similar amounts of data
+template <typename KMER_T, unsigned SIZE, bool QUAKE_MODE> void CKMC<KMER_T, SIZE, QUAKE_MODE>::SetBinDirectories(uint32 *stats)
+{
+	uint32 n_dirs = (uint32) Params.working_directories.size();
+	Params.bin_dirs.assign(Params.n_bins, 0);
+	if(n_dirs < 2)
+		return;
+
+	vector<pair<uint64, int32>> bin_sizes(Params.n_bins);
+	for(int32 i = 0; i < Params.n_bins; ++i)
+		bin_sizes[i] = make_pair(0ull, i);
+	for(uint32 i = 0; i < Queues.s_mapper->get_map_size(); ++i)
+	{
+		int32 bin_id = Queues.s_mapper->get_bin_id(i);
+		if(bin_id >= 0)
+			bin_sizes[bin_id].first += stats[i] + 1ull;
+	}
+	sort(bin_sizes.begin(), bin_sizes.end(), greater<pair<uint64, int32>>());
+
+	priority_queue<pair<uint64, uint32>, vector<pair<uint64, uint32>>, greater<pair<uint64, uint32>>> dir_loads;
+	for(uint32 i = 0; i < n_dirs; ++i)
+		dir_loads.push(make_pair(0ull, i));
+	for(auto p = bin_sizes.begin(); p != bin_sizes.end(); ++p)
+	{
+		auto dir = dir_loads.top();
+		dir_loads.pop();
+		Params.bin_dirs[p->second] = dir.second;
+		dir.first += p->first;
+		dir_loads.push(dir);
+	}
+}
+
+//----------------------------------------------------------------------------------
+// Create the single-file stores of bins. Each of them is preallocated for its part (by the k-mer counts
+// estimated in stage 0) of the expected size of temporary data, i.e., about half of the size of uncompressed
+// input; compressed input is not taken into account, the stores grow as needed.
+template <typename KMER_T, unsigned SIZE, bool QUAKE_MODE> void CKMC<KMER_T, SIZE, QUAKE_MODE>::CreateTmpStores(uint32 *stats)
+{
+	uint64 tmp_size_est = 0;
+	for(auto p = Params.input_file_names.begin(); p != Params.input_file_names.end(); ++p)
+		tmp_size_est += CInputFilesQueue::PlainFileSize(*p) / 2;
+
+	uint32 n_dirs = (uint32) Params.working_directories.size();
+	vector<double> dir_kmers(n_dirs, 0.0);
+	double tot_kmers = 0.0;
+	for(uint32 i = 0; i < Queues.s_mapper->get_map_size(); ++i)
+	{
+		int32 bin_id = Queues.s_mapper->get_bin_id(i);
+		if(bin_id >= 0)
+		{
+			dir_kmers[Params.bin_dirs[bin_id]] += stats[i] + 1.0;
+			tot_kmers += stats[i] + 1.0;
+		}
+	}
+
+	Queues.tmp_stores.resize(n_dirs);
+	for(uint32 i = 0; i < n_dirs; ++i)
+	{
+		string name = Params.working_directories[i];
+		if(*name.rbegin() != '/' && *name.rbegin() != '\\')
+			name += "/";
+		Queues.tmp_stores[i] = new CTmpStore(name + "kmc_store.bin", (uint64) (tmp_size_est * dir_kmers[i] / tot_kmers));
+	}
 }
 
+//----------------------------------------------------------------------------------
 template <typename KMER_T, unsigned SIZE, bool QUAKE_MODE> void CKMC<KMER_T, SIZE, QUAKE_MODE>::AdjustMemoryLimitsStage2()
 {
 	// Memory for 2nd stage
@@ -264,6 +376,10 @@ template <typename KMER_T, unsigned SIZE, bool QUAKE_MODE> void CKMC<KMER_T, SIZ
 		Params.mem_part_pmm_epxand = Params.mem_tot_pmm_epxand = 0;
 
 	Params.max_mem_stage2 = Params.max_mem_size - Params.mem_tot_pmm_radix_buf - Params.mem_tot_pmm_prob - Params.mem_tot_pmm_epxand;
+
+	// Bins kept in RAM in hybrid mode stay there until they are sorted
+	if(Params.hybrid_mode)
+		Params.max_mem_stage2 -= Params.hybrid_mem;
 }
 
 //----------------------------------------------------------------------------------
@@ -273,10 +389,57 @@ template <typename KMER_T, unsigned SIZE, bool QUAKE_MODE> bool CKMC<KMER_T, SIZ
 	// Memory for splitter internal buffers
 	int64 m_rest = Params.max_mem_size;  
 
-	Params.mem_part_pmm_stats = ((1 << Params.signature_len * 2) + 1) * sizeof(uint32);
-	Params.mem_tot_pmm_stats = (Params.n_splitters + 1 + 1) * Params.mem_part_pmm_stats; //1 merged in main thread, 1 for sorting indices
+	// Bins kept in RAM in hybrid mode are a part of the memory limit; at least 1GB must remain for the buffers of stage 1
+	if(Params.hybrid_mode)
+	{
+		m_rest -= Params.hybrid_mem;
+		if(m_rest < (1ll << 30))
+		{
+			cout << "Error: RAM for bins in hybrid mode (-rh) leaves too little memory for stage 1\n";
+			return false;
+		}
+	}
+
+	// For cost based packing of bins also the no. of k(+x)-mer records of signatures is counted
+	int64 sig_map_size = ((1 << Params.signature_len * 2) + 1) * sizeof(uint32);
+	Params.mem_part_pmm_stats = (Params.cost_packing ? 2 : 1) * sig_map_size;
+
+	// Each splitter of stage 0 keeps its own stats array, so for long signatures fewer splitters are used in stage 0
+	// to keep the arrays within 1/8 of the memory
+	Params.n_stats_splitters = Params.n_splitters;
+	while(Params.n_stats_splitters > 1 && (Params.n_stats_splitters + 1 + 1) * Params.mem_part_pmm_stats > Params.max_mem_size / 8)
+		--Params.n_stats_splitters;
+	Params.mem_tot_pmm_stats = (Params.n_stats_splitters + 1 + 1) * Params.mem_part_pmm_stats; //1 merged in main thread, 1 for sorting indices
+
+	// Normalization table of signatures and signature map (large for long signatures) and the stats arrays of stage 0
+	m_rest -= 2 * sig_map_size + Params.mem_tot_pmm_stats;
+	if(m_rest < (1ll << 30))
+	{
+		cout << "Error: Signature statistics of stage 0 (-p) leave too little memory for stage 1\n";
+		return false;
+	}
 
 	
+	// Uncompressed files are memory mapped and their parts are passed to the splitters without copying,
+	// so if there are no compressed files only a few FASTQ buffers are necessary
+	bool all_mapped = CMappedFile::Supported() && Params.file_type != multiline_fasta;
+	bool any_head_kept = false;
+	for(auto &p : Params.input_file_names)
+	{
+		if((p.size() > 3 && string(p.end()-3, p.end()) == ".gz") || (p.size() > 4 && string(p.end()-4, p.end()) == ".bz2"))
+		{
+			any_head_kept = true;
+			all_mapped = false;
+		}
+		if(CInputFilesQueue::IsStream(p))
+		{
+			any_head_kept = true;
+			all_mapped = false;
+		}
+	}
+	Params.n_mapped_parts = CMappedFile::Supported() ? MAX(2, 2 * Params.n_splitters / Params.n_readers) : 0;
+	int n_fastq_parts = Params.n_readers + Params.n_splitters + (all_mapped ? 0 : 96);
+
 	// Settings for memory manager of FASTQ buffers
 	Params.fastq_buffer_size = 32 << 20;
 	do {
@@ -285,18 +448,29 @@ template <typename KMER_T, unsigned SIZE, bool QUAKE_MODE> bool CKMC<KMER_T, SIZ
 		else
 			Params.fastq_buffer_size = Params.fastq_buffer_size / 2 + Params.fastq_buffer_size / 4;
 		Params.mem_part_pmm_fastq = Params.fastq_buffer_size + CFastqReader::OVERHEAD_SIZE;
-		Params.mem_tot_pmm_fastq  = Params.mem_part_pmm_fastq * (Params.n_readers + Params.n_splitters + 96);
+		Params.mem_tot_pmm_fastq  = Params.mem_part_pmm_fastq * n_fastq_parts;
 	} while(Params.mem_tot_pmm_fastq > m_rest * 0.17);
 	m_rest -= Params.mem_tot_pmm_fastq;
 
+	// The beginnings of the streams and compressed files read in stage 0 are kept for stage 1
+	if(any_head_kept)
+		m_rest -= STATS_FASTQ_SIZE + Params.n_readers * Params.mem_part_pmm_fastq;
+
 	// Subtract memory for buffers for decompression of FASTQ files
 	while(Params.n_readers * Params.gzip_buffer_size > m_rest / 10)
 		Params.gzip_buffer_size /= 2;
 	m_rest -= Params.n_readers * Params.gzip_buffer_size;
+	m_rest -= Params.n_readers * MAX(CGzBlockReader::MemoryUsage(Params.n_gzip_threads), CGzSpecReader::MemoryUsage(Params.n_gzip_threads));
 
 	// Subtract memory for bin collectors internal buffers
 	m_rest -= Params.n_splitters * Params.bin_part_size * sizeof(KMER_T);
 
+	// Subtract memory for buffers of writers of temporary files (uncompressed parts are written without buffering)
+	if(Params.tmp_compress)
+		m_rest -= Params.n_writers * (TMP_WRITE_BUFFER_SIZE + 2 * TMP_CHUNK_SIZE);
+	else if(Params.direct_io)
+		m_rest -= Params.n_writers * (TMP_WRITE_BUFFER_SIZE + DIRECT_IO_ALIGNMENT) + Params.n_bins_max * 2 * DIRECT_IO_ALIGNMENT;
+
 	// Settings for memory manager of reads
 	Params.mem_part_pmm_reads = (CSplitter<QUAKE_MODE>::MAX_LINE_SIZE + 1) * sizeof(double);
 	Params.mem_tot_pmm_reads  = Params.mem_part_pmm_reads * 2 * Params.n_splitters;
@@ -332,7 +506,7 @@ template <typename KMER_T, unsigned SIZE, bool QUAKE_MODE> void CKMC<KMER_T, SIZ
 
 	cout << "No. of input files           : " << Params.input_file_names.size() << "\n";
 	cout << "Output file name             : " << Params.output_file_name << "\n";
-	cout << "No. of working directories   : " << 1 << "\n";
+	cout << "No. of working directories   : " << Params.working_directories.size() << "\n";
 	cout << "Input format                 : "; 
 	switch (Params.file_type)
 	{
@@ -350,6 +524,12 @@ template <typename KMER_T, unsigned SIZE, bool QUAKE_MODE> void CKMC<KMER_T, SIZ
 	cout << "k-mer length                 : " << Params.kmer_len << "\n";
 	cout << "Max. k-mer length            : " << MAX_K << "\n";
 	cout << "Signature length             : " << Params.signature_len << "\n"; 
+	cout << "Signature order              : " << (Params.sig_order == sig_hash ? "hash\n" : "lexicographic\n");
+	cout << "Assignment of signatures     : " << (Params.cost_packing ? "estimated stage 2 cost (LPT)\n" : "k-mer counts\n");
+	if (Params.stats_fraction > 0)
+		cout << "Sampled input in stage 0     : " << Params.stats_fraction << "\n";
+	else
+		cout << "Sampled input in stage 0     : heads of files\n";
 	cout << "Min. count threshold         : " << Params.cutoff_min << "\n";
 	cout << "Max. count threshold         : " << Params.cutoff_max << "\n";
 	cout << "Max. counter value           : " << Params.counter_max << "\n";
@@ -358,6 +538,11 @@ template <typename KMER_T, unsigned SIZE, bool QUAKE_MODE> void CKMC<KMER_T, SIZ
 		cout << "Lowest quality value         : " << Params.lowest_quality << "\n";
 	cout << "Both strands                 : " << (Params.both_strands ? "true\n" : "false\n");	
 	cout << "RAM olny mode                : " << (Params.mem_mode ? "true\n" : "false\n");
+	if(Params.hybrid_mode)
+		cout << "RAM for bins (hybrid mode)   : " << (Params.hybrid_mem >> 30) << "GB\n";
+	cout << "Compressed temporary files   : " << (Params.tmp_compress ? "true\n" : "false\n");
+	cout << "Direct I/O of temporary files: " << (Params.direct_io ? "true\n" : "false\n");
+	cout << "Single-file temporary store  : " << (Params.tmp_store ? "true\n" : "false\n");
 
 	cout << "\n******* Stage 1 configuration: *******\n";
 	cout << "\n";
@@ -367,7 +552,10 @@ template <typename KMER_T, unsigned SIZE, bool QUAKE_MODE> void CKMC<KMER_T, SIZ
 	cout << "\n";
 
 	cout << "No. of readers               : " << Params.n_readers << "\n";
+	cout << "No. of decompression threads : " << Params.n_gzip_threads << "\n";
+	cout << "No. of writers of tmp files  : " << Params.n_writers << "\n";
 	cout << "No. of splitters             : " << Params.n_splitters << "\n";
+	cout << "No. of splitters in stage 0  : " << Params.n_stats_splitters << "\n";
 	cout << "\n";
 
 	cout << "Max. mem. size               : " << setw(5) << (Params.max_mem_size / 1000000) << "MB\n";
@@ -391,15 +579,15 @@ template <typename KMER_T, unsigned SIZE, bool QUAKE_MODE> void CKMC<KMER_T, SIZ
 
 	cout << "\n******* Stage 2 configuration: *******\n";
 
+	cout << "No. of bin readers per dir.  : " << Params.n_bin_readers << "\n";
 	cout << "No. of sorters               : " << Params.n_sorters << "\n";
-	cout << "No. of sort. threads         : ";
-	for (uint32 i = 0; i < Params.n_omp_threads.size() - 1; ++i)
-		cout << Params.n_omp_threads[i] << ", ";
-	cout << Params.n_omp_threads.back() << "\n";
+	cout << "No. of sort. threads         : " << Params.n_sort_threads << " (shared by the sorters)\n";
 
 	cout << "\n";
 
 	cout << "Max. mem. for 2nd stage      : " << setw(5) << (Params.max_mem_stage2 / 1000000) << "MB\n";
+	if(Params.hybrid_mode)
+		cout << "Bins spilled to disk         : " << Queues.spiller->NoSpilled() << " of " << Params.n_bins << "\n";
 	cout << "\n";	
 }
 //----------------------------------------------------------------------------------
@@ -428,13 +616,15 @@ template <typename KMER_T, unsigned SIZE, bool QUAKE_MODE> bool CKMC<KMER_T, SIZ
 
 
 	// Create queues
-	Queues.input_files_queue = new CInputFilesQueue(Params.input_file_names);
+	Queues.input_files_queue = new CInputFilesQueue(Params.input_file_names, Params.input_range_size);
 	Queues.part_queue = new CPartQueue(Params.n_readers);
 	Queues.bpq = new CBinPartQueue(Params.n_splitters);
+	Queues.bfq = new CBinFlushQueue(Params.n_writers);
 	Queues.bd = new CBinDesc;
-	Queues.bq = new CBinQueue(1);
+	Queues.bq = new CBinQueue((int) Params.working_directories.size() * Params.n_bin_readers);
 
 	Queues.stats_part_queue = new CStatsPartQueue(Params.n_readers, STATS_FASTQ_SIZE);
+	Queues.stream_heads = new CStreamHeads;
 
 	// Create memory manager
 	Queues.pmm_bins = new CMemoryPool(Params.mem_tot_pmm_bins, Params.mem_part_pmm_bins);
@@ -444,67 +634,88 @@ template <typename KMER_T, unsigned SIZE, bool QUAKE_MODE> bool CKMC<KMER_T, SIZ
 
 	
 
-	Queues.s_mapper = new CSignatureMapper(Queues.pmm_stats, Params.signature_len);
+	CMmer::prepare(Params.signature_len, Params.sig_order);
+	Queues.s_mapper = new CSignatureMapper(Queues.pmm_stats, Params.signature_len, Params.sig_order, Params.n_bins_max);
 	
 	// ***** Stage 0 *****
 	w0.startTimer();
-	w_stats_splitters.resize(Params.n_splitters);
-	
 
-	for (int i = 0; i < Params.n_splitters; ++i)
-	{
-		w_stats_splitters[i] = new CWStatsSplitter<false>(Params, Queues);
-		gr0_2.push_back(thread(std::ref(*w_stats_splitters[i])));
-	}
+	uint32 *stats;
+	Queues.pmm_stats->reserve(stats);
+	fill_n(stats, Params.mem_part_pmm_stats / sizeof(uint32), 0);
+	bool map_loaded = false;
 
-	w_stats_fastqs.resize(Params.n_readers);
-	
-	for (int i = 0; i < Params.n_readers; ++i)
+	if (!Params.stats_load_file_name.empty())
+		map_loaded = Queues.s_mapper->LoadStats(Params.stats_load_file_name, stats, Params.kmer_len, Params.both_strands, 
+			Params.use_quake ? 0 : Params.max_x, Params.cost_packing);
+	else
 	{
-		w_stats_fastqs[i] = new CWStatsFastqReader(Params, Queues);
-		gr0_1.push_back(thread(std::ref(*w_stats_fastqs[i])));
-	}
-	for (auto p = gr0_1.begin(); p != gr0_1.end(); ++p)
-		p->join();
-	for (auto p = gr0_2.begin(); p != gr0_2.end(); ++p)
-		p->join();
-
+		w_stats_splitters.resize(Params.n_stats_splitters);
 
-	uint32 *stats;
-	Queues.pmm_stats->reserve(stats);
-	fill_n(stats, (1 << Params.signature_len * 2) + 1, 0);
+		for (int i = 0; i < Params.n_stats_splitters; ++i)
+		{
+			w_stats_splitters[i] = new CWStatsSplitter<false>(Params, Queues);
+			gr0_2.push_back(thread(std::ref(*w_stats_splitters[i])));
+		}
 
+		w_stats_fastqs.resize(Params.n_readers);
+	
+		for (int i = 0; i < Params.n_readers; ++i)
+		{
+			w_stats_fastqs[i] = new CWStatsFastqReader(Params, Queues);
+			gr0_1.push_back(thread(std::ref(*w_stats_fastqs[i])));
+		}
+		for (auto p = gr0_1.begin(); p != gr0_1.end(); ++p)
+			p->join();
+		for (auto p = gr0_2.begin(); p != gr0_2.end(); ++p)
+			p->join();
 
-	for (int i = 0; i < Params.n_readers; ++i)
-		delete w_stats_fastqs[i];
+		for (int i = 0; i < Params.n_readers; ++i)
+			delete w_stats_fastqs[i];
 
-	for (int i = 0; i < Params.n_splitters; ++i)
-	{
-		w_stats_splitters[i]->GetStats(stats);			
-		delete w_stats_splitters[i];
-	}		
+		for (int i = 0; i < Params.n_stats_splitters; ++i)
+		{
+			w_stats_splitters[i]->GetStats(stats);			
+			delete w_stats_splitters[i];
+		}		
+	}
 
 	delete Queues.stats_part_queue;
 	Queues.stats_part_queue = NULL;
 	delete Queues.input_files_queue;
-	Queues.input_files_queue = new CInputFilesQueue(Params.input_file_names);
+	Queues.input_files_queue = new CInputFilesQueue(Params.input_file_names, Params.input_range_size);
 
 	heuristic_time.startTimer();
-	Queues.s_mapper->Init(stats);
+	if (!map_loaded)
+	{
+		if (Params.cost_packing)
+			Queues.s_mapper->InitCost(stats, 2 * sizeof(KMER_T) + (Params.max_x && !Params.use_quake ? sizeof(uint32) : 0));
+		else
+			Queues.s_mapper->Init(stats);
+	}
 	heuristic_time.stopTimer();
 
+	if (!Params.stats_save_file_name.empty())
+		Queues.s_mapper->SaveStats(Params.stats_save_file_name, stats, Params.kmer_len, Params.both_strands, 
+			Params.use_quake ? 0 : Params.max_x, Params.cost_packing);
+
 	cout << "\n";
 	
 	w0.stopTimer();
 
 
+	Params.n_bins = Queues.s_mapper->get_max_bin_no() + 1;
+	SetBinDirectories(stats);
+	if(Params.tmp_store)
+		CreateTmpStores(stats);
+	if(Params.hybrid_mode)
+		Queues.spiller = new CMemDiskSpiller(Params.hybrid_mem);
+
 	Queues.pmm_stats->free(stats);
 	Queues.pmm_stats->release();
 	delete Queues.pmm_stats;
 	Queues.pmm_stats = NULL;
 
-	Params.n_bins = Queues.s_mapper->get_max_bin_no() + 1;
-
 	// ***** Stage 1 *****
 	ShowSettingsStage1();
 
@@ -519,6 +730,13 @@ template <typename KMER_T, unsigned SIZE, bool QUAKE_MODE> bool CKMC<KMER_T, SIZ
 	w_storer = new CWKmerBinStorer(Params, Queues);
 	gr1_3.push_back(thread(std::ref(*w_storer)));
 
+	w_writers.resize(Params.n_writers);
+	for(int i = 0; i < Params.n_writers; ++i)
+	{
+		w_writers[i] = new CWKmerBinWriter(Params, Queues, i);
+		gr1_4.push_back(thread(std::ref(*w_writers[i])));
+	}
+
 	w_fastqs.resize(Params.n_readers);
 	for(int i = 0; i < Params.n_readers; ++i)
 	{
@@ -531,6 +749,9 @@ template <typename KMER_T, unsigned SIZE, bool QUAKE_MODE> bool CKMC<KMER_T, SIZ
 	for(auto p = gr1_2.begin(); p != gr1_2.end(); ++p)
 		p->join();
 
+	delete Queues.stream_heads;
+	Queues.stream_heads = NULL;
+
 	Queues.pmm_fastq->release();
 	Queues.pmm_reads->release();
 	
@@ -539,6 +760,8 @@ template <typename KMER_T, unsigned SIZE, bool QUAKE_MODE> bool CKMC<KMER_T, SIZ
 
 	for(auto p = gr1_3.begin(); p != gr1_3.end(); ++p)
 		p->join();
+	for(auto p = gr1_4.begin(); p != gr1_4.end(); ++p)
+		p->join();
 
 	n_reads = 0;
 
@@ -555,6 +778,15 @@ template <typename KMER_T, unsigned SIZE, bool QUAKE_MODE> bool CKMC<KMER_T, SIZ
 		}
 
 		delete w_storer;
+
+		tmp_size_written = 0;
+		for(int i = 0; i < Params.n_writers; ++i)
+		{
+			uint64 _total;
+			w_writers[i]->GetTotal(_total);
+			tmp_size_written += _total;
+			delete w_writers[i];
+		}
 	});
 
 	thread *release_thr_st1_2 = new thread([&]{
@@ -649,9 +881,18 @@ template <typename KMER_T, unsigned SIZE, bool QUAKE_MODE> bool CKMC<KMER_T, SIZ
 		Queues.pmm_prob = new CMemoryPool(Params.mem_tot_pmm_prob, Params.mem_part_pmm_prob);
 	else
 		Queues.pmm_prob = NULL;
-	w_reader = new CWKmerBinReader<KMER_T, SIZE>(Params, Queues);
-	gr2_1.push_back(thread(std::ref(*w_reader)));
 
+	// Several readers per working directory
+	Queues.bd->init_schedule(Params.bin_dirs, (uint32) Params.working_directories.size(), Params.n_omp_threads, 2 * sizeof(KMER_T), Params.max_x != 0, Params.max_mem_stage2);
+	w_readers.resize(Params.working_directories.size() * Params.n_bin_readers);
+	for(uint32 i = 0; i < w_readers.size(); ++i)
+	{
+		w_readers[i] = new CWKmerBinReader<KMER_T, SIZE>(Params, Queues, i / Params.n_bin_readers);
+		gr2_1.push_back(thread(std::ref(*w_readers[i])));
+	}
+
+	// The sorters take part in execution of the tasks, so the pool needs only the remaining threads
+	Queues.task_pool = new CTaskPool(Params.n_sort_threads - Params.n_sorters, Params.n_sorters);
 	w_sorters.resize(Params.n_sorters);
 	
 
@@ -668,6 +909,7 @@ template <typename KMER_T, unsigned SIZE, bool QUAKE_MODE> bool CKMC<KMER_T, SIZ
 		p->join();
 	for(auto p = gr2_2.begin(); p != gr2_2.end(); ++p)
 		p->join();
+	delete Queues.task_pool;
 
 
 	for(auto p = gr2_3.begin(); p != gr2_3.end(); ++p)
@@ -695,7 +937,8 @@ template <typename KMER_T, unsigned SIZE, bool QUAKE_MODE> bool CKMC<KMER_T, SIZ
 	stat_n_plus_x_recs = stat_n_recs = stat_n_recs_tmp = stat_n_plus_x_recs_tmp = 0;
 	thread *release_thr_st2_2 = new thread([&]{
 		
-		delete w_reader;
+		for(auto p = w_readers.begin(); p != w_readers.end(); ++p)
+			delete *p;
 		for(int i = 0; i < Params.n_sorters; ++i)
 		{
 			w_sorters[i]->GetDebugStats(stat_n_recs_tmp, stat_n_plus_x_recs_tmp);
@@ -709,6 +952,7 @@ template <typename KMER_T, unsigned SIZE, bool QUAKE_MODE> bool CKMC<KMER_T, SIZ
 		delete Queues.bq;
 		delete Queues.part_queue;
 		delete Queues.bpq;
+		delete Queues.bfq;
 		delete Queues.kq;
 	});
 
@@ -724,12 +968,25 @@ template <typename KMER_T, unsigned SIZE, bool QUAKE_MODE> bool CKMC<KMER_T, SIZ
 	{
 		Queues.bd->read(bin_id, file, name, size, n_rec, n_plus_x_recs, n_super_kmers);		
 #ifndef DEVELOP_MODE
-		boost::filesystem::remove(boost::filesystem::path(name));
+		if(!Params.tmp_store)
+			boost::filesystem::remove(boost::filesystem::path(name));
 #endif // DEVELOP_MODE
 		tmp_size += size;
 		n_total_super_kmers += n_super_kmers;
 	}
 	delete Queues.bd;
+	delete Queues.spiller;
+	Queues.spiller = NULL;
+
+	for(auto p = Queues.tmp_stores.begin(); p != Queues.tmp_stores.end(); ++p)
+	{
+		name = (*p)->FileName();
+		delete *p;
+#ifndef DEVELOP_MODE
+		boost::filesystem::remove(boost::filesystem::path(name));
+#endif // DEVELOP_MODE
+	}
+	Queues.tmp_stores.clear();
 
 	release_thr_st2_1->join();
 	release_thr_st2_2->join();
@@ -748,7 +1005,7 @@ template <typename KMER_T, unsigned SIZE, bool QUAKE_MODE> bool CKMC<KMER_T, SIZ
 //----------------------------------------------------------------------------------
 // Return statistics
 template <typename KMER_T, unsigned SIZE, bool QUAKE_MODE> void CKMC<KMER_T, SIZE, QUAKE_MODE>::GetStats(double &time1,
-	double &time2, uint64 &_n_unique, uint64 &_n_cutoff_min, uint64 &_n_cutoff_max, uint64 &_n_total, uint64 &_n_reads, uint64 &_tmp_size, uint64& _n_total_super_kmers)
+	double &time2, uint64 &_n_unique, uint64 &_n_cutoff_min, uint64 &_n_cutoff_max, uint64 &_n_total, uint64 &_n_reads, uint64 &_tmp_size, uint64 &_tmp_size_written, uint64& _n_total_super_kmers)
 {
 	time1 = w1.getElapsedTime();
 	time2 = w2.getElapsedTime();
@@ -759,6 +1016,7 @@ template <typename KMER_T, unsigned SIZE, bool QUAKE_MODE> void CKMC<KMER_T, SIZ
 	_n_total      = n_total;
 	_n_reads      = n_reads;
 	_tmp_size     = tmp_size;
+	_tmp_size_written = tmp_size_written;
 	_n_total_super_kmers = n_total_super_kmers;
 }
 
@@ -61,13 +61,13 @@ public:
 			delete kmc;
 	}
 
-	void GetStats(double &time1, double &time2, uint64 &_n_unique, uint64 &_n_cutoff_min, uint64 &_n_cutoff_max, uint64 &_n_total, uint64 &_n_reads, uint64 &_tmp_size, uint64& _n_total_super_kmers) {
+	void GetStats(double &time1, double &time2, uint64 &_n_unique, uint64 &_n_cutoff_min, uint64 &_n_cutoff_max, uint64 &_n_total, uint64 &_n_reads, uint64 &_tmp_size, uint64 &_tmp_size_written, uint64& _n_total_super_kmers) {
 		if (is_selected)
 		{
-			kmc->GetStats(time1, time2, _n_unique, _n_cutoff_min, _n_cutoff_max, _n_total, _n_reads, _tmp_size, _n_total_super_kmers);
+			kmc->GetStats(time1, time2, _n_unique, _n_cutoff_min, _n_cutoff_max, _n_total, _n_reads, _tmp_size, _tmp_size_written, _n_total_super_kmers);
 		}
 		else
-			app_1->GetStats(time1, time2, _n_unique, _n_cutoff_min, _n_cutoff_max, _n_total, _n_reads, _tmp_size, _n_total_super_kmers);
+			app_1->GetStats(time1, time2, _n_unique, _n_cutoff_min, _n_cutoff_max, _n_total, _n_reads, _tmp_size, _tmp_size_written, _n_total_super_kmers);
 	}
 
 	bool Process() {
@@ -106,11 +106,11 @@ public:
 			delete kmc;
 	};
 
-	void GetStats(double &time1, double &time2, uint64 &_n_unique, uint64 &_n_cutoff_min, uint64 &_n_cutoff_max, uint64 &_n_total, uint64 &_n_reads, uint64 &_tmp_size, uint64& _n_total_super_kmers) {
+	void GetStats(double &time1, double &time2, uint64 &_n_unique, uint64 &_n_cutoff_min, uint64 &_n_cutoff_max, uint64 &_n_total, uint64 &_n_reads, uint64 &_tmp_size, uint64 &_tmp_size_written, uint64& _n_total_super_kmers) {
 		if (is_selected)
 		{
 			if(kmc)
-				kmc->GetStats(time1, time2, _n_unique, _n_cutoff_min, _n_cutoff_max, _n_total, _n_reads, _tmp_size, _n_total_super_kmers);
+				kmc->GetStats(time1, time2, _n_unique, _n_cutoff_min, _n_cutoff_max, _n_total, _n_reads, _tmp_size, _tmp_size_written, _n_total_super_kmers);
 		}
 	}
 
@@ -129,16 +129,22 @@ public:
 void usage()
 {
 	cout << "K-Mer Counter (KMC) ver. " << KMC_VER << " (" << KMC_DATE << ")\n";
-	cout << "Usage:\n kmc [options] <input_file_name> <output_file_name> <working_directory>\n";
-	cout << " kmc [options] <@input_file_names> <output_file_name> <working_directory>\n";
+	cout << "Usage:\n kmc [options] <input_file_name> <output_file_name> <working_directory>[,<working_directory>...]\n";
+	cout << " kmc [options] <@input_file_names> <output_file_name> <working_directory>[,<working_directory>...]\n";
 	cout << "Parameters:\n";
-	cout << "  input_file_name - single file in FASTQ format (gziped or not)\n";
+	cout << "  input_file_name - single file in FASTQ format (gziped or not); - for the standard input\n";
 	cout << "  @input_file_names - file name with list of input files in FASTQ format (gziped or not)\n";
 	cout << "Options:\n";
 	cout << "  -v - verbose mode (shows all parameter settings); default: false\n";
 	cout << "  -k<len> - k-mer length (k from " << MIN_K << " to " << MAX_K << "; default: 25\n";
 	cout << "  -m<size> - max amount of RAM in GB (from 4 to 1024); default: 12\n";
-	cout << "  -p<par> - signature length (5, 6, 7, 8); default: 7\n";
+	cout << "  -p<par> - signature length (" << MIN_SL << " to " << MAX_SL << "); default: 7\n";
+	cout << "  -n<bins> - max. number of bins (" << MIN_N_BINS << " to " << MAX_N_BINS << "); default: " << DEFAULT_N_BINS << "\n";
+	cout << "  -l<h/c> - assignment of signatures to bins: heuristic on k-mer counts (-lh) or LPT on estimated stage 2 cost (-lc); default: heuristic\n";
+	cout << "  -sa<fraction> - sample the given fraction (0 to 1) of input in stage 0 instead of reading the heads of files\n";
+	cout << "  -ss<file_name> - save statistics of signatures (stage 0) to a file\n";
+	cout << "  -sl<file_name> - load statistics of signatures from a file saved for the same k, signature length and order (stage 0 is skipped)\n";
+	cout << "  -o<l/h> - order of signatures: lexicographic (-ol) or random hash (-oh); default: lexicographic\n";
 	cout << "  -f<a/q/m> - input in FASTA format (-fa), FASTQ format (-fq) or mulit FASTA (-fm); default: FASTQ\n";
 	cout << "  -q[value] - use Quake's compatible counting with [value] representing lowest quality (default: 33)\n";
 	cout << "  -ci<value> - exclude k-mers occurring less than <value> times (default: 2)\n";
@@ -146,11 +152,18 @@ void usage()
 	cout << "  -cx<value> - exclude k-mers occurring more of than <value> times (default: 1e9)\n";
 	cout << "  -b - turn off transformation of k-mers into canonical form\n";	
 	cout << "  -r - turn on RAM-only mode \n";
+	cout << "  -rh<size> - hybrid mode: keep up to <size> GB of temporary bins in RAM, the largest bins are spilled to disk above it\n";
+	cout << "  -z - compress temporary files (ignored in RAM-only mode)\n";
+	cout << "  -d - write temporary files with direct I/O bypassing the page cache (ignored in RAM-only mode, with -z and -e)\n";
+	cout << "  -e - keep temporary bins as extents of a single preallocated file per working directory (ignored in RAM-only mode)\n";
 	cout << "  -t<value> - total number of threads (default: no. of CPU cores)\n";
 	cout << "  -sf<value> - number of FASTQ reading threads\n";
 	cout << "  -sp<value> - number of splitting threads\n";
 	cout << "  -sr<value> - number of sorter threads\n";
-	cout << "  -so<value> - number of threads per single sorter\n";	
+	cout << "  -so<value> - number of threads per single sorter (the threads of all sorters form a shared pool)\n";	
+	cout << "  -sz<value> - number of decompression threads per FASTQ reader (multi-member gzip, e.g., BGZF, files)\n";
+	cout << "  -sw<value> - number of threads writing temporary files (default: 1)\n";
+	cout << "  -sb<value> - number of threads reading bins in stage 2 per working directory (default: 2)\n";
 	cout << "Example:\n";
 	cout << "kmc -k27 -m24 NA19238.fastq NA.res \\data\\kmc_tmp_dir\\\n";
 	cout << "kmc -k27 -q -m24 @files.lst NA.res \\data\\kmc_tmp_dir\\\n";
@@ -168,7 +181,7 @@ bool parse_parameters(int argc, char *argv[])
 
 	for(i = 1 ; i < argc; ++i)
 	{
-		if(argv[i][0] != '-')
+		if(argv[i][0] != '-' || argv[i][1] == 0)		// "-" is the standard input
 			break;
 		// Number of threads
 		if(strncmp(argv[i], "-t", 2) == 0)
@@ -234,12 +247,50 @@ bool parse_parameters(int argc, char *argv[])
 			Params.p_file_type = fastq;
 		else if(strncmp(argv[i], "-fm", 3) == 0)
 			Params.p_file_type = multiline_fasta;
+		// Number of bins
+		else if (strncmp(argv[i], "-n", 2) == 0)
+		{
+			tmp = atoi(&argv[i][2]);
+			if (tmp < MIN_N_BINS || tmp > MAX_N_BINS)
+			{
+				cout << "Wrong parameter: number of bins must be from range <" << MIN_N_BINS << "," << MAX_N_BINS << ">\n";
+				return false;
+			}
+			else
+				Params.p_n_bins = tmp;
+		}
+		// Assignment of signatures to bins
+		else if(strncmp(argv[i], "-lh", 3) == 0)
+			Params.p_cost_packing = false;
+		else if(strncmp(argv[i], "-lc", 3) == 0)
+			Params.p_cost_packing = true;
+		// Order of signatures
+		else if(strncmp(argv[i], "-ol", 3) == 0)
+			Params.p_signature_order = sig_lexicographic;
+		else if(strncmp(argv[i], "-oh", 3) == 0)
+			Params.p_signature_order = sig_hash;
 		else if(strncmp(argv[i], "-v", 2) == 0)
 			Params.p_verbose = true;		
+		else if(strncmp(argv[i], "-rh", 3) == 0)
+		{
+			tmp = atoi(&argv[i][3]);
+			if(tmp < 1)
+			{
+				usage();
+				return false;
+			}
+			Params.p_hybrid_mem = tmp;
+		}
 		else if (strncmp(argv[i], "-r", 2) == 0)
 			Params.p_mem_mode = true;
 		else if(strncmp(argv[i], "-b", 2) == 0)
 			Params.p_both_strands = false;
+		else if(strncmp(argv[i], "-z", 2) == 0)
+			Params.p_tmp_compress = true;
+		else if(strncmp(argv[i], "-d", 2) == 0)
+			Params.p_direct_io = true;
+		else if(strncmp(argv[i], "-e", 2) == 0)
+			Params.p_tmp_store = true;
 		// Number of reading threads
 		else if(strncmp(argv[i], "-sf", 3) == 0)
 		{
@@ -288,6 +339,59 @@ bool parse_parameters(int argc, char *argv[])
 			else
 				Params.p_sr = tmp;
 		}
+		// Sampling of input in stage 0
+		else if(strncmp(argv[i], "-sa", 3) == 0)
+		{
+			double frac = atof(&argv[i][3]);
+			if(frac <= 0.0 || frac > 1.0)
+			{
+				cout << "Wrong parameter: sampled fraction of input must be in range (0,1]\n";
+				return false;
+			}
+			else
+				Params.p_sa = frac;
+		}
+		// File of signature statistics
+		else if(strncmp(argv[i], "-ss", 3) == 0)
+			Params.stats_save_file_name = string(argv[i] + 3);
+		else if(strncmp(argv[i], "-sl", 3) == 0)
+			Params.stats_load_file_name = string(argv[i] + 3);
+		// Number of threads writing temporary files
+		else if(strncmp(argv[i], "-sw", 3) == 0)
+		{
+			tmp = atoi(&argv[i][3]);
+			if(tmp < MIN_SW || tmp > MAX_SW)
+			{
+				cout << "Wrong parameter: number of writing threads must be in range <" << MIN_SW << "," << MAX_SW << ">\n";
+				return false;
+			}
+			else
+				Params.p_sw = tmp;
+		}
+		// Number of threads reading bins (per working directory)
+		else if(strncmp(argv[i], "-sb", 3) == 0)
+		{
+			tmp = atoi(&argv[i][3]);
+			if(tmp < MIN_SB || tmp > MAX_SB)
+			{
+				cout << "Wrong parameter: number of bin reading threads must be in range <" << MIN_SB << "," << MAX_SB << ">\n";
+				return false;
+			}
+			else
+				Params.p_sb = tmp;
+		}
+		// Number of decompression threads (per single reader)
+		else if(strncmp(argv[i], "-sz", 3) == 0)
+		{
+			tmp = atoi(&argv[i][3]);
+			if(tmp < MIN_SZ || tmp > MAX_SZ)
+			{
+				cout << "Wrong parameter: number of decompression threads per single reader must be in range <" << MIN_SZ << "," << MAX_SZ << ">\n";
+				return false;
+			}
+			else
+				Params.p_sz = tmp;
+		}
 	}
 
 	if(argc - i < 3)
@@ -295,7 +399,20 @@ bool parse_parameters(int argc, char *argv[])
 
 	string input_file_name = string(argv[i++]);
 	Params.output_file_name = string(argv[i++]);
-	Params.working_directory = string(argv[i++]);
+
+	// Temporary files can be spread over several (comma separated) directories, e.g., on separate disks
+	string working_directories = string(argv[i++]);
+	Params.working_directories.clear();
+	for(size_t start = 0, end; start <= working_directories.size(); start = end + 1)
+	{
+		end = working_directories.find(',', start);
+		if(end == string::npos)
+			end = working_directories.size();
+		if(end > start)
+			Params.working_directories.push_back(working_directories.substr(start, end - start));
+	}
+	if(Params.working_directories.empty())
+		return false;
 
 	Params.input_file_names.clear();
 	if(input_file_name[0] != '@')
@@ -327,9 +444,7 @@ int _tmain(int argc, _TCHAR* argv[])
 {
 	CStopWatch w0, w1;
 	double time1, time2;
-	uint64 n_unique, n_cutoff_min, n_cutoff_max, n_total, n_reads, tmp_size, n_total_super_kmers;
-
-	omp_set_num_threads(1);
+	uint64 n_unique, n_cutoff_min, n_cutoff_max, n_total, n_reads, tmp_size, tmp_size_written, n_total_super_kmers;
 
 #ifdef WIN32
 	_setmaxstdio(2040);
@@ -351,7 +466,7 @@ int _tmain(int argc, _TCHAR* argv[])
 			delete app;
 			return 0;
 		}
-		app->GetStats(time1, time2, n_unique, n_cutoff_min, n_cutoff_max, n_total, n_reads, tmp_size, n_total_super_kmers);
+		app->GetStats(time1, time2, n_unique, n_cutoff_min, n_cutoff_max, n_total, n_reads, tmp_size, tmp_size_written, n_total_super_kmers);
 		delete app;
 	}
 	else
@@ -364,7 +479,7 @@ int _tmain(int argc, _TCHAR* argv[])
 			delete app;
 			return 0;
 		}
-		app->GetStats(time1, time2, n_unique, n_cutoff_min, n_cutoff_max, n_total, n_reads, tmp_size, n_total_super_kmers);
+		app->GetStats(time1, time2, n_unique, n_cutoff_min, n_cutoff_max, n_total, n_reads, tmp_size, tmp_size_written, n_total_super_kmers);
 		delete app;
 	}
 
@@ -372,7 +487,10 @@ int _tmain(int argc, _TCHAR* argv[])
 	cout << "2nd stage: " << time2  << "s\n";
 	cout << "Total    : " << (time1+time2) << "s\n";
 	//cout << "Tmp size : " << tmp_size / (1 << 20) << "MB\n";
-	cout << "Tmp size : " << tmp_size / 1000000 << "MB\n";
+	cout << "Tmp size : " << tmp_size / 1000000 << "MB";
+	if(tmp_size_written != tmp_size && tmp_size)
+		cout << " (compressed: " << tmp_size_written / 1000000 << "MB, " << tmp_size_written * 100 / tmp_size << "%)";
+	cout << "\n";
 	cout << "\nStats:\n";
 	cout << "   No. of k-mers below min. threshold : " << setw(12) << n_cutoff_min << "\n";
 	cout << "   No. of k-mers above max. threshold : " << setw(12) << n_cutoff_max << "\n";
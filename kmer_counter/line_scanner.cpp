@@ -0,0 +1,196 @@
+#include "stdafx.h"
+/*
+  This file is a part of KMC software distributed under GNU GPL 3 licence.
+  The homepage of the KMC project is http://sun.aei.polsl.pl/kmc
+
+  Authors: Sebastian Deorowicz, Agnieszka Debudaj-Grabysz, Marek Kokot
+
+  Version: 2.0
+  Date   : 2014-07-04
+*/
+
+#include "line_scanner.h"
+#include "libs/asmlib.h"
+
+#if defined(__x86_64__) || defined(_M_X64)
+#define LINE_SCANNER_SIMD
+#include <immintrin.h>
+#endif
+
+#ifdef _MSC_VER
+#include <intrin.h>
+#define TARGET_AVX2
+#else
+#define TARGET_AVX2 __attribute__((target("avx2")))
+#endif
+
+CLineScanner::find_t CLineScanner::find_line_end;
+CLineScanner::find_t CLineScanner::find_eol;
+CLineScanner::find_char_t CLineScanner::find_char;
+CLineScanner::_si CLineScanner::_init;
+
+//----------------------------------------------------------------------------------
+// Byte predicates
+struct CLineEndPred {
+	bool Match(uchar x) const { return x < 32; }
+};
+
+struct CEOLPred {
+	bool Match(uchar x) const { return x == '\n' || x == '\r'; }
+};
+
+struct CCharPred {
+	uchar c;
+	bool Match(uchar x) const { return x == c; }
+};
+
+//----------------------------------------------------------------------------------
+template<typename PRED> uint64 FindScalar(const uchar *p, uint64 pos, uint64 size, const PRED &pred)
+{
+	for(; pos < size && !pred.Match(p[pos]); ++pos)
+		;
+	return pos;
+}
+
+#ifdef LINE_SCANNER_SIMD
+//----------------------------------------------------------------------------------
+static inline uint32 LowestBit(uint32 x)
+{
+#ifdef _MSC_VER
+	unsigned long r;
+	_BitScanForward(&r, x);
+	return r;
+#else
+	return __builtin_ctz(x);
+#endif
+}
+
+//----------------------------------------------------------------------------------
+// Masks of matching bytes in 16-byte vectors
+static inline uint32 MatchMask(__m128i x, const CLineEndPred &)
+{
+	const __m128i thr = _mm_set1_epi8(31);
+	return _mm_movemask_epi8(_mm_cmpeq_epi8(_mm_max_epu8(x, thr), thr));			// x <= 31
+}
+
+static inline uint32 MatchMask(__m128i x, const CEOLPred &)
+{
+	return _mm_movemask_epi8(_mm_or_si128(_mm_cmpeq_epi8(x, _mm_set1_epi8('\n')), _mm_cmpeq_epi8(x, _mm_set1_epi8('\r'))));
+}
+
+static inline uint32 MatchMask(__m128i x, const CCharPred &pred)
+{
+	return _mm_movemask_epi8(_mm_cmpeq_epi8(x, _mm_set1_epi8((char) pred.c)));
+}
+
+//----------------------------------------------------------------------------------
+// Masks of matching bytes in 32-byte vectors
+TARGET_AVX2 static inline uint32 MatchMask(__m256i x, const CLineEndPred &)
+{
+	const __m256i thr = _mm256_set1_epi8(31);
+	return _mm256_movemask_epi8(_mm256_cmpeq_epi8(_mm256_max_epu8(x, thr), thr));
+}
+
+TARGET_AVX2 static inline uint32 MatchMask(__m256i x, const CEOLPred &)
+{
+	return _mm256_movemask_epi8(_mm256_or_si256(_mm256_cmpeq_epi8(x, _mm256_set1_epi8('\n')), _mm256_cmpeq_epi8(x, _mm256_set1_epi8('\r'))));
+}
+
+TARGET_AVX2 static inline uint32 MatchMask(__m256i x, const CCharPred &pred)
+{
+	return _mm256_movemask_epi8(_mm256_cmpeq_epi8(x, _mm256_set1_epi8((char) pred.c)));
+}
+
+//----------------------------------------------------------------------------------
+template<typename PRED> uint64 FindSSE2(const uchar *p, uint64 pos, uint64 size, const PRED &pred)
+{
+	for(; pos + 16 <= size; pos += 16)
+	{
+		uint32 m = MatchMask(_mm_loadu_si128((const __m128i *) (p + pos)), pred);
+		if(m)
+			return pos + LowestBit(m);
+	}
+
+	return FindScalar(p, pos, size, pred);
+}
+
+//----------------------------------------------------------------------------------
+template<typename PRED> TARGET_AVX2 uint64 FindAVX2(const uchar *p, uint64 pos, uint64 size, const PRED &pred)
+{
+	// Lines are usually short, so the first bytes are checked with a 16-byte vector
+	if(pos + 16 <= size)
+	{
+		uint32 m = MatchMask(_mm_loadu_si128((const __m128i *) (p + pos)), pred);
+		if(m)
+			return pos + LowestBit(m);
+		pos += 16;
+	}
+
+	for(; pos + 32 <= size; pos += 32)
+	{
+		uint32 m = MatchMask(_mm256_loadu_si256((const __m256i *) (p + pos)), pred);
+		if(m)
+			return pos + LowestBit(m);
+	}
+
+	return FindSSE2(p, pos, size, pred);
+}
+#endif
+
+//----------------------------------------------------------------------------------
+// Variants of the search functions
+static uint64 FindLineEndScalar(const uchar *p, uint64 pos, uint64 size)	{ return FindScalar(p, pos, size, CLineEndPred()); }
+static uint64 FindEOLScalar(const uchar *p, uint64 pos, uint64 size)		{ return FindScalar(p, pos, size, CEOLPred()); }
+static uint64 FindCharScalar(const uchar *p, uint64 pos, uint64 size, uchar c)
+{
+	CCharPred pred;
+	pred.c = c;
+	return FindScalar(p, pos, size, pred);
+}
+
+#ifdef LINE_SCANNER_SIMD
+static uint64 FindLineEndSSE2(const uchar *p, uint64 pos, uint64 size)		{ return FindSSE2(p, pos, size, CLineEndPred()); }
+static uint64 FindEOLSSE2(const uchar *p, uint64 pos, uint64 size)			{ return FindSSE2(p, pos, size, CEOLPred()); }
+static uint64 FindCharSSE2(const uchar *p, uint64 pos, uint64 size, uchar c)
+{
+	CCharPred pred;
+	pred.c = c;
+	return FindSSE2(p, pos, size, pred);
+}
+
+TARGET_AVX2 static uint64 FindLineEndAVX2(const uchar *p, uint64 pos, uint64 size)	{ return FindAVX2(p, pos, size, CLineEndPred()); }
+TARGET_AVX2 static uint64 FindEOLAVX2(const uchar *p, uint64 pos, uint64 size)		{ return FindAVX2(p, pos, size, CEOLPred()); }
+TARGET_AVX2 static uint64 FindCharAVX2(const uchar *p, uint64 pos, uint64 size, uchar c)
+{
+	CCharPred pred;
+	pred.c = c;
+	return FindAVX2(p, pos, size, pred);
+}
+#endif
+
+//----------------------------------------------------------------------------------
+// Choose the variant according to the instruction set supported by the CPU
+CLineScanner::_si::_si()
+{
+	find_line_end = FindLineEndScalar;
+	find_eol	  = FindEOLScalar;
+	find_char	  = FindCharScalar;
+
+#ifdef LINE_SCANNER_SIMD
+	int iset = InstructionSet();
+	if(iset >= 13)				// AVX2
+	{
+		find_line_end = FindLineEndAVX2;
+		find_eol	  = FindEOLAVX2;
+		find_char	  = FindCharAVX2;
+	}
+	else if(iset >= 4)			// SSE2
+	{
+		find_line_end = FindLineEndSSE2;
+		find_eol	  = FindEOLSSE2;
+		find_char	  = FindCharSSE2;
+	}
+#endif
+}
+
+// ***** EOF
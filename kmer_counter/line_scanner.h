@@ -0,0 +1,46 @@
+/*
+  This file is a part of KMC software distributed under GNU GPL 3 licence.
+  The homepage of the KMC project is http://sun.aei.polsl.pl/kmc
+
+  Authors: Sebastian Deorowicz, Agnieszka Debudaj-Grabysz, Marek Kokot
+
+  Version: 2.0
+  Date   : 2014-07-04
+*/
+
+#ifndef _LINE_SCANNER_H
+#define _LINE_SCANNER_H
+
+#include "defs.h"
+
+//************************************************************************************************************
+// CLineScanner - search for line ends and markers in FASTA/FASTQ buffers
+// AVX2 or SSE2 variants are chosen at start-up according to the CPU; scalar code is used otherwise.
+// All functions return the position of the first matching byte in [pos, size) or size if there is none.
+//************************************************************************************************************
+class CLineScanner {
+	typedef uint64 (*find_t)(const uchar *p, uint64 pos, uint64 size);
+	typedef uint64 (*find_char_t)(const uchar *p, uint64 pos, uint64 size, uchar c);
+
+	static find_t find_line_end;
+	static find_t find_eol;
+	static find_char_t find_char;
+
+	struct _si
+	{
+		_si();
+	} static _init;
+
+public:
+	// Control character (c < 32), i.e., the end of a line in the splitters
+	static inline uint64 FindLineEnd(const uchar *p, uint64 pos, uint64 size) { return find_line_end(p, pos, size); }
+
+	// '\n' or '\r'
+	static inline uint64 FindEOL(const uchar *p, uint64 pos, uint64 size) { return find_eol(p, pos, size); }
+
+	static inline uint64 FindChar(const uchar *p, uint64 pos, uint64 size, uchar c) { return find_char(p, pos, size, c); }
+};
+
+#endif
+
+// ***** EOF
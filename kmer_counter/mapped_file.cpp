@@ -0,0 +1,158 @@
+#include "stdafx.h"
+/*
+  This file is a part of KMC software distributed under GNU GPL 3 licence.
+  The homepage of the KMC project is http://sun.aei.polsl.pl/kmc
+
+  Authors: Sebastian Deorowicz, Agnieszka Debudaj-Grabysz, Marek Kokot
+
+  Version: 2.0
+  Date   : 2014-07-04
+*/
+
+#include "mapped_file.h"
+
+#ifndef WIN32
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
+#endif
+
+//----------------------------------------------------------------------------------
+CMappedFile::CMappedFile()
+{
+	fd	 = -1;
+	data = NULL;
+	size = 0;
+
+	max_views   = 1;
+	n_views     = 0;
+	detached    = false;
+	free_behind = false;
+}
+
+//----------------------------------------------------------------------------------
+CMappedFile::~CMappedFile()
+{
+#ifndef WIN32
+	if(data)
+		munmap(data, size);
+	if(fd >= 0)
+		close(fd);
+#endif
+}
+
+//----------------------------------------------------------------------------------
+bool CMappedFile::Supported()
+{
+#ifdef WIN32
+	return false;
+#else
+	return true;
+#endif
+}
+
+//----------------------------------------------------------------------------------
+// Map the file; NULL if the file cannot be mapped (it should be read in a regular way then)
+CMappedFile *CMappedFile::Open(const string &file_name, uint32 _max_views, bool _free_behind)
+{
+#ifdef WIN32
+	return NULL;
+#else
+	int fd = open(file_name.c_str(), O_RDONLY);
+	if(fd < 0)
+		return NULL;
+
+	struct stat st;
+	if(fstat(fd, &st) != 0 || !S_ISREG(st.st_mode) || st.st_size == 0)
+	{
+		close(fd);
+		return NULL;
+	}
+
+	void *p = mmap(NULL, st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+	if(p == MAP_FAILED)
+	{
+		close(fd);
+		return NULL;
+	}
+
+	// The file is read once from the beginning to the end
+	madvise(p, st.st_size, MADV_SEQUENTIAL);
+#ifdef POSIX_FADV_SEQUENTIAL
+	posix_fadvise(fd, 0, 0, POSIX_FADV_SEQUENTIAL);
+#endif
+
+	CMappedFile *mf = new CMappedFile;
+	mf->fd			= fd;
+	mf->data		= (uchar *) p;
+	mf->size		= st.st_size;
+	mf->max_views	= MAX(_max_views, 1u);
+	mf->free_behind = _free_behind;
+
+	return mf;
+#endif
+}
+
+//----------------------------------------------------------------------------------
+// Return a view of the file; waits if too many views are in use
+uchar *CMappedFile::GetView(uint64 offset, uint64 view_size)
+{
+	unique_lock<mutex> lck(mtx);
+	cv_views.wait(lck, [this]{return this->n_views < this->max_views;});
+	++n_views;
+	lck.unlock();
+
+#ifndef WIN32
+	// Start reading the view before a splitter touches it
+	uint64 page_size = sysconf(_SC_PAGESIZE);
+	uint64 start = offset / page_size * page_size;
+	madvise(data + start, offset + view_size - start, MADV_WILLNEED);
+#endif
+
+	return data + offset;
+}
+
+//----------------------------------------------------------------------------------
+// Release a view; its pages are no longer needed
+void CMappedFile::ReleaseView(uchar *view, uint64 view_size)
+{
+#ifndef WIN32
+	// Only the pages that are entirely inside the view are dropped, the border ones can be used by the neighbours
+	uint64 page_size = sysconf(_SC_PAGESIZE);
+	uint64 start = (view - data + page_size - 1) / page_size * page_size;
+	uint64 end   = (view - data + view_size) / page_size * page_size;
+	if(end > start)
+	{
+		madvise(data + start, end - start, MADV_DONTNEED);
+#ifdef POSIX_FADV_DONTNEED
+		if(free_behind)
+			posix_fadvise(fd, start, end - start, POSIX_FADV_DONTNEED);
+#endif
+	}
+#endif
+
+	unique_lock<mutex> lck(mtx);
+	--n_views;
+	bool last = detached && !n_views;
+	cv_views.notify_one();
+	lck.unlock();
+
+	if(last)
+		delete this;
+}
+
+//----------------------------------------------------------------------------------
+// The reader does not need the mapping any more
+void CMappedFile::Detach()
+{
+	unique_lock<mutex> lck(mtx);
+	detached = true;
+	bool last = !n_views;
+	lck.unlock();
+
+	if(last)
+		delete this;
+}
+
+// ***** EOF
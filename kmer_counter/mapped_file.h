@@ -0,0 +1,55 @@
+/*
+  This file is a part of KMC software distributed under GNU GPL 3 licence.
+  The homepage of the KMC project is http://sun.aei.polsl.pl/kmc
+
+  Authors: Sebastian Deorowicz, Agnieszka Debudaj-Grabysz, Marek Kokot
+
+  Version: 2.0
+  Date   : 2014-07-04
+*/
+
+#ifndef _MAPPED_FILE_H
+#define _MAPPED_FILE_H
+
+#include "defs.h"
+#include "queues.h"
+#include <string>
+
+using namespace std;
+
+//************************************************************************************************************
+// CMappedFile - read-only memory mapping of an input file
+// Parts of the file are passed to the splitters as views (no copy). The mapping is released when the reader
+// detached from it and all the views were released.
+//************************************************************************************************************
+class CMappedFile {
+	int fd;
+	uchar *data;
+	uint64 size;
+
+	uint32 max_views;
+	uint32 n_views;						// no. of views not released yet
+	bool detached;
+	bool free_behind;					// drop the released views from the page cache
+
+	mutex mtx;
+	condition_variable cv_views;
+
+	CMappedFile();
+	~CMappedFile();
+
+public:
+	static bool Supported();
+	static CMappedFile *Open(const string &file_name, uint32 _max_views, bool _free_behind);
+
+	uint64 Size() { return size; }
+	uchar *Data() { return data; }
+
+	uchar *GetView(uint64 offset, uint64 view_size);
+	void ReleaseView(uchar *view, uint64 view_size);
+	void Detach();
+};
+
+#endif
+
+// ***** EOF
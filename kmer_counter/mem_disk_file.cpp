@@ -12,24 +12,89 @@
 #include "mem_disk_file.h"
 #include "libs/asmlib.h"
 
+#ifndef WIN32
+#include <fcntl.h>
+#include <unistd.h>
+#endif
+
 //----------------------------------------------------------------------------------
 // Constructor 
-CMemDiskFile::CMemDiskFile(bool _memory_mode)
+CMemDiskFile::CMemDiskFile(bool _memory_mode, bool _direct_io)
 {
 	memory_mode = _memory_mode;
+	direct_io	= _direct_io && !_memory_mode;
+	file = NULL;
+
+	direct_pos	= 0;
+	tail_raw	= NULL;
+	tail		= NULL;
+	tail_size	= 0;
+
+	store		= NULL;
+	read_extent = 0;
+	read_pos	= 0;
+
+	spiller		= NULL;
+}
+
+//----------------------------------------------------------------------------------
+// Constructor of a file kept in the store
+CMemDiskFile::CMemDiskFile(CTmpStore *_store)
+{
+	memory_mode = false;
+	direct_io	= false;
 	file = NULL;
+
+	direct_pos	= 0;
+	tail_raw	= NULL;
+	tail		= NULL;
+	tail_size	= 0;
+
+	store		= _store;
+	read_extent = 0;
+	read_pos	= 0;
+
+	spiller		= NULL;
+}
+
+//----------------------------------------------------------------------------------
+// Constructor of a file of hybrid mode (kept in memory until spilled)
+CMemDiskFile::CMemDiskFile(CMemDiskSpiller *_spiller) : CMemDiskFile(true)
+{
+	spiller = _spiller;
 }
 
 //----------------------------------------------------------------------------------
 void CMemDiskFile::Open(const string& f_name)
 {
-	if(memory_mode)
+	if(spiller && memory_mode)
+	{
+		file_name = f_name;
+		spiller->Register(this);
+	}
+	else if(memory_mode || store)
 	{
 
 	}
 	else
 	{
-		file = fopen(f_name.c_str(), "wb+");
+#if !defined(WIN32) && defined(O_DIRECT)
+		// Some file systems (e.g., tmpfs) do not support direct I/O; the file is written in a regular way then
+		if(direct_io)
+		{
+			int fd = open(f_name.c_str(), O_RDWR | O_CREAT | O_TRUNC | O_DIRECT, 0644);
+			if(fd >= 0 && (file = fdopen(fd, "wb+")) == NULL)
+				close(fd);
+		}
+#endif
+		direct_io = file != NULL;
+		if(direct_io)
+		{
+			tail_raw = new uchar[2 * DIRECT_IO_ALIGNMENT];
+			tail	 = tail_raw + DIRECT_IO_ALIGNMENT - ((uint64) tail_raw) % DIRECT_IO_ALIGNMENT;
+		}
+		else
+			file = fopen(f_name.c_str(), "wb+");
 
 		if (!file)
 		{
@@ -46,13 +111,66 @@ void CMemDiskFile::Rewind()
 	if(memory_mode)
 	{
 
+	}
+	else if(store)
+	{
+		read_extent = 0;
+		read_pos	= 0;
 	}
 	else
 	{
+		if(direct_io && !FlushTail())
+		{
+			cout << "Error while writing to temporary file\n";
+			exit(1);
+		}
 		rewind(file);
 	}
 }
 
+//----------------------------------------------------------------------------------
+// Tell the OS that the file will be read soon (it is read in the background) or is no longer needed
+void CMemDiskFile::Advise(bool will_need)
+{
+	if(memory_mode)
+	{
+
+	}
+	else if(store)
+	{
+		for(auto p = extents.begin(); p != extents.end(); ++p)
+			store->Advise(p->first, p->second, will_need);
+	}
+	else
+	{
+#if !defined(WIN32) && defined(POSIX_FADV_WILLNEED)
+		posix_fadvise(fileno(file), 0, 0, will_need ? POSIX_FADV_WILLNEED : POSIX_FADV_DONTNEED);
+#endif
+	}
+}
+
+//----------------------------------------------------------------------------------
+// Write the tail and turn off direct I/O, so the file can be read in a regular way
+bool CMemDiskFile::FlushTail()
+{
+	direct_io = false;
+#if !defined(WIN32) && defined(O_DIRECT)
+	int fd = fileno(file);
+	if(fcntl(fd, F_SETFL, fcntl(fd, F_GETFL) & ~O_DIRECT) != 0)
+		return false;
+	for(uint32 pos = 0; pos < tail_size; )
+	{
+		ssize_t w = pwrite(fd, tail + pos, tail_size - pos, direct_pos + pos);
+		if(w <= 0)
+			return false;
+		pos += (uint32) w;
+	}
+#endif
+	direct_pos += tail_size;
+	tail_size = 0;
+	return true;
+}
+
 //----------------------------------------------------------------------------------
 int CMemDiskFile::Close()
 {
@@ -63,10 +181,19 @@ int CMemDiskFile::Close()
 			delete[] p.first;
 		}
 		container.clear();
+		if(spiller)
+			spiller->Release(this);
+		return 0;
+	}
+	else if(store)
+	{
+		extents.clear();
 		return 0;
 	}
 	else
 	{
+		delete[] tail_raw;
+		tail_raw = tail = NULL;
 		return fclose(file);
 	}
 }
@@ -84,8 +211,12 @@ size_t CMemDiskFile::Read(uchar * ptr, size_t size, size_t count)
 			delete[] p.first;
 		}
 		container.clear();
+		if(spiller)
+			spiller->Release(this);
 		return pos;
 	}
+	else if(store)
+		return ReadExtents(ptr, size * count) / size;
 	else
 	{
 		return fread(ptr, size, count, file);
@@ -95,6 +226,13 @@ size_t CMemDiskFile::Read(uchar * ptr, size_t size, size_t count)
 //----------------------------------------------------------------------------------
 size_t CMemDiskFile::Write(const uchar * ptr, size_t size, size_t count)
 {
+	unique_lock<mutex> lck(mtx, defer_lock);
+	if(spiller)
+	{
+		MakeRoom(size * count);
+		lck.lock();
+	}
+
 	if(memory_mode)
 	{
 		uchar *buf = new uchar[size * count];
@@ -102,8 +240,235 @@ size_t CMemDiskFile::Write(const uchar * ptr, size_t size, size_t count)
 		container.push_back(make_pair(buf, size * count));
 		return size * count;
 	}
+	else if(store)
+	{
+		uint64 offset = store->Reserve(size * count);
+		if(!store->Write(offset, ptr, size * count))
+			return 0;
+		AddExtent(offset, size * count);
+		return count;
+	}
 	else
 	{
 		return fwrite(ptr, size, count, file);
 	}
 }
+
+//----------------------------------------------------------------------------------
+// Gather write of parts (no copy to an intermediate buffer)
+size_t CMemDiskFile::WriteParts(const vector<elem_t> &parts)
+{
+	unique_lock<mutex> lck(mtx, defer_lock);
+	if(spiller)
+	{
+		uint64 size = 0;
+		for(auto& p : parts)
+			size += p.second;
+		MakeRoom(size);
+		lck.lock();
+	}
+
+	if(memory_mode)
+	{
+		uint64 size = 0;
+		for(auto& p : parts)
+			size += p.second;
+		uchar *buf = new uchar[size];
+		uint64 pos = 0;
+		for(auto& p : parts)
+		{
+			A_memcpy(buf + pos, p.first, p.second);
+			pos += p.second;
+		}
+		container.push_back(make_pair(buf, size));
+		return size;
+	}
+	else if(store)
+	{
+		uint64 size = 0;
+		for(auto& p : parts)
+			size += p.second;
+		uint64 offset = store->Reserve(size);
+		if(!store->WriteParts(offset, parts))
+			return 0;
+		AddExtent(offset, size);
+		return size;
+	}
+
+	size_t written = 0;
+#ifdef WIN32
+	for(auto& p : parts)
+		written += fwrite(p.first, 1, p.second, file);
+#else
+	// The file is not buffered, so its descriptor can be written directly
+	written = WriteGathered(fileno(file), parts);
+#endif
+	return written;
+}
+
+//----------------------------------------------------------------------------------
+// Direct write of aligned data (address and size must be multiples of DIRECT_IO_ALIGNMENT)
+size_t CMemDiskFile::WriteDirect(const uchar * ptr, uint64 size)
+{
+	size_t written = 0;
+#ifndef WIN32
+	while(written < size)
+	{
+		ssize_t w = pwrite(fileno(file), ptr + written, size - written, direct_pos);
+		if(w <= 0)
+			break;
+		written	   += w;
+		direct_pos += w;
+	}
+#endif
+	return written;
+}
+
+//----------------------------------------------------------------------------------
+// Move the tail of the data written directly to ptr; returns its size
+uint32 CMemDiskFile::TakeTail(uchar *ptr)
+{
+	uint32 size = tail_size;
+	A_memcpy(ptr, tail, tail_size);
+	tail_size = 0;
+	return size;
+}
+
+//----------------------------------------------------------------------------------
+// Keep the unaligned end of the data for the next direct write
+void CMemDiskFile::PutTail(const uchar *ptr, uint32 size)
+{
+	A_memcpy(tail, ptr, size);
+	tail_size = size;
+}
+
+//----------------------------------------------------------------------------------
+// Neighbouring extents are joined, so they are read at once
+void CMemDiskFile::AddExtent(uint64 offset, uint64 size)
+{
+	if(!extents.empty() && extents.back().first + extents.back().second == offset)
+		extents.back().second += size;
+	else
+		extents.push_back(make_pair(offset, size));
+}
+
+//----------------------------------------------------------------------------------
+// Sequential read of the extents from the current position
+size_t CMemDiskFile::ReadExtents(uchar * ptr, uint64 size)
+{
+	uint64 pos = 0;
+	while(pos < size && read_extent < extents.size())
+	{
+		uint64 n = MIN(size - pos, extents[read_extent].second - read_pos);
+		uint64 r = store->Read(extents[read_extent].first + read_pos, ptr + pos, n);
+		pos		 += r;
+		read_pos += r;
+		if(r < n)
+			break;
+		if(read_pos == extents[read_extent].second)
+		{
+			++read_extent;
+			read_pos = 0;
+		}
+	}
+	return pos;
+}
+
+//----------------------------------------------------------------------------------
+// Hybrid mode: spill the bins chosen by the spiller (possibly this one) if the new data exceed the budget
+void CMemDiskFile::MakeRoom(uint64 size)
+{
+	vector<CMemDiskFile*> to_spill = spiller->Acquire(this, size);
+	for(auto p = to_spill.begin(); p != to_spill.end(); ++p)
+		(*p)->Spill();
+}
+
+//----------------------------------------------------------------------------------
+// Move the data kept in memory to a disk file; the file is in disk mode since then
+void CMemDiskFile::Spill()
+{
+	lock_guard<mutex> lck(mtx);
+	if(!memory_mode)
+		return;
+
+	memory_mode = false;
+	Open(file_name);
+	for(auto& p : container)
+	{
+		if(fwrite(p.first, 1, p.second, file) != p.second)
+		{
+			cout << "Error while writing to temporary file " << file_name << "\n";
+			exit(1);
+		}
+		delete[] p.first;
+	}
+	container.clear();
+}
+
+
+//************************************************************************************************************
+// CMemDiskSpiller
+//************************************************************************************************************
+
+//----------------------------------------------------------------------------------
+CMemDiskSpiller::CMemDiskSpiller(uint64 _budget)
+{
+	budget	  = _budget;
+	used	  = 0;
+	n_spilled = 0;
+}
+
+//----------------------------------------------------------------------------------
+void CMemDiskSpiller::Register(CMemDiskFile *file)
+{
+	lock_guard<mutex> lck(mtx);
+	in_memory[file] = 0;
+}
+
+//----------------------------------------------------------------------------------
+// Account new data of a bin; returns the bins that must be spilled to keep the budget
+vector<CMemDiskFile*> CMemDiskSpiller::Acquire(CMemDiskFile *file, uint64 size)
+{
+	lock_guard<mutex> lck(mtx);
+	vector<CMemDiskFile*> to_spill;
+
+	auto p = in_memory.find(file);
+	if(p == in_memory.end())				// already on disk
+		return to_spill;
+	p->second += size;
+	used	  += size;
+
+	while(used > budget)
+	{
+		auto largest = in_memory.begin();
+		for(auto q = in_memory.begin(); q != in_memory.end(); ++q)
+			if(q->second > largest->second)
+				largest = q;
+
+		to_spill.push_back(largest->first);
+		used -= largest->second;
+		in_memory.erase(largest);
+		++n_spilled;
+	}
+
+	return to_spill;
+}
+
+//----------------------------------------------------------------------------------
+// The data of a bin were released
+void CMemDiskSpiller::Release(CMemDiskFile *file)
+{
+	lock_guard<mutex> lck(mtx);
+	auto p = in_memory.find(file);
+	if(p == in_memory.end())
+		return;
+	used -= p->second;
+	in_memory.erase(p);
+}
+
+//----------------------------------------------------------------------------------
+uint32 CMemDiskSpiller::NoSpilled()
+{
+	lock_guard<mutex> lck(mtx);
+	return n_spilled;
+}
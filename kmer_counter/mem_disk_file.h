@@ -12,29 +12,93 @@
 #define _MEM_DISK_FILE_H
 
 #include "defs.h"
+#include "tmp_store.h"
 #include <string>
+#include <vector>
+#include <map>
 #include <stdio.h>
 using namespace std;
 
+class CMemDiskSpiller;
+
 
 //************************************************************************************************************
-// CMemDiskFile - wrapper for FILE* or memory equivalent
+// CMemDiskFile - wrapper for FILE*, memory equivalent or a list of extents of a temporary store
+// In hybrid mode the file is kept in memory until the spiller moves it to disk.
+// In direct I/O mode the file is written by aligned blocks bypassing the page cache. The last, unaligned, part
+// of the data is kept as a tail and written in a regular way when the file is rewound for reading.
 //************************************************************************************************************
 class CMemDiskFile
 {
+public:
+	typedef pair<uchar*, uint64> elem_t;//buf,size
+
+private:
 	bool memory_mode;
+	bool direct_io;
 	FILE* file;
-	typedef pair<uchar*, uint64> elem_t;//buf,size
 	typedef vector<elem_t> container_t;
 
 	container_t container;
+
+	uint64 direct_pos;				// file position of direct writes
+	uchar *tail_raw, *tail;
+	uint32 tail_size;
+
+	CTmpStore *store;
+	vector<pair<uint64, uint64>> extents;		// offset, size
+	size_t read_extent;
+	uint64 read_pos;				// position in the current extent
+
+	CMemDiskSpiller *spiller;
+	string file_name;
+	mutex mtx;						// hybrid mode: writes vs. spilling
+
+	bool FlushTail();
+	void MakeRoom(uint64 size);
+	void AddExtent(uint64 offset, uint64 size);
+	size_t ReadExtents(uchar * ptr, uint64 size);
 public:
-	CMemDiskFile(bool _memory_mode);
+	CMemDiskFile(bool _memory_mode, bool _direct_io = false);
+	CMemDiskFile(CTmpStore *_store);
+	CMemDiskFile(CMemDiskSpiller *_spiller);
 	void Open(const string& f_name);
 	void Rewind();
+	void Advise(bool will_need);
 	int Close();
 	size_t Read(uchar * ptr, size_t size, size_t count);
 	size_t Write(const uchar * ptr, size_t size, size_t count);
+	size_t WriteParts(const vector<elem_t> &parts);
+
+	bool InMemory() { return memory_mode; }
+	const vector<elem_t> &Chunks() { return container; }	// data kept in memory (used in place in stage 2)
+	void Spill();
+
+	bool DirectIO() { return direct_io; }
+	size_t WriteDirect(const uchar * ptr, uint64 size);
+	uint32 TakeTail(uchar *ptr);
+	void PutTail(const uchar *ptr, uint32 size);
+};
+
+//************************************************************************************************************
+// CMemDiskSpiller - memory budget of the bins kept in RAM in hybrid mode
+// If the budget is exceeded, the largest bins are spilled to disk.
+//************************************************************************************************************
+class CMemDiskSpiller
+{
+	uint64 budget;
+	uint64 used;
+	map<CMemDiskFile*, uint64> in_memory;		// bins kept in RAM and their sizes
+	uint32 n_spilled;
+	mutex mtx;
+
+public:
+	CMemDiskSpiller(uint64 _budget);
+
+	void Register(CMemDiskFile *file);
+	vector<CMemDiskFile*> Acquire(CMemDiskFile *file, uint64 size);
+	void Release(CMemDiskFile *file);
+	uint32 NoSpilled();
 };
 
 #endif
@@ -12,38 +12,64 @@
 #include "mmer.h"
 
 
-uint32 CMmer::norm5[];
-uint32 CMmer::norm6[];
-uint32 CMmer::norm7[];
-uint32 CMmer::norm8[];
+uint32* CMmer::norm_tables[2][CMmer::MAX_LEN + 1];
 
 CMmer::_si CMmer::_init;
 
 
 //--------------------------------------------------------------------------
-CMmer::CMmer(uint32 _len)
+// The table for m-mers longer than 8 symbols must be created by prepare() first
+CMmer::CMmer(uint32 _len, signature_order _order)
 {
-	switch (_len)
-	{
-	case 5:
-		norm = norm5;
-		break;
-	case 6:
-		norm = norm6;
-		break;
-	case 7:
-		norm = norm7;
-		break;
-	case 8:
-		norm = norm8;
-		break;
-	default:
-		break;
-	}
+	norm = norm_tables[_order][_len];
 	len = _len;
 	mask = (1 << _len * 2) - 1;
 	str = 0;
 }
 
 //--------------------------------------------------------------------------
+// Create the normalization table (not thread-safe, should be called before m-mers of given length are used)
+void CMmer::prepare(uint32 len, signature_order order)
+{
+	if (norm_tables[order][len])
+		return;
+
+	uint32* norm = new uint32[1 << len * 2];
+	if (order == sig_hash)
+		_si::init_hash_norm(norm, len);
+	else
+		_si::init_norm(norm, len);
+	norm_tables[order][len] = norm;
+}
+
+//--------------------------------------------------------------------------
+// Check if val is a value of some normalized m-mer
+bool CMmer::is_signature(uint32 val, uint32 len, signature_order order)
+{
+	if (order == sig_lexicographic)
+		return is_allowed(val, len);
+
+	if (val >= (1u << len * 2))
+		return false;
+	return val <= hash(_si::get_rev(unhash(val, len), len), len);
+}
+
+//--------------------------------------------------------------------------
+// _max_mmers - max. no. of m-mers in a k-mer
+CMmerWindow::CMmerWindow(uint32 _max_mmers)
+{
+	uint32 size = 1;
+	while (size < _max_mmers)
+		size <<= 1;
+	vals = new uint32[size];
+	mask = size - 1;
+}
+
+//--------------------------------------------------------------------------
+CMmerWindow::~CMmerWindow()
+{
+	delete[] vals;
+}
+
+//--------------------------------------------------------------------------
 
@@ -12,6 +12,9 @@
 #define _MMER_H
 #include "defs.h"
 
+// Order of signatures: lexicographic (low-complexity signatures excluded) or random (hash of an m-mer)
+typedef enum {sig_lexicographic, sig_hash} signature_order;
+
 // *************************************************************************
 // *************************************************************************
 
@@ -23,10 +26,30 @@ class CMmer
 	uint32 current_val;
 	uint32* norm;
 	uint32 len;
-	static uint32 norm5[1 << 10];
-	static uint32 norm6[1 << 12];
-	static uint32 norm7[1 << 14];	
-	static uint32 norm8[1 << 16];
+
+	// Normalization tables [order][len]; the ones for m-mers longer than 8 symbols are created by prepare()
+	static const uint32 MAX_LEN = 12;
+	static uint32* norm_tables[2][MAX_LEN + 1];
+
+	static const uint32 HASH_MULT	  = 0x9E3779B1u;
+	static const uint32 HASH_MULT_INV = 0x0E8B2F51u;		// HASH_MULT * HASH_MULT_INV = 1 (mod 2^32)
+
+	// Bijection of 2*len-bit values
+	static uint32 hash(uint32 mmer, uint32 len)
+	{
+		uint32 mask = (1 << len * 2) - 1;
+		mmer = (mmer * HASH_MULT) & mask;
+		mmer ^= mmer >> len;
+		return (mmer * HASH_MULT) & mask;
+	}
+
+	static uint32 unhash(uint32 val, uint32 len)
+	{
+		uint32 mask = (1 << len * 2) - 1;
+		val = (val * HASH_MULT_INV) & mask;
+		val ^= val >> len;
+		return (val * HASH_MULT_INV) & mask;
+	}
 
 	static bool is_allowed(uint32 mmer, uint32 len)
 	{
@@ -83,17 +106,26 @@ class CMmer
 			}
 		}
 
+		static void init_hash_norm(uint32* norm, uint32 len)
+		{
+			for(uint32 i = 0 ; i < (1u << len * 2) ; ++i)
+				norm[i] = MIN(hash(i, len), hash(get_rev(i, len), len));
+		}
+
 		_si()
 		{
-			init_norm(norm5, 5);
-			init_norm(norm6, 6);
-			init_norm(norm7, 7);
-			init_norm(norm8, 8);
+			for(uint32 len = 5 ; len <= 8 ; ++len)
+			{
+				prepare(len, sig_lexicographic);
+				prepare(len, sig_hash);
+			}
 		}
 
 	}static _init;
 public:
-	CMmer(uint32 _len);
+	CMmer(uint32 _len, signature_order _order = sig_lexicographic);
+	static void prepare(uint32 len, signature_order order);
+	static bool is_signature(uint32 val, uint32 len, signature_order order);
 	inline void insert(uchar symb);
 	inline uint32 get() const;
 	inline bool operator==(const CMmer& x);
@@ -172,6 +204,9 @@ inline void CMmer::insert(char* seq)
 		str = (seq[0] << 14) + (seq[1] << 12) + (seq[2] << 10) + (seq[3] << 8) + (seq[4] << 6) + (seq[5] << 4) + (seq[6] << 2) + (seq[7]);
 		break;
 	default:
+		str = 0;
+		for (uint32 i = 0; i < len; ++i)
+			str = (str << 2) + seq[i];
 		break;
 	}
 
@@ -179,4 +214,43 @@ inline void CMmer::insert(char* seq)
 }
 
 
+// *************************************************************************
+// Values of the recent m-mers of a read (ring buffer)
+// The values are stored when the m-mers are built, so when the signature leaves the k-mer the new one
+// is found without recomputing the m-mers
+// *************************************************************************
+class CMmerWindow
+{
+	uint32* vals;
+	uint32 mask;
+
+public:
+	CMmerWindow(uint32 _max_mmers);
+	~CMmerWindow();
+	inline void insert(const CMmer& x, uint32 pos);
+	inline uint32 find_min(uint32 first_pos, uint32 last_pos);
+};
+
+//--------------------------------------------------------------------------
+// Store the m-mer starting at pos
+inline void CMmerWindow::insert(const CMmer& x, uint32 pos)
+{
+	vals[pos & mask] = x.get();
+}
+
+//--------------------------------------------------------------------------
+// Return the position of the lowest m-mer in [first_pos, last_pos]; for equal values the rightmost one is taken
+inline uint32 CMmerWindow::find_min(uint32 first_pos, uint32 last_pos)
+{
+	uint32 min_pos = first_pos;
+	uint32 min_val = vals[first_pos & mask];
+	for (uint32 j = first_pos + 1; j <= last_pos; ++j)
+	if (vals[j & mask] <= min_val)
+	{
+		min_val = vals[j & mask];
+		min_pos = j;
+	}
+	return min_pos;
+}
+
 #endif
\ No newline at end of file
@@ -14,6 +14,8 @@
 #include "defs.h"
 #include "queues.h"
 #include "s_mapper.h"
+#include "tmp_store.h"
+#include "task_pool.h"
 #include <vector>
 #include <string>
 
@@ -21,6 +23,8 @@ typedef enum {fasta, fastq, multiline_fasta} input_type;
 
 using namespace std;
 
+class CStreamHeads;
+
 // Structure for passing KMC parameters
 struct CKMCParams {
 	
@@ -32,21 +36,34 @@ struct CKMCParams {
 	int p_sp;							// no. of splitting threads
 	int p_so;							// no. of OpenMP threads for sorting
 	int p_sr;							// no. of sorting threads	
+	int p_sz;							// no. of decompression threads per reader (multi-member gzip files)
+	int p_sw;							// no. of threads writing temporary files
+	int p_sb;							// no. of threads reading bins per working directory
+	double p_sa;						// fraction of input sampled in stage 0 (0: heads of files)
 	int p_ci;							// do not count k-mers occurring less than
 	int p_cx;							// do not count k-mers occurring more than
 	int p_cs;							// maximal counter value
 	bool p_quake;						// use Quake-compatibile counting
 	bool p_mem_mode;					// use RAM instead of disk
+	int p_hybrid_mem;					// hybrid mode: max. amount of RAM (GB) for bins kept in memory
+	bool p_tmp_compress;				// compress temporary files
+	bool p_direct_io;					// write temporary files with direct I/O
+	bool p_tmp_store;					// keep temporary bins in a single file
 	int p_quality;						// lowest quality
 	input_type p_file_type;				// input in FASTA format
 	bool p_verbose;						// verbose mode
 	bool p_both_strands;				// compute canonical k-mer representation
 	int p_p1;							// signature length	
+	signature_order p_signature_order;	// order of signatures
+	int p_n_bins;						// max. number of bins
+	bool p_cost_packing;				// assign signatures to bins according to the estimated cost of stage 2
 
 	// File names
 	vector<string> input_file_names;
 	string output_file_name;
-	string working_directory;
+	vector<string> working_directories;	// temporary files are spread over all of them
+	string stats_save_file_name;		// signature statistics of stage 0 are saved here
+	string stats_load_file_name;		// signature statistics are loaded from here (stage 0 is skipped)
 	input_type file_type;
 	
 	uint32 lut_prefix_len;
@@ -80,6 +97,7 @@ struct CKMCParams {
 
 	int kmer_len;			// kmer length
 	int signature_len;
+	signature_order sig_order;	// order of signatures (recorded in the .kmc_pre file)
 	int cutoff_min;			// exclude k-mers occurring less than times
 	int cutoff_max;			// exclude k-mers occurring more than times
 	int counter_max;		// maximal counter value
@@ -87,16 +105,32 @@ struct CKMCParams {
 	int lowest_quality;		// lowest quality value	    
 	bool both_strands;		// find canonical representation of each k-mer
 	bool mem_mode;			// use RAM instead of disk
-
-	int n_bins;				// number of bins; fixed: 448
+	bool hybrid_mode;		// bins are kept in RAM and spilled to disk if hybrid_mem is exceeded
+	uint64 hybrid_mem;
+	bool tmp_compress;		// temporary files are compressed in chunks (zlib)
+	bool direct_io;			// temporary files are written bypassing the page cache (O_DIRECT)
+	bool tmp_store;			// bins are extents of a single preallocated file per working directory
+
+	int n_bins_max;			// max. number of bins; default: 512
+	int n_bins;				// number of bins (set by the signature mapper)
+	vector<uint32> bin_dirs;	// working directory of each bin
+	bool cost_packing;		// LPT assignment of signatures to bins based on estimated stage 2 cost
 	int bin_part_size;		// size of a bin part; fixed: 2^15
 	int fastq_buffer_size;	// size of FASTQ file buffer; fixed: 2^23
 
 	int n_threads;			// number of cores
 	int n_readers;			// number of FASTQ readers; default: 1
 	int n_splitters;		// number of splitters; default: 1
+	int n_stats_splitters;	// number of splitters in stage 0 (fewer for long signatures)
 	int n_sorters;			// number of sorters; default: 1
+	int n_gzip_threads;		// number of decompression threads per FASTQ reader (multi-member gzip files); default: 1
+	int n_writers;			// number of threads writing temporary files; default: 1
+	int n_bin_readers;		// number of threads reading bins in stage 2 per working directory; default: 2
+	int n_mapped_parts;		// max. number of parts of a memory mapped input file in use; 0: no mapping
+	uint64 input_range_size;	// size of byte ranges of uncompressed files read by separate readers; 0: whole files
+	double stats_fraction;		// fraction of input sampled in stage 0; 0: heads of files are read
 	vector<int> n_omp_threads;// number of OMP threads per sorters
+	int n_sort_threads;		// number of threads of the task pool shared by the sorters (incl. the sorters)
 	uint32 max_x;					//k+x-mers will be counted
 
 	uint32 gzip_buffer_size;
@@ -111,16 +145,27 @@ struct CKMCParams {
 		p_sp = 0;
 		p_so = 0;
 		p_sr = 0;
+		p_sz = 0;
+		p_sw = 0;
+		p_sb = 0;
+		p_sa = 0.0;
 		p_ci = 2;
 		p_cx = 1000000000;
 		p_cs = 255;
 		p_quake = false;
 		p_mem_mode = false;
+		p_hybrid_mem = 0;
+		p_tmp_compress = false;
+		p_direct_io = false;
+		p_tmp_store = false;
 		p_quality = 33;
 		p_file_type = fastq;
 		p_verbose = false;
 		p_both_strands = true;
 		p_p1 = 7;		
+		p_signature_order = sig_lexicographic;
+		p_n_bins = DEFAULT_N_BINS;
+		p_cost_packing = false;
 
 		gzip_buffer_size  = 64 << 20;
 		bzip2_buffer_size = 64 << 20;
@@ -141,13 +186,18 @@ struct CKMCQueues
 	CStatsPartQueue* stats_part_queue;
 
 	CBinPartQueue *bpq;
+	CBinFlushQueue *bfq;
 	CBinDesc *bd;
 	CBinQueue *bq;
 	CKmerQueue *kq;
 	CMemoryPool *pmm_bins, *pmm_fastq, *pmm_reads, *pmm_radix_buf, *pmm_prob, *pmm_stats, *pmm_expand;
 	CMemoryBins *memory_bins;
+	CStreamHeads *stream_heads;
+	vector<CTmpStore*> tmp_stores;		// one per working directory (if bins are kept in single files)
+	CMemDiskSpiller *spiller;			// hybrid mode
+	CTaskPool *task_pool;				// threads sorting the bins in stage 2
 
-	CKMCQueues() {}
+	CKMCQueues() { spiller = NULL; task_pool = NULL; }
 };
 
 #endif
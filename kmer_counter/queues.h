@@ -18,9 +18,14 @@
 #include <queue>
 #include <list>
 #include <map>
+#include <vector>
 #include <string>
 #include "mem_disk_file.h"
 
+#ifndef WIN32
+#include <sys/stat.h>
+#endif
+
 using namespace std;
 
 #ifdef THREADS_NATIVE			// C++11 threads
@@ -37,9 +42,12 @@ using std::thread;
 using namespace boost;
 #endif
 
+class CMappedFile;
+
 //************************************************************************************************************
+// Input files; large uncompressed files are split into byte ranges (the readers align them to records)
 class CInputFilesQueue {
-	typedef string elem_t;
+	typedef tuple<string, uint64, uint64> elem_t;		// file name, range begin, range end
 	typedef queue<elem_t, list<elem_t>> queue_t;
 
 	queue_t q;
@@ -48,11 +56,47 @@ class CInputFilesQueue {
 	mutable mutex mtx;								// The mutex to synchronise on
 
 public:
-	CInputFilesQueue(const vector<string> &file_names) {
+	static const uint64 FILE_END = ~0ull;
+
+	// Size of an uncompressed file (0 for compressed files and streams)
+	static uint64 PlainFileSize(const string &file_name) {
+		if(IsStream(file_name))
+			return 0;
+		if((file_name.size() > 3 && string(file_name.end()-3, file_name.end()) == ".gz") ||
+			(file_name.size() > 4 && string(file_name.end()-4, file_name.end()) == ".bz2"))
+			return 0;
+		FILE *f = my_fopen(file_name.c_str(), "rb");
+		if(!f)
+			return 0;
+		my_fseek(f, 0, SEEK_END);
+		uint64 size = my_ftell(f);
+		fclose(f);
+		return size;
+	}
+
+	// Standard input ("-") or a named pipe: can be read only once and has no size
+	static bool IsStream(const string &file_name) {
+		if(file_name == "-")
+			return true;
+#ifndef WIN32
+		struct stat st;
+		return stat(file_name.c_str(), &st) == 0 && S_ISFIFO(st.st_mode);
+#else
+		return false;
+#endif
+	}
+
+	CInputFilesQueue(const vector<string> &file_names, uint64 range_size) {
 		unique_lock<mutex> lck(mtx);
 
 		for(vector<string>::const_iterator p = file_names.begin(); p != file_names.end(); ++p)
-			q.push(*p);
+		{
+			uint64 size = range_size ? PlainFileSize(*p) : 0;
+			uint64 i;
+			for(i = 0; i + range_size < size; i += range_size)
+				q.push(make_tuple(*p, i, i + range_size));
+			q.push(make_tuple(*p, i, FILE_END));
+		}
 
 		is_completed = false;
 	};
@@ -70,13 +114,15 @@ public:
 		lock_guard<mutex> lck(mtx);
 		is_completed = true;
 	}
-	bool pop(string &file_name) {
+	bool pop(string &file_name, uint64 &range_begin, uint64 &range_end) {
 		lock_guard<mutex> lck(mtx);
 
 		if(q.empty())
 			return false;
 
-		file_name = q.front();
+		file_name   = get<0>(q.front());
+		range_begin = get<1>(q.front());
+		range_end   = get<2>(q.front());
 		q.pop();
 
 		return true;
@@ -84,8 +130,9 @@ public:
 };
 
 //************************************************************************************************************
+// Parts of input files: FASTQ buffers or views of memory mapped files (mapped != NULL)
 class CPartQueue {
-	typedef pair<uchar *, uint64> elem_t;
+	typedef tuple<uchar *, uint64, CMappedFile *> elem_t;
 	typedef queue<elem_t, list<elem_t>> queue_t;
 
 	queue_t q;
@@ -117,24 +164,25 @@ public:
 		if(!n_readers)
 			cv_queue_empty.notify_all();
 	}
-	void push(uchar *part, uint64 size) {
+	void push(uchar *part, uint64 size, CMappedFile *mapped) {
 		unique_lock<mutex> lck(mtx);
 		
 		bool was_empty = q.empty();
-		q.push(make_pair(part, size));
+		q.push(make_tuple(part, size, mapped));
 
 		if(was_empty)
 			cv_queue_empty.notify_all();
 	}
-	bool pop(uchar *&part, uint64 &size) {
+	bool pop(uchar *&part, uint64 &size, CMappedFile *&mapped) {
 		unique_lock<mutex> lck(mtx);
 		cv_queue_empty.wait(lck, [this]{return !this->q.empty() || !this->n_readers;}); 
 
 		if(q.empty())
 			return false;
 
-		part = q.front().first;
-		size = q.front().second;
+		part   = get<0>(q.front());
+		size   = get<1>(q.front());
+		mapped = get<2>(q.front());
 		q.pop();
 
 		return true;
@@ -144,7 +192,7 @@ public:
 //************************************************************************************************************
 class CStatsPartQueue
 {
-	typedef pair<uchar *, uint64> elem_t;
+	typedef tuple<uchar *, uint64, CMappedFile *> elem_t;
 	typedef queue<elem_t, list<elem_t>> queue_t;
 
 	queue_t q;
@@ -175,14 +223,14 @@ public:
 		return q.empty() && !n_readers;
 	}
 
-	bool push(uchar *part, uint64 size) {
+	bool push(uchar *part, uint64 size, CMappedFile *mapped) {
 		unique_lock<mutex> lck(mtx);
 
 		if (bytes_to_read <= 0)
 			return false;
 
 		bool was_empty = q.empty();
-		q.push(make_pair(part, size));
+		q.push(make_tuple(part, size, mapped));
 		bytes_to_read -= size;
 		if (was_empty)
 			cv_queue_empty.notify_one();
@@ -190,15 +238,27 @@ public:
 		return true;
 	}
 
-	bool pop(uchar *&part, uint64 &size) {
+	// A part read but not passed to the splitters (sampling) also counts to the read bytes
+	bool skip(uint64 size) {
+		lock_guard<mutex> lck(mtx);
+
+		if (bytes_to_read <= 0)
+			return false;
+		bytes_to_read -= size;
+
+		return true;
+	}
+
+	bool pop(uchar *&part, uint64 &size, CMappedFile *&mapped) {
 		unique_lock<mutex> lck(mtx);
 		cv_queue_empty.wait(lck, [this]{return !this->q.empty() || !this->n_readers; });
 
 		if (q.empty())
 			return false;
 
-		part = q.front().first;
-		size = q.front().second;
+		part   = get<0>(q.front());
+		size   = get<1>(q.front());
+		mapped = get<2>(q.front());
 		q.pop();
 
 		return true;
@@ -267,6 +327,60 @@ public:
 	}
 };
 
+//************************************************************************************************************
+// Packages of bins to be written to temporary files. Bins are assigned to the writers by their ids, so
+// the packages of a bin are written in order.
+class CBinFlushQueue {
+public:
+	typedef list<tuple<uchar *, uint32, uint32>> package_t;		// parts of a bin: buffer, true size, allocated size
+
+private:
+	typedef tuple<int32, CMemDiskFile *, package_t *> elem_t;
+	typedef queue<elem_t, list<elem_t>> queue_t;
+	vector<queue_t> q;
+
+	bool is_completed;
+
+	mutable mutex mtx;						// The mutex to synchronise on
+	condition_variable cv_queue_empty;
+
+public:
+	CBinFlushQueue(int n_writers) {
+		lock_guard<mutex> lck(mtx);
+
+		q.resize(n_writers);
+		is_completed = false;
+	}
+	~CBinFlushQueue() {}
+
+	void mark_completed() {
+		lock_guard<mutex> lck(mtx);
+		is_completed = true;
+		cv_queue_empty.notify_all();
+	}
+	void push(int32 bin_id, CMemDiskFile *file, package_t *package) {
+		lock_guard<mutex> lck(mtx);
+
+		q[bin_id % q.size()].push(std::make_tuple(bin_id, file, package));
+		cv_queue_empty.notify_all();
+	}
+	bool pop(int writer_id, int32 &bin_id, CMemDiskFile *&file, package_t *&package) {
+		unique_lock<mutex> lck(mtx);
+		queue_t &wq = q[writer_id];
+		cv_queue_empty.wait(lck, [&]{return !wq.empty() || is_completed;}); 
+
+		if(wq.empty())
+			return false;
+
+		bin_id  = get<0>(wq.front());
+		file    = get<1>(wq.front());
+		package = get<2>(wq.front());
+		wq.pop();
+
+		return true;
+	}
+};
+
 //************************************************************************************************************
 class CBinDesc {
 	typedef tuple<string, int64, uint64, uint32, uint32, CMemDiskFile*, uint64, uint64> desc_t;
@@ -275,7 +389,10 @@ class CBinDesc {
 	map_t m;
 	int32 bin_id;
 
-	vector<int32> random_bins;
+	vector<int32> bin_order;
+	vector<vector<int32>> dir_bins;		// order of reading bins of each working directory
+	vector<size_t> dir_next;			// next bin to read
+	vector<size_t> dir_advised;			// end of the bins announced for read-ahead
 
 	mutable mutex mtx;
 
@@ -296,44 +413,118 @@ public:
 		return m.empty();
 	}
 
-	void init_random()
+	// Order of processing bins in stage 2
+	// The sorters (of given no. of OMP threads) are simulated: a free sorter starts the largest remaining bin that fits
+	// in the memory left by the bins in progress, so the largest bins start first and small ones fill the gaps.
+	// The time of a bin is estimated as no. of its records divided by no. of OMP threads of the sorter.
+	void init_schedule(const vector<uint32> &bin_dirs, uint32 n_dirs, const vector<int> &n_omp_threads, uint64 rec_size, bool use_x_recs, int64 mem_budget)
 	{
 		lock_guard<mutex> lck(mtx);
-		vector<pair<int32, int64>> bin_sizes;
+		typedef tuple<int32, double, int64> bin_cost_t;			// id, time, memory
+		vector<bin_cost_t> bins;
 
 		for (auto& p : m)
-			bin_sizes.push_back(make_pair(p.first, get<2>(p.second)));
+		{
+			uint64 n_recs = use_x_recs ? get<6>(p.second) : get<2>(p.second);
+			bins.push_back(make_tuple(p.first, (double) n_recs, (int64) (n_recs * rec_size)));
+		}
 
-		sort(bin_sizes.begin(), bin_sizes.end(), [](const pair<int32, int64>& l, const pair<int32, int64>& r){
-			return l.second > r.second;
+		sort(bins.begin(), bins.end(), [](const bin_cost_t& l, const bin_cost_t& r){
+			return get<1>(l) > get<1>(r);
 		});
 
-		uint32 no_sort_start = uint32(0.6 * bin_sizes.size());
-		uint32 no_sort_end = uint32(0.8 * bin_sizes.size());
+		vector<double> free_at(n_omp_threads.size(), 0.0);
+		vector<pair<double, int64>> in_progress;				// end time, memory
+		vector<bool> scheduled(bins.size(), false);
+		int64 mem_used = 0;
+		double now = 0.0;
+
+		bin_order.clear();
+		for (size_t n = 0; n < bins.size(); ++n)
+		{
+			// The sorter that is free first; the one of more threads on a tie
+			uint32 s = 0;
+			for (uint32 i = 1; i < free_at.size(); ++i)
+				if (free_at[i] < free_at[s] || (free_at[i] == free_at[s] && n_omp_threads[i] > n_omp_threads[s]))
+					s = i;
+			now = MAX(now, free_at[s]);
+
+			size_t best;
+			while (true)
+			{
+				for (auto p = in_progress.begin(); p != in_progress.end();)
+					if (p->first <= now)
+					{
+						mem_used -= p->second;
+						p = in_progress.erase(p);
+					}
+					else
+						++p;
+
+				for (best = 0; best < bins.size(); ++best)
+					if (!scheduled[best] && mem_used + get<2>(bins[best]) <= mem_budget)
+						break;
+				if (best < bins.size())
+					break;
+				if (in_progress.empty())
+				{
+					// The bin does not fit even alone; it waits for all the others
+					for (best = 0; scheduled[best]; ++best)
+						;
+					break;
+				}
 
-		for (uint32 i = 0; i < no_sort_start; ++i)
-			random_bins.push_back(bin_sizes[i].first);
+				// Wait for the next bin to finish
+				now = min_element(in_progress.begin(), in_progress.end())->first;
+			}
 
-		for (uint32 i = no_sort_end; i < bin_sizes.size(); ++i)
-			random_bins.push_back(bin_sizes[i].first);
+			scheduled[best] = true;
+			free_at[s] = now + get<1>(bins[best]) / n_omp_threads[s];
+			mem_used += get<2>(bins[best]);
+			in_progress.push_back(make_pair(free_at[s], get<2>(bins[best])));
+			bin_order.push_back(get<0>(bins[best]));
+		}
 
-		random_shuffle(random_bins.begin(), random_bins.end());
+		// Bins kept in RAM (hybrid mode) are processed first, so their memory is released early
+		stable_partition(bin_order.begin(), bin_order.end(), [this](int32 id){
+			return get<5>(this->m[id])->InMemory();
+		});
 
-		for (uint32 i = no_sort_start; i < no_sort_end; ++i)
-			random_bins.push_back(bin_sizes[i].first);
+		dir_bins.assign(n_dirs, vector<int32>());
+		dir_next.assign(n_dirs, 0);
+		dir_advised.assign(n_dirs, 0);
+		for (auto p : bin_order)
+			dir_bins[bin_dirs[p]].push_back(p);
 	}
 
-	int32 get_next_random_bin()
+	// Next bin of the working directory to read in stage 2 (init_schedule must be called before).
+	// The files of the following bins that fit in read_ahead bytes and were not announced yet are returned in to_prefetch.
+	int32 get_next_scheduled_bin(uint32 dir_id, uint64 read_ahead, vector<CMemDiskFile*> &to_prefetch)
 	{
 		lock_guard<mutex> lck(mtx);
-		if (bin_id == -1)
-			bin_id = 0;
-		else
-			++bin_id;
+		vector<int32> &bins = dir_bins[dir_id];
+		size_t &next = dir_next[dir_id];
+		size_t &advised = dir_advised[dir_id];
 
-		if (bin_id >= (int32)m.size())
+		to_prefetch.clear();
+		if (next >= bins.size())
 			return -1000;
-		return random_bins[bin_id];
+		int32 id = bins[next++];
+
+		uint64 ahead = 0;
+		for (size_t i = next; i < bins.size(); ++i)
+		{
+			ahead += get<1>(m[bins[i]]);
+			if (ahead > read_ahead)
+				break;
+			if (i >= advised)
+			{
+				to_prefetch.push_back(get<5>(m[bins[i]]));
+				advised = i + 1;
+			}
+		}
+
+		return id;
 	}
 
 	int32 get_next_bin()
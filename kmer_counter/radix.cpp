@@ -13,251 +13,262 @@
 #include "radix.h"
 
 //----------------------------------------------------------------------------------
-/*Parallel radix sort. The input data to be sorted are divided evenly among threads. 
-  Each thread is responsible for building a local histogram to enable sorting keys 
-  according to a given digit. Then a global histogram is created as a combination
-  of local ones and the write offset (location) to which each digit should be written
- is computed. Finally, threads scatter the data to the appropriate locations.*/
+// No. of parts of the records processed by separate tasks
+static uint32 RadixParts(CTaskPool *task_pool, uint64 size)
+{
+	uint64 n_parts = MIN((uint64) MIN(task_pool->NoThreads(), (uint32) MAX_NUM_THREADS), size / RADIX_MIN_PART_RECS);
+
+	return (uint32) MAX(n_parts, 1ull);
+}
+
+//----------------------------------------------------------------------------------
+// Turn the histograms of the parts into the positions, where the parts start writing the records of each digit
 template<typename COUNTER_TYPE>
-void RadixOMP_uint8(uint32 *SourcePtr, uint32 *DestPtr, const int64 SourceSize, unsigned rec_size, unsigned data_offset, unsigned data_size, const unsigned n_phases, const unsigned n_threads)
+static void RadixOffsets(vector<array<COUNTER_TYPE, 256>> &ByteCounter, uint32 n_parts)
 {
-/* SourceSize - number of records */
-/* rec_size - in bytes */
-/* data_offset - in bytes*/
-/* data_size - in bytes - not used now */
+	COUNTER_TYPE prevSum = 0;
+	COUNTER_TYPE temp;
 
-    
-#ifdef WIN32
-	__declspec( align( WIN_ALIGNMENT ) ) COUNTER_TYPE ByteCounter[MAX_NUM_THREADS][256];
-#else
-	COUNTER_TYPE ByteCounter[MAX_NUM_THREADS][256] __attribute__((aligned(ALIGNMENT)));
-#endif
+	for(uint32 i = 0; i < 256; ++i)
+		for(uint32 n = 0; n < n_parts; ++n)
+		{
+			temp = ByteCounter[n][i];
+			ByteCounter[n][i] = prevSum;
+			prevSum += temp;
+		}
+}
 
-#ifdef WIN32
-	__declspec( align( WIN_ALIGNMENT ) ) COUNTER_TYPE globalHisto[256];
-#else
-	COUNTER_TYPE globalHisto[256] __attribute__((aligned(ALIGNMENT)));
-#endif
+//----------------------------------------------------------------------------------
+// Comparison of the keys of two records on digits [0, digit]; the digit of the highest number is the most significant
+template<unsigned FIXED_SIZE>
+static inline bool RadixLess(const uchar *a, const uchar *b, unsigned key_offset, int32 digit)
+{
+	if(FIXED_SIZE == 8)
+	{
+		uint64 mask = digit >= 7 ? ~0ull : (1ull << (8 * (digit + 1))) - 1;
+		return (*(const uint64*) a & mask) < (*(const uint64*) b & mask);
+	}
 
-#pragma omp parallel num_threads(n_threads)
-	{ 
-		int myID = omp_get_thread_num();
-		uint8_t ByteIndex = 0;
-		long long i;					
-		COUNTER_TYPE prevSum;
-		COUNTER_TYPE temp;
-		uint32 n;
-		
-		int private_i;
-		int byteValue;
-	
-		int64 SourceSize_in_bytes = SourceSize * rec_size;
-
-		uint8_t *char_ptr_tempSource = (uint8_t*)(SourcePtr);
-		uint8_t *char_ptr_tempDest = (uint8_t*)(DestPtr);
-		uint8_t *char_tempPtr;
+	for(int32 i = digit; i >= 0; --i)
+		if(a[key_offset + i] != b[key_offset + i])
+			return a[key_offset + i] < b[key_offset + i];
 
-#ifdef WIN32
-	__declspec( align( WIN_ALIGNMENT ) ) COUNTER_TYPE privateByteCounter[256] = {0};
-#else
-	__attribute__((aligned(ALIGNMENT)))  COUNTER_TYPE privateByteCounter[256] = {0};
-#endif
+	return false;
+}
 
-		for(uint32 privatePhaseCounter = 0; privatePhaseCounter < n_phases; privatePhaseCounter++)
-		{
-			#pragma omp for private(i) schedule(static) 
-			for(i = data_offset; i < SourceSize_in_bytes; i = i + rec_size)
-			{
-				byteValue = *(&char_ptr_tempSource[i] + ByteIndex);
-				
-				++privateByteCounter[byteValue];
-			}	
-			A_memcpy(&ByteCounter[myID][0], privateByteCounter, sizeof(privateByteCounter));
+//----------------------------------------------------------------------------------
+// Stable insertion sort of small buckets
+template<unsigned FIXED_SIZE>
+static void RadixInsertionSort(uchar *data, uint64 size, unsigned rec_size, unsigned key_offset, int32 digit)
+{
+	const unsigned rs = FIXED_SIZE ? FIXED_SIZE : rec_size;
+	uint64 rec[KMER_WORDS + 1];					// the largest record (k-mer with quality) fits here
 
-			#pragma omp barrier
+	for(uint64 i = 1; i < size; ++i)
+	{
+		if(!RadixLess<FIXED_SIZE>(data + i * rs, data + (i - 1) * rs, key_offset, digit))
+			continue;
 
-			#pragma omp for schedule(static)
-			for(i = 0; i < 256; ++i)
-			{
-				prevSum = 0; 
-				for(n = 0; n < n_threads; n++)
-				{
-					temp = ByteCounter[n][i];
-					ByteCounter[n][i] = prevSum;
-					prevSum += temp; 
-				}
-				globalHisto[i] = prevSum;
-			}	
+		memcpy(rec, data + i * rs, rs);
+		uint64 j = i;
+		do
+		{
+			memcpy(data + j * rs, data + (j - 1) * rs, rs);
+			--j;
+		} while(j > 0 && RadixLess<FIXED_SIZE>((uchar *) rec, data + (j - 1) * rs, key_offset, digit));
+		memcpy(data + j * rs, rec, rs);
+	}
+}
 
-			#pragma omp single
-			{
-				prevSum = 0; 
-				for(i = 0; i < 256; ++i)
-				{
-					temp = globalHisto[i];
-					globalHisto[i] = prevSum;
-					prevSum += temp; 
-				}	
-			}
+//----------------------------------------------------------------------------------
+/*Sequential MSD radix sort of a bucket on digits [0, digit].
+  Digits of a single value in the bucket are skipped. Small buckets are sorted by insertion.
+  The sorted records are in dest if in_dest is true and in source otherwise.*/
+template<unsigned FIXED_SIZE>
+static void RadixMSD(uchar *source, uchar *dest, uint64 size, unsigned rec_size, unsigned key_offset, int32 digit, bool in_dest)
+{
+	const unsigned rs = FIXED_SIZE ? FIXED_SIZE : rec_size;
+	uint64 counts[256];
 
+	while(true)
+	{
+		if(size <= RADIX_INSERTION_RECS)
+		{
+			RadixInsertionSort<FIXED_SIZE>(source, size, rec_size, key_offset, digit);
+			if(in_dest)
+				A_memcpy(dest, source, size * rs);
+			return;
+		}
 
-			for (private_i = 0; private_i < 256; private_i++)
-				ByteCounter[myID][private_i] += globalHisto[private_i];
+		memset(counts, 0, sizeof(counts));
+		for(uint64 i = 0; i < size; ++i)
+			++counts[source[i * rs + key_offset + digit]];
 
-			A_memcpy(privateByteCounter, &ByteCounter[myID][0], sizeof(privateByteCounter));
-		
-			#pragma omp for schedule(static)
-			for(i = data_offset; i < SourceSize_in_bytes; i = i + rec_size)
-			{
-				byteValue = *(&char_ptr_tempSource[i] + ByteIndex);
+		if(counts[source[key_offset + digit]] != size)
+			break;
 
-				memcpy(&char_ptr_tempDest[privateByteCounter[byteValue] * rec_size], &char_ptr_tempSource[i - data_offset], rec_size);
+		// Constant digit
+		if(digit == 0)
+		{
+			if(in_dest)
+				A_memcpy(dest, source, size * rs);
+			return;
+		}
+		--digit;
+	}
 
-				(privateByteCounter[byteValue])++;
-			}
+	uint64 starts[256];
+	uint64 prevSum = 0;
+	for(uint32 i = 0; i < 256; ++i)
+	{
+		starts[i] = prevSum;
+		prevSum += counts[i];
+	}
 
-		
-			#pragma omp barrier
+	uint64 pos[256];
+	A_memcpy(pos, starts, sizeof(pos));
+	for(uint64 i = 0; i < size; ++i)
+	{
+		uchar *rec = source + i * rs;
+		memcpy(dest + (pos[rec[key_offset + digit]]++) * rs, rec, rs);
+	}
 
-			char_tempPtr = char_ptr_tempDest;
-			char_ptr_tempDest = char_ptr_tempSource;
-			char_ptr_tempSource = char_tempPtr;
-			ByteIndex++;
-			memset(privateByteCounter, 0, sizeof(privateByteCounter));
-		}
+	if(digit == 0)
+	{
+		if(!in_dest)
+			A_memcpy(source, dest, size * rs);
+		return;
 	}
-}
 
-//----------------------------------------------------------------------------------
-void RadixSort_uint8(uint32 *&data_ptr, uint32 *&tmp_ptr, uint64 size, unsigned rec_size, unsigned data_offset, unsigned data_size, const unsigned n_phases, const unsigned n_threads)
-{
-	if(size * rec_size >= (1ull << 32))
-		RadixOMP_uint8<uint64>(data_ptr, tmp_ptr, size, rec_size, data_offset, data_size, n_phases, n_threads);
-	else
-		RadixOMP_uint8<uint32>(data_ptr, tmp_ptr, size, rec_size, data_offset, data_size, n_phases, n_threads);
+	for(uint32 i = 0; i < 256; ++i)
+		if(counts[i])
+			RadixMSD<FIXED_SIZE>(dest + starts[i] * rs, source + starts[i] * rs, counts[i], rec_size, key_offset, digit - 1, !in_dest);
 }
 
-
 //----------------------------------------------------------------------------------
-/*Parallel radix sort. Parallelization scheme taken from 
-  Satish, N., Kim, C., Chhugani, J., Nguyen, A.D., Lee, V.W., Kim, D., Dubey, P. (2010). 
-  Fast Sort on CPUs and GPUs. A Case for Bandwidth Oblivious SIMD Sort. 
-  Proc. of the 2010 Int. Conf. on Management of data, pp. 351362. 
+/*Parallel MSD radix sort on digits [0, digit]. The input data to be sorted are divided evenly among tasks of the shared pool.
+  Each task is responsible for building a local histogram to enable sorting keys
+  according to a given digit. Then a global histogram is created as a combination
+  of local ones and the write offset (location) to which each digit should be written
+ is computed. Finally, tasks scatter the data to the appropriate locations.
+  Digits of a single value in the data are skipped. Large buckets are sorted further in the same way,
+  the other ones are sorted by sequential MSD radix sort tasks.
+  The sorted records are in dest if in_dest is true and in source otherwise.
+
+  For 8-byte records the scatter uses software-managed buffers. Parallelization scheme taken from
+  Satish, N., Kim, C., Chhugani, J., Nguyen, A.D., Lee, V.W., Kim, D., Dubey, P. (2010).
+  Fast Sort on CPUs and GPUs. A Case for Bandwidth Oblivious SIMD Sort.
+  Proc. of the 2010 Int. Conf. on Management of data, pp. 351362.
   The usage of software-managed buffers in the writting phase results in diminishing
   the influence of irregular memory accesses. As the number of cache conflict misses
   is reduced better efficiency is reached.*/
-template<typename COUNTER_TYPE, typename INT_TYPE>
-	void RadixOMP_buffer(CMemoryPool *pmm_radix_buf, uint64 *Source, uint64 *Dest, const int64 SourceSize, const unsigned n_phases, const unsigned n_threads)
+template<typename COUNTER_TYPE, typename INT_TYPE, unsigned FIXED_SIZE>
+static void RadixParallelMSD(CMemoryPool *pmm_radix_buf, uchar *source, uchar *dest, const int64 SourceSize, unsigned rec_size, unsigned key_offset, int32 digit, bool in_dest, CTaskPool *task_pool, uint32 slot_id)
 {
-#ifdef WIN32
-	__declspec( align( WIN_ALIGNMENT ) ) COUNTER_TYPE ByteCounter[MAX_NUM_THREADS][256];
-#else
-	COUNTER_TYPE ByteCounter[MAX_NUM_THREADS][256] __attribute__((aligned(ALIGNMENT)));
-#endif
+	const unsigned rs = FIXED_SIZE ? FIXED_SIZE : rec_size;
+
+	uint32 n_parts = RadixParts(task_pool, SourceSize);
+	vector<array<COUNTER_TYPE, 256>> ByteCounter(n_parts);
+	CTaskGroup group;
+	int32 first_symb;
+
+	// Skip the constant digits
+	while(true)
+	{
+		for(uint32 part = 0; part < n_parts; ++part)
+			task_pool->Run(slot_id, group, [&, part]{
+				int64 i_end = SourceSize * (part + 1) / n_parts;
+				COUNTER_TYPE *privateByteCounter = ByteCounter[part].data();
+
+				memset(privateByteCounter, 0, 256 * sizeof(COUNTER_TYPE));
+				for(int64 i = SourceSize * part / n_parts; i < i_end; ++i)
+					++privateByteCounter[source[i * rs + key_offset + digit]];
+			});
+		task_pool->Wait(slot_id, group);
+
+		first_symb = source[key_offset + digit];
+		COUNTER_TYPE sum = 0;
+		for(uint32 part = 0; part < n_parts; ++part)
+			sum += ByteCounter[part][first_symb];
+		if(sum != (COUNTER_TYPE) SourceSize)
+			break;
+
+		if(digit == 0)
+		{
+			if(in_dest)
+				A_memcpy(dest, source, SourceSize * rs);
+			return;
+		}
+		--digit;
+	}
 
-#ifdef WIN32
-	__declspec( align( WIN_ALIGNMENT ) ) COUNTER_TYPE globalHisto[256];
-#else
-	COUNTER_TYPE globalHisto[256] __attribute__((aligned(ALIGNMENT)));
-#endif
-	
-#pragma omp parallel num_threads(n_threads)
-	{ 
-		int myID = omp_get_thread_num();
-		uint8_t ByteIndex = 0;
-		long long i;
-		COUNTER_TYPE prevSum;
-		COUNTER_TYPE temp;
-
-		uint32 n;
-		
-		int index_x;
-		int private_i;
-		int byteValue;
-		uint64 *tempSource = Source;
-		uint64 *tempDest = Dest;
-		uint64 *tempPtr;
-					
-		uint64 *raw_Buffer;
-		pmm_radix_buf->reserve(raw_Buffer);
-		uint64 *Buffer = raw_Buffer;     
-		
-		while(((unsigned long long) Buffer) % ALIGNMENT)
-			Buffer++; 
+	RadixOffsets(ByteCounter, n_parts);
+
+	for(uint32 part = 0; part < n_parts; ++part)
+		task_pool->Run(slot_id, group, [&, part]{
+			int64 i_start = SourceSize * part / n_parts;
+			int64 i_end   = SourceSize * (part + 1) / n_parts;
 
 #ifdef WIN32
-	__declspec( align( WIN_ALIGNMENT ) ) COUNTER_TYPE privateByteCounter[256] = {0};
+			__declspec( align( WIN_ALIGNMENT ) ) COUNTER_TYPE privateByteCounter[256];
 #else
-	__attribute__((aligned(ALIGNMENT)))  COUNTER_TYPE privateByteCounter[256] = {0};
+			__attribute__((aligned(ALIGNMENT)))  COUNTER_TYPE privateByteCounter[256];
 #endif
-		
-   		for(uint32 privatePhaseCounter = 0; privatePhaseCounter < n_phases; privatePhaseCounter++)
-		{
-			#pragma omp for private(i) schedule(static) 
-			for(i = 0; i < SourceSize; ++i)
-			{
-				byteValue = *(reinterpret_cast<const uint8_t*>(&tempSource[i]) + ByteIndex);
-				++privateByteCounter[byteValue];
-			}	
-			A_memcpy(&ByteCounter[myID][0], privateByteCounter, sizeof(privateByteCounter));
-
-			#pragma omp barrier
+			A_memcpy(privateByteCounter, ByteCounter[part].data(), sizeof(privateByteCounter));
 
-			#pragma omp for schedule(static)
-			for(i = 0; i < 256; ++i)
+			if(FIXED_SIZE != 8 || !pmm_radix_buf)
 			{
-				prevSum = 0; 
-				for(n = 0; n < n_threads; n++)
+				for(int64 i = i_start; i < i_end; ++i)
 				{
-					temp = ByteCounter[n][i];
-					ByteCounter[n][i] = prevSum;
-					prevSum += temp; 
+					uchar *rec = source + i * rs;
+					memcpy(dest + (privateByteCounter[rec[key_offset + digit]]++) * rs, rec, rs);
 				}
-				globalHisto[i] = prevSum;
-			}	
-
-			#pragma omp single
-			{
-				prevSum = 0; 
-				for(i = 0; i < 256; ++i)
-				{
-					temp = globalHisto[i];
-					globalHisto[i] = prevSum;
-					prevSum += temp; 
-				}	
+				return;
 			}
 
-			for (private_i = 0; private_i < 256; private_i++)
-				ByteCounter[myID][private_i] += globalHisto[private_i];
+			uint64 *tempSource = (uint64*) source;
+			uint64 *tempDest = (uint64*) dest;
+			int index_x;
+			int private_i;
+			int byteValue;
 
-			A_memcpy(privateByteCounter, &ByteCounter[myID][0], sizeof(privateByteCounter));
-		
+			uint64 *raw_Buffer;
+			pmm_radix_buf->reserve(raw_Buffer);
+			uint64 *Buffer = raw_Buffer;
 
-			#pragma omp for schedule(static)
-			for(i = 0; i < SourceSize; ++i)
+			while(((unsigned long long) Buffer) % ALIGNMENT)
+				Buffer++;
+
+			for(int64 i = i_start; i < i_end; ++i)
 			{
-				byteValue = *(reinterpret_cast<const uint8_t*>(&tempSource[i]) + ByteIndex);
+				byteValue = *(reinterpret_cast<const uint8_t*>(&tempSource[i]) + digit);
 
 				index_x = privateByteCounter[byteValue] % BUFFER_WIDTH;
 
 				Buffer[byteValue * BUFFER_WIDTH + index_x] = tempSource[i];
-			
+
 				privateByteCounter[byteValue]++;
 
 				if(index_x == (BUFFER_WIDTH -1))
-					A_memcpy ( &tempDest[privateByteCounter[byteValue] - (BUFFER_WIDTH)], &Buffer[byteValue * BUFFER_WIDTH], BUFFER_WIDTH *sizeof(uint64) );
+				{
+					// The first block of a digit can start before the range of the part (it belongs to the previous part then)
+					if(privateByteCounter[byteValue] - BUFFER_WIDTH >= ByteCounter[part][byteValue])
+						A_memcpy ( &tempDest[privateByteCounter[byteValue] - (BUFFER_WIDTH)], &Buffer[byteValue * BUFFER_WIDTH], BUFFER_WIDTH *sizeof(uint64) );
+					else
+						A_memcpy ( &tempDest[ByteCounter[part][byteValue]], &Buffer[byteValue * BUFFER_WIDTH + ByteCounter[part][byteValue] % BUFFER_WIDTH], (privateByteCounter[byteValue] - ByteCounter[part][byteValue]) *sizeof(uint64) );
+				}
 			} //end_for
 
 			INT_TYPE elemInBuffer;
 			INT_TYPE index_stop;
 			INT_TYPE index_start;
 			INT_TYPE elemWrittenIntoBuffer;
-		
+
 			for(private_i = 0; private_i < 256; private_i++)
 			{
 				index_stop = privateByteCounter[private_i] % BUFFER_WIDTH;
-				index_start = ByteCounter[myID][private_i] % BUFFER_WIDTH;
-				elemWrittenIntoBuffer = privateByteCounter[private_i] - ByteCounter[myID][private_i];
+				index_start = ByteCounter[part][private_i] % BUFFER_WIDTH;
+				elemWrittenIntoBuffer = privateByteCounter[private_i] - ByteCounter[part][private_i];
 
 				if((index_stop - elemWrittenIntoBuffer) <= 0)
 					elemInBuffer = index_stop;
@@ -266,27 +277,64 @@ template<typename COUNTER_TYPE, typename INT_TYPE>
 
 				if(elemInBuffer != 0)
 					A_memcpy ( &tempDest[privateByteCounter[private_i] - elemInBuffer], &Buffer[private_i * BUFFER_WIDTH + (privateByteCounter[private_i] - elemInBuffer)%BUFFER_WIDTH], (elemInBuffer)*sizeof(uint64) );
-			
 			}
-			#pragma omp barrier
 
-			tempPtr = tempDest;
-			tempDest = tempSource;
-			tempSource = tempPtr;
-			ByteIndex++;
-			memset(privateByteCounter, 0, sizeof(privateByteCounter));
-		}
-		pmm_radix_buf->free(raw_Buffer);
+			pmm_radix_buf->free(raw_Buffer);
+		});
+	task_pool->Wait(slot_id, group);
+
+	if(digit == 0)
+	{
+		if(!in_dest)
+			A_memcpy(source, dest, SourceSize * rs);
+		return;
+	}
+
+	// Buckets start at the positions of the first part
+	vector<pair<uint64, uint64>> large_buckets;
+	for(uint32 i = 0; i < 256; ++i)
+	{
+		uint64 start = ByteCounter[0][i];
+		uint64 count = (i < 255 ? (uint64) ByteCounter[0][i + 1] : (uint64) SourceSize) - start;
+
+		if(count >= RADIX_PARALLEL_RECS)
+			large_buckets.push_back(make_pair(start, count));
+		else if(count)
+			task_pool->Run(slot_id, group, [=]{
+				RadixMSD<FIXED_SIZE>(dest + start * rs, source + start * rs, count, rec_size, key_offset, digit - 1, !in_dest);
+			});
 	}
+
+	for(auto p = large_buckets.begin(); p != large_buckets.end(); ++p)
+		RadixParallelMSD<COUNTER_TYPE, INT_TYPE, FIXED_SIZE>(pmm_radix_buf, dest + p->first * rs, source + p->first * rs, p->second, rec_size, key_offset, digit - 1, !in_dest, task_pool, slot_id);
+
+	task_pool->Wait(slot_id, group);
 }
 
 //----------------------------------------------------------------------------------
-void RadixSort_buffer(CMemoryPool *pmm_radix_buf, uint64 *&data, uint64 *&tmp, uint64 size, const unsigned n_phases, const unsigned n_threads)
+// The sorted records are in tmp_ptr if n_phases is odd and in data_ptr otherwise (as after n_phases LSD passes)
+void RadixSort_uint8(uint32 *&data_ptr, uint32 *&tmp_ptr, uint64 size, unsigned rec_size, unsigned data_offset, unsigned data_size, const unsigned n_phases, CTaskPool *task_pool, uint32 slot_id)
 {
+	if(!size || !n_phases)
+		return;
+
+	if(size * rec_size >= (1ull << 32))
+		RadixParallelMSD<uint64, int64, 0>(NULL, (uchar*) data_ptr, (uchar*) tmp_ptr, size, rec_size, data_offset, n_phases - 1, n_phases % 2 != 0, task_pool, slot_id);
+	else
+		RadixParallelMSD<uint32, int32, 0>(NULL, (uchar*) data_ptr, (uchar*) tmp_ptr, size, rec_size, data_offset, n_phases - 1, n_phases % 2 != 0, task_pool, slot_id);
+}
+
+//----------------------------------------------------------------------------------
+// The sorted records are in tmp if n_phases is odd and in data otherwise (as after n_phases LSD passes)
+void RadixSort_buffer(CMemoryPool *pmm_radix_buf, uint64 *&data, uint64 *&tmp, uint64 size, const unsigned n_phases, CTaskPool *task_pool, uint32 slot_id)
+{
+	if(!size || !n_phases)
+		return;
+
 	if(size >= (1ull << 31))
-		RadixOMP_buffer<uint64, int64>(pmm_radix_buf, data, tmp, size, n_phases, n_threads);
+		RadixParallelMSD<uint64, int64, 8>(pmm_radix_buf, (uchar*) data, (uchar*) tmp, size, 8, 0, n_phases - 1, n_phases % 2 != 0, task_pool, slot_id);
 	else
-		RadixOMP_buffer<uint32, int32>(pmm_radix_buf, data, tmp, size, n_phases, n_threads);
+		RadixParallelMSD<uint32, int32, 8>(pmm_radix_buf, (uchar*) data, (uchar*) tmp, size, 8, 0, n_phases - 1, n_phases % 2 != 0, task_pool, slot_id);
 }
 
 // ***** EOF
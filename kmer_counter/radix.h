@@ -14,11 +14,13 @@
 #include <cstring>
 #include <cstdlib>
 #include <iostream>
-#include <omp.h>
 #include <algorithm>
+#include <vector>
+#include <array>
 #include "libs/asmlib.h"
 #include "defs.h"
 #include "queues.h"
+#include "task_pool.h"
 #include <boost/static_assert.hpp>
 
 #ifdef WIN32
@@ -29,6 +31,9 @@ typedef unsigned __int8 uint8_t;
 
 #define MAX_NUM_THREADS 32
 #define BUFFER_WIDTH 32
+#define RADIX_MIN_PART_RECS (1 << 12)
+#define RADIX_PARALLEL_RECS (1 << 20)		// smaller buckets are sorted by single tasks
+#define RADIX_INSERTION_RECS 32			// smaller buckets are sorted by insertion
 #define ALIGNMENT 0x100
 #define WIN_ALIGNMENT 64
 
@@ -36,8 +41,8 @@ typedef unsigned __int8 uint8_t;
 #define BUFFER_WIDTH_MINUS_1 31
 #define BUFFER_WIDTH_MUL_sizeof_UINT 256
 
-void RadixSort_uint8(uint32 *&data_ptr, uint32 *&tmp_ptr, uint64 size, unsigned rec_size, unsigned data_offset, unsigned data_size, const unsigned n_phases, const unsigned n_threads);
-void RadixSort_buffer(CMemoryPool *pmm_radix_buf, uint64 *&data, uint64 *&tmp, uint64 size, const unsigned n_phases, const unsigned n_threads);
+void RadixSort_uint8(uint32 *&data_ptr, uint32 *&tmp_ptr, uint64 size, unsigned rec_size, unsigned data_offset, unsigned data_size, const unsigned n_phases, CTaskPool *task_pool, uint32 slot_id);
+void RadixSort_buffer(CMemoryPool *pmm_radix_buf, uint64 *&data, uint64 *&tmp, uint64 size, const unsigned n_phases, CTaskPool *task_pool, uint32 slot_id);
 
 #endif
 
@@ -13,6 +13,14 @@
 #include "defs.h"
 #include "mmer.h"
 #include "params.h"
+#include <vector>
+#include <algorithm>
+#include <numeric>
+#include <queue>
+#include <functional>
+#include <string>
+#include <cstdio>
+#include <cstring>
 
 #ifdef DEVELOP_MODE
 #include "develop.h"
@@ -24,9 +32,27 @@ class CSignatureMapper
 	uint32 map_size;
 	int32* signature_map;
 	uint32 signature_len;
+	signature_order sig_order;
 	uint32 special_signature;
+	uint32 n_bins_max;
 	CMemoryPool* pmm_stats;
 
+	// Header of a file of signature statistics
+	static constexpr const char* STATS_MARKER = "KMCS";
+	static const uint32 STATS_HEADER_SIZE = 9;
+	void MakeStatsHeader(uint32* header, uint32 kmer_len, bool both_strands, uint32 max_x, bool cost_packing)
+	{
+		header[0] = 1;										// version
+		header[1] = kmer_len;
+		header[2] = signature_len;
+		header[3] = sig_order;
+		header[4] = both_strands;
+		header[5] = max_x;
+		header[6] = cost_packing ? 2 * map_size : map_size;	// size of stats
+		header[7] = n_bins_max;
+		header[8] = cost_packing;
+	}
+
 	class Comp
 	{
 		uint32* signature_occurences;
@@ -37,6 +63,22 @@ class CSignatureMapper
 			return signature_occurences[i] > signature_occurences[j];
 		}
 	};
+
+	// Return the first signature not assigned to a bin at position pos or further (next[] links the assigned ones
+	// to the following positions)
+	static uint32 find_next(vector<uint32>& next, uint32 pos)
+	{
+		uint32 r = pos;
+		while (next[r] != r)
+			r = next[r];
+		while (next[pos] != r)
+		{
+			uint32 tmp = next[pos];
+			next[pos] = r;
+			pos = tmp;
+		}
+		return r;
+	}
 	
 public:	
 	void Init(uint32* stats)
@@ -47,14 +89,13 @@ public:
 			sorted[i] = i;
 		sort(sorted, sorted + map_size, Comp(stats));
 
-		list<pair<uint32, uint64>> _stats;
+		vector<pair<uint32, uint64>> _stats;
 		for (uint32 i = 0; i < map_size ; ++i)
 		{
-			if (CMmer::is_allowed(sorted[i], signature_len))
+			if (CMmer::is_signature(sorted[i], signature_len, sig_order))
 				_stats.push_back(make_pair(sorted[i], stats[sorted[i]]));
 		}
 
-		list<pair<uint32, uint64>> group;
 		uint32 bin_no = 0;
 		//counting sum
 		double sum = 0.0;
@@ -64,13 +105,20 @@ public:
 			sum += i.second;
 		}
 
-		double mean = sum / MAX_BINS;
+		// Signatures are in the order of non-increasing counts; the ones assigned to bins are skipped by find_next
+		uint32 n_sigs = (uint32) _stats.size();
+		uint32 n_left = n_sigs;
+		vector<uint32> next(n_sigs + 1);
+		iota(next.begin(), next.end(), 0);
+
+		double mean = sum / n_bins_max;
 		double max_bin_size = 1.1 * mean;
-		uint32 n = MAX_BINS - 1; //one is needed for disabled signatures
-		uint32 max_bins = MAX_BINS - 1;
-		while (_stats.size() > n)
+		uint32 n = n_bins_max - 1; //one is needed for disabled signatures
+		uint32 max_bins = n_bins_max - 1;
+		while (n_left > n)
 		{
-			pair<uint32, uint64>& max = _stats.front();
+			uint32 first = find_next(next, 0);
+			pair<uint32, uint64>& max = _stats[first];
 
 			if (max.second > mean)
 			{
@@ -79,31 +127,26 @@ public:
 				mean = sum / (max_bins - bin_no);
 				max_bin_size = 1.1 * mean;
 
-				_stats.pop_front();
+				next[first] = first + 1;
+				--n_left;
 				--n;
 			}
 			else
 			{
-				//heuristic
-				group.clear();
+				//heuristic: the largest signatures that still fit are added to the bin
 				double tmp_sum = 0.0;
-				uint32 in_current = 0;
-				for (auto it = _stats.begin(); it != _stats.end();)
+				for (uint32 pos = first; ; ++pos)
 				{
-					if (tmp_sum + it->second < max_bin_size)
-					{
-						tmp_sum += it->second;
-						group.push_back(*it);
-						it = _stats.erase(it);
-						++in_current;
-					}
-					else
-						++it;
-				}
+					pos = (uint32) (partition_point(_stats.begin() + pos, _stats.end(), [&](const pair<uint32, uint64> &x){
+						return !(tmp_sum + x.second < max_bin_size); }) - _stats.begin());
+					pos = find_next(next, pos);
+					if (pos == n_sigs)
+						break;
 
-				for (auto i = group.begin(); i != group.end(); ++i)
-				{
-					signature_map[i->first] = bin_no;
+					tmp_sum += _stats[pos].second;
+					signature_map[_stats[pos].first] = bin_no;
+					next[pos] = pos + 1;
+					--n_left;
 				}
 				--n;
 				++bin_no;
@@ -113,13 +156,10 @@ public:
 				max_bin_size = 1.1 * mean;
 			}
 		}
-		if (_stats.size() > 0)
+		for (uint32 i = find_next(next, 0); i < n_sigs; i = find_next(next, i + 1))
 		{
-			for (auto i = _stats.begin(); i != _stats.end(); ++i)
-			{
-				signature_map[i->first] = bin_no++;
-				cout << "rest bin: " << i->second << "\n";
-			}
+			signature_map[_stats[i].first] = bin_no++;
+			cout << "rest bin: " << _stats[i].second << "\n";
 		}
 		signature_map[special_signature] = bin_no;
 		pmm_stats->free(sorted);
@@ -129,10 +169,143 @@ public:
 #endif
 
 	}
-	CSignatureMapper(CMemoryPool* _pmm_stats, uint32 _signature_len)
+	// Longest-processing-time assignment of signatures to bins according to the estimated cost of stage 2.
+	// stats[0, map_size) are k-mer counts, stats[map_size, 2*map_size) counts of k(+x)-mer records of signatures.
+	// The cost of a signature is the size of its records (read, radix sorted and compacted in stage 2) plus
+	// the size of its super k-mers in a bin file.
+	// The signatures are sorted in an array of the stats pool (as in Init), so no memory outside -m is needed.
+	void InitCost(uint32* stats, uint32 rec_size)
+	{
+		uint32* recs = stats + map_size;
+
+		uint32 *sigs;
+		pmm_stats->reserve(sigs);
+		uint32 n_sigs = 0;
+		double sum_kmers = 0.0, sum_recs = 0.0;
+		for (uint32 i = 0; i < map_size; ++i)
+			if (CMmer::is_signature(i, signature_len, sig_order))
+			{
+				sigs[n_sigs++] = i;
+				sum_kmers += stats[i];
+				sum_recs += recs[i];
+			}
+
+		// The same prior as in Init, i.e., 1000 k-mers per signature (k+x-mers are added proportionally)
+		double recs_per_kmer = sum_kmers > 0 ? sum_recs / sum_kmers : 1.0;
+		auto cost = [&](uint32 sig) {
+			double kmers = stats[sig] + 1000.0;
+			double n_recs = recs[sig] + 1000.0 * recs_per_kmer;
+			return n_recs * rec_size + kmers / 4.0;
+		};
+		sort(sigs, sigs + n_sigs, [&](uint32 x, uint32 y){
+			double cx = cost(x), cy = cost(y);
+			return cx > cy || (cx == cy && x < y); });
+
+		// Each signature goes to the least loaded bin; one bin is needed for disabled signatures
+		uint32 n = MIN(n_bins_max - 1, n_sigs);
+		priority_queue<pair<double, uint32>, vector<pair<double, uint32>>, greater<pair<double, uint32>>> bins;
+		for (uint32 i = 0; i < n; ++i)
+			bins.push(make_pair(0.0, i));
+		for (uint32 i = 0; i < n_sigs; ++i)
+		{
+			auto bin = bins.top();
+			bins.pop();
+			signature_map[sigs[i]] = bin.second;
+			bin.first += cost(sigs[i]);
+			bins.push(bin);
+		}
+		signature_map[special_signature] = n;
+		pmm_stats->free(sigs);
+
+#ifdef DEVELOP_MODE
+		map_log(signature_len, map_size, signature_map);
+#endif
+	}
+
+	// Save the statistics of signatures collected in stage 0 together with the signature map made of them
+	void SaveStats(const string& file_name, uint32* stats, uint32 kmer_len, bool both_strands, uint32 max_x, bool cost_packing)
+	{
+		FILE* f = fopen(file_name.c_str(), "wb");
+		if (!f)
+		{
+			cout << "Error: cannot create file " << file_name << "\n";
+			exit(1);
+		}
+
+		uint32 header[STATS_HEADER_SIZE];
+		MakeStatsHeader(header, kmer_len, both_strands, max_x, cost_packing);
+		bool ok = fwrite(STATS_MARKER, 1, 4, f) == 4;
+		ok = ok && fwrite(header, sizeof(uint32), STATS_HEADER_SIZE, f) == STATS_HEADER_SIZE;
+		ok = ok && fwrite(stats, sizeof(uint32), header[6], f) == header[6];
+		ok = ok && fwrite(signature_map, sizeof(int32), map_size, f) == map_size;
+		if (fclose(f) != 0 || !ok)
+		{
+			cout << "Error: cannot write file " << file_name << "\n";
+			exit(1);
+		}
+	}
+
+	// Load the statistics of signatures saved by a previous run. If the saved map was made for the same no. of bins
+	// and assignment method it is also loaded and true is returned; otherwise the map must be made of the stats.
+	bool LoadStats(const string& file_name, uint32* stats, uint32 kmer_len, bool both_strands, uint32 max_x, bool cost_packing)
+	{
+		FILE* f = fopen(file_name.c_str(), "rb");
+		if (!f)
+		{
+			cout << "Error: cannot open file " << file_name << "\n";
+			exit(1);
+		}
+
+		char marker[4];
+		uint32 header[STATS_HEADER_SIZE], cur_header[STATS_HEADER_SIZE];
+		MakeStatsHeader(cur_header, kmer_len, both_strands, max_x, cost_packing);
+		if (fread(marker, 1, 4, f) != 4 || strncmp(marker, STATS_MARKER, 4) != 0 ||
+			fread(header, sizeof(uint32), STATS_HEADER_SIZE, f) != STATS_HEADER_SIZE || header[0] != cur_header[0])
+		{
+			cout << "Error: " << file_name << " is not a file of signature statistics\n";
+			exit(1);
+		}
+		if (header[1] != cur_header[1] || header[2] != cur_header[2] || header[3] != cur_header[3])
+		{
+			cout << "Error: signature statistics in " << file_name << " were collected for k = " << header[1] << ", signature length = " << header[2] 
+				<< " and " << (header[3] == sig_hash ? "hash" : "lexicographic") << " order of signatures\n";
+			exit(1);
+		}
+		// No. of k+x-mer records depends on x and on the canonical form of k-mers
+		if (cost_packing && (header[6] != cur_header[6] || header[4] != cur_header[4] || header[5] != cur_header[5]))
+		{
+			cout << "Error: signature statistics in " << file_name << " are not suitable for -lc for these parameters; run stage 0 with -lc to collect them\n";
+			exit(1);
+		}
+
+		// Counts of k+x-mer records are skipped if not needed
+		uint32 stats_size = MIN(header[6], cur_header[6]);
+		if (fread(stats, sizeof(uint32), stats_size, f) != stats_size)
+		{
+			cout << "Error: cannot read file " << file_name << "\n";
+			exit(1);
+		}
+		bool map_loaded = false;
+		if (header[6] == cur_header[6] && header[7] == cur_header[7] && header[8] == cur_header[8])
+		{
+			if (fread(signature_map, sizeof(int32), map_size, f) != map_size)
+			{
+				cout << "Error: cannot read file " << file_name << "\n";
+				exit(1);
+			}
+			map_loaded = true;
+		}
+		fclose(f);
+
+		return map_loaded;
+	}
+
+	CSignatureMapper(CMemoryPool* _pmm_stats, uint32 _signature_len, signature_order _sig_order, uint32 _n_bins_max)
 	{
 		pmm_stats = _pmm_stats;
 		signature_len = _signature_len;
+		sig_order = _sig_order;
+		n_bins_max = _n_bins_max;
 		special_signature = 1 << 2 * signature_len;
 		map_size = (1 << 2 * signature_len) + 1;
 		signature_map = new int32[map_size];		
@@ -156,6 +329,11 @@ public:
 		return signature_map[special_signature];
 	}
 
+	inline uint32 get_map_size()
+	{
+		return map_size;
+	}
+
 	~CSignatureMapper()
 	{
 		delete [] signature_map;
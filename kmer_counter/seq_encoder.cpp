@@ -0,0 +1,171 @@
+#include "stdafx.h"
+/*
+  This file is a part of KMC software distributed under GNU GPL 3 licence.
+  The homepage of the KMC project is http://sun.aei.polsl.pl/kmc
+
+  Authors: Sebastian Deorowicz, Agnieszka Debudaj-Grabysz, Marek Kokot
+
+  Version: 2.0
+  Date   : 2014-07-04
+*/
+
+#include "seq_encoder.h"
+#include "libs/asmlib.h"
+#include <string.h>
+
+#if defined(__x86_64__) || defined(_M_X64)
+#define SEQ_ENCODER_SIMD
+#include <immintrin.h>
+#endif
+
+#ifdef _MSC_VER
+#define TARGET_AVX2
+#else
+#define TARGET_AVX2 __attribute__((target("avx2")))
+#endif
+
+char CSeqEncoder::codes[256];
+CSeqEncoder::encode_t CSeqEncoder::encode;
+CSeqEncoder::pack_t CSeqEncoder::pack;
+CSeqEncoder::_si CSeqEncoder::_init;
+
+//----------------------------------------------------------------------------------
+static void EncodeScalar(const uchar *src, uint64 n, char *dst)
+{
+	for(uint64 i = 0; i < n; ++i)
+		dst[i] = CSeqEncoder::codes[src[i]];
+}
+
+//----------------------------------------------------------------------------------
+static void PackScalar(const char *seq, uint64 n, uchar *dst)
+{
+	for(uint64 i = 0, j = 0; i < n / 4; ++i, j += 4)
+		dst[i] = (seq[j] << 6) + (seq[j + 1] << 4) + (seq[j + 2] << 2) + seq[j + 3];
+}
+
+#ifdef SEQ_ENCODER_SIMD
+//----------------------------------------------------------------------------------
+// 16 symbols: the symbols are converted to lower case and compared with the nucleotides
+static inline __m128i EncodeVec(__m128i x)
+{
+	x = _mm_or_si128(x, _mm_set1_epi8(0x20));
+	__m128i eq_a = _mm_cmpeq_epi8(x, _mm_set1_epi8('a'));
+	__m128i eq_c = _mm_cmpeq_epi8(x, _mm_set1_epi8('c'));
+	__m128i eq_g = _mm_cmpeq_epi8(x, _mm_set1_epi8('g'));
+	__m128i eq_t = _mm_cmpeq_epi8(x, _mm_set1_epi8('t'));
+
+	__m128i code = _mm_or_si128(_mm_and_si128(eq_c, _mm_set1_epi8(1)),
+		_mm_or_si128(_mm_and_si128(eq_g, _mm_set1_epi8(2)), _mm_and_si128(eq_t, _mm_set1_epi8(3))));
+	__m128i valid = _mm_or_si128(_mm_or_si128(eq_a, eq_c), _mm_or_si128(eq_g, eq_t));
+
+	return _mm_or_si128(code, _mm_andnot_si128(valid, _mm_set1_epi8(-1)));
+}
+
+//----------------------------------------------------------------------------------
+// 16 codes -> 4 bytes
+static inline uint32 PackVec(__m128i x)
+{
+	x = _mm_or_si128(_mm_slli_epi16(_mm_and_si128(x, _mm_set1_epi16(0xFF)), 2), _mm_srli_epi16(x, 8));
+	x = _mm_or_si128(_mm_slli_epi32(_mm_and_si128(x, _mm_set1_epi32(0xFFFF)), 4), _mm_srli_epi32(x, 16));
+	x = _mm_packs_epi32(x, x);
+
+	return (uint32) _mm_cvtsi128_si32(_mm_packus_epi16(x, x));
+}
+
+//----------------------------------------------------------------------------------
+static void EncodeSSE2(const uchar *src, uint64 n, char *dst)
+{
+	uint64 i = 0;
+	for(; i + 16 <= n; i += 16)
+		_mm_storeu_si128((__m128i *) (dst + i), EncodeVec(_mm_loadu_si128((const __m128i *) (src + i))));
+
+	EncodeScalar(src + i, n - i, dst + i);
+}
+
+//----------------------------------------------------------------------------------
+static void PackSSE2(const char *seq, uint64 n, uchar *dst)
+{
+	uint64 i = 0;
+	for(; i + 16 <= n; i += 16, dst += 4)
+	{
+		uint32 x = PackVec(_mm_loadu_si128((const __m128i *) (seq + i)));
+		memcpy(dst, &x, 4);
+	}
+
+	PackScalar(seq + i, n - i, dst);
+}
+
+//----------------------------------------------------------------------------------
+// 32 symbols: the lower nibble identifies the nucleotide (a-1, c-3, t-4, g-7), the expected symbol and its code
+// are taken from tables
+TARGET_AVX2 static void EncodeAVX2(const uchar *src, uint64 n, char *dst)
+{
+	const __m256i lut_symbols = _mm256_setr_epi8(0, 'a', 0, 'c', 't', 0, 0, 'g', 0, 0, 0, 0, 0, 0, 0, 0,
+		0, 'a', 0, 'c', 't', 0, 0, 'g', 0, 0, 0, 0, 0, 0, 0, 0);
+	const __m256i lut_codes = _mm256_setr_epi8(0, 0, 0, 1, 3, 0, 0, 2, 0, 0, 0, 0, 0, 0, 0, 0,
+		0, 0, 0, 1, 3, 0, 0, 2, 0, 0, 0, 0, 0, 0, 0, 0);
+
+	uint64 i = 0;
+	for(; i + 32 <= n; i += 32)
+	{
+		__m256i x	  = _mm256_loadu_si256((const __m256i *) (src + i));
+		__m256i nib	  = _mm256_and_si256(x, _mm256_set1_epi8(0x0F));
+		__m256i valid = _mm256_cmpeq_epi8(_mm256_or_si256(x, _mm256_set1_epi8(0x20)), _mm256_shuffle_epi8(lut_symbols, nib));
+		__m256i code  = _mm256_or_si256(_mm256_shuffle_epi8(lut_codes, nib), _mm256_andnot_si256(valid, _mm256_set1_epi8(-1)));
+		_mm256_storeu_si256((__m256i *) (dst + i), code);
+	}
+
+	EncodeSSE2(src + i, n - i, dst + i);
+}
+
+//----------------------------------------------------------------------------------
+// 32 codes -> 8 bytes
+TARGET_AVX2 static void PackAVX2(const char *seq, uint64 n, uchar *dst)
+{
+	const __m256i weights = _mm256_set1_epi32(0x01041040);		// 64, 16, 4, 1
+
+	uint64 i = 0;
+	for(; i + 32 <= n; i += 32, dst += 8)
+	{
+		__m256i x = _mm256_maddubs_epi16(_mm256_loadu_si256((const __m256i *) (seq + i)), weights);
+		x = _mm256_madd_epi16(x, _mm256_set1_epi16(1));
+		x = _mm256_packs_epi32(x, x);
+		x = _mm256_packus_epi16(x, x);
+		x = _mm256_permutevar8x32_epi32(x, _mm256_setr_epi32(0, 4, 0, 4, 0, 4, 0, 4));
+		_mm_storel_epi64((__m128i *) dst, _mm256_castsi256_si128(x));
+	}
+
+	PackSSE2(seq + i, n - i, dst);
+}
+#endif
+
+//----------------------------------------------------------------------------------
+// Choose the variant according to the instruction set supported by the CPU
+CSeqEncoder::_si::_si()
+{
+	for(int i = 0; i < 256; ++i)
+		codes[i] = -1;
+	codes['A'] = codes['a'] = 0;
+	codes['C'] = codes['c'] = 1;
+	codes['G'] = codes['g'] = 2;
+	codes['T'] = codes['t'] = 3;
+
+	encode = EncodeScalar;
+	pack   = PackScalar;
+
+#ifdef SEQ_ENCODER_SIMD
+	int iset = InstructionSet();
+	if(iset >= 13)				// AVX2
+	{
+		encode = EncodeAVX2;
+		pack   = PackAVX2;
+	}
+	else if(iset >= 4)			// SSE2
+	{
+		encode = EncodeSSE2;
+		pack   = PackSSE2;
+	}
+#endif
+}
+
+// ***** EOF
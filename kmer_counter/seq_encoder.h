@@ -0,0 +1,46 @@
+/*
+  This file is a part of KMC software distributed under GNU GPL 3 licence.
+  The homepage of the KMC project is http://sun.aei.polsl.pl/kmc
+
+  Authors: Sebastian Deorowicz, Agnieszka Debudaj-Grabysz, Marek Kokot
+
+  Version: 2.0
+  Date   : 2014-07-04
+*/
+
+#ifndef _SEQ_ENCODER_H
+#define _SEQ_ENCODER_H
+
+#include "defs.h"
+
+//************************************************************************************************************
+// CSeqEncoder - conversion of nucleotides to 2-bit codes and packing of the codes (4 symbols per byte)
+// A/a = 0, C/c = 1, G/g = 2, T/t = 3; all other symbols are encoded as -1, so the sign bits of the codes
+// form the mask of 'N' symbols tested by the splitters.
+// AVX2 or SSE2 variants are chosen at start-up according to the CPU; scalar code is used otherwise.
+//************************************************************************************************************
+class CSeqEncoder {
+	typedef void (*encode_t)(const uchar *src, uint64 n, char *dst);
+	typedef void (*pack_t)(const char *seq, uint64 n, uchar *dst);
+
+	static encode_t encode;
+	static pack_t pack;
+
+	struct _si
+	{
+		_si();
+	} static _init;
+
+public:
+	static char codes[256];
+
+	// Encode n symbols from src
+	static inline void Encode(const uchar *src, uint64 n, char *dst) { encode(src, n, dst); }
+
+	// Pack n / 4 groups of 4 codes (0..3) into n / 4 bytes; the first symbol of a group is at the 2 highest bits
+	static inline void Pack(const char *seq, uint64 n, uchar *dst) { pack(seq, n, dst); }
+};
+
+#endif
+
+// ***** EOF
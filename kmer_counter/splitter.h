@@ -20,6 +20,9 @@
 #include "kb_completer.h"
 #include "queues.h"
 #include "s_mapper.h"
+#include "mapped_file.h"
+#include "line_scanner.h"
+#include "seq_encoder.h"
 #include "mmer.h"
 #include <stdio.h>
 #include <iostream>
@@ -47,7 +50,6 @@ template <bool QUAKE_MODE> class CSplitter {
 	int64 mem_part_pmm_bins;
 	int64 mem_part_pmm_reads;
 
-	char codes[256];
 	bool use_quake;
 	input_type file_type;
 	int lowest_quality;
@@ -56,12 +58,17 @@ template <bool QUAKE_MODE> class CSplitter {
 	uint32 kmer_len;
 	//uint32 prefix_len;
 	uint32 signature_len;
+	signature_order sig_order;
 	uint32 n_bins;	
 	uint64 n_reads;//for multifasta its a sequences counter	
 
 	CSignatureMapper* s_mapper;
 
+	uint32 n_rec_stats_pos;		// position of the no. of k(+x)-mer records in the stats (0: not counted)
+	uint32 stats_max_x;
+
 	inline bool GetSeq(char *seq, uint32 &seq_size);
+	inline void AddStats(uint32* _stats, uint32 signature, char* seq, uint32 len);
 	inline bool GetSeq(char *seq, char *quals, uint32 &seq_size);
 
 	
@@ -110,6 +117,7 @@ template <bool QUAKE_MODE> bool CSplitter<QUAKE_MODE>::GetSeq(char *seq, uint32
 {
 	uchar c = 0;
 	uint32 pos = 0;
+	uint64 line_end;
 	
 	if(file_type == fasta)
 	{
@@ -119,12 +127,7 @@ template <bool QUAKE_MODE> bool CSplitter<QUAKE_MODE>::GetSeq(char *seq, uint32
 		c = part[part_pos++];
 		if(c != '>')
 			return false;
-		for(; part_pos < part_size;)
-		{
-			c = part[part_pos++];
-			if(c < 32)					// newliners
-				break;
-		}
+		part_pos = CLineScanner::FindLineEnd(part, part_pos, part_size) + 1;		// skip the line with a newliner
 		if(part_pos >= part_size)
 			return false;
 
@@ -135,13 +138,12 @@ template <bool QUAKE_MODE> bool CSplitter<QUAKE_MODE>::GetSeq(char *seq, uint32
 			return false;
 
 		// Sequence
-		for(; part_pos < part_size;)
-		{
-			c = part[part_pos++];
-			if(c < 32)					// newliners
-				break;
-			seq[pos++] = codes[c];
-		}
+		line_end = CLineScanner::FindLineEnd(part, part_pos, part_size);
+		CSeqEncoder::Encode(part + part_pos, line_end - part_pos, seq);
+		pos = (uint32) (line_end - part_pos);
+		part_pos = line_end;
+		if(part_pos < part_size)
+			c = part[part_pos++];					// newliner
 		seq_size = pos;
 
 		if(part_pos >= part_size)
@@ -160,12 +162,7 @@ template <bool QUAKE_MODE> bool CSplitter<QUAKE_MODE>::GetSeq(char *seq, uint32
 		c = part[part_pos++];
 		if(c != '@')
 			return false;
-		for(; part_pos < part_size;)
-		{
-			c = part[part_pos++];
-			if(c < 32)					// newliners
-				break;
-		}
+		part_pos = CLineScanner::FindLineEnd(part, part_pos, part_size) + 1;		// skip the line with a newliner
 		if(part_pos >= part_size)
 			return false;
 
@@ -176,13 +173,12 @@ template <bool QUAKE_MODE> bool CSplitter<QUAKE_MODE>::GetSeq(char *seq, uint32
 			return false;
 
 		// Sequence
-		for(; part_pos < part_size;)
-		{
-			c = part[part_pos++];
-			if(c < 32)					// newliners
-				break;
-			seq[pos++] = codes[c];
-		}
+		line_end = CLineScanner::FindLineEnd(part, part_pos, part_size);
+		CSeqEncoder::Encode(part + part_pos, line_end - part_pos, seq);
+		pos = (uint32) (line_end - part_pos);
+		part_pos = line_end;
+		if(part_pos < part_size)
+			c = part[part_pos++];					// newliner
 		if(part_pos >= part_size)
 			return false;
 
@@ -198,12 +194,7 @@ template <bool QUAKE_MODE> bool CSplitter<QUAKE_MODE>::GetSeq(char *seq, uint32
 			return false;
 		if(c != '+')
 			return false;
-		for(; part_pos < part_size;)
-		{
-			c = part[part_pos++];
-			if(c < 32)					// newliners
-				break;
-		}
+		part_pos = CLineScanner::FindLineEnd(part, part_pos, part_size) + 1;		// skip the line with a newliner
 		if(part_pos >= part_size)
 			return false;
 
@@ -235,15 +226,15 @@ template <bool QUAKE_MODE> bool CSplitter<QUAKE_MODE>::GetSeq(char *seq, uint32
 		if(part[part_pos] == '>')//need to ommit header
 		{
 			++n_reads;
-			for(;part_pos < part_size && part[part_pos] != '\n' && part[part_pos] != '\r';++part_pos);//find EOF
+			part_pos = CLineScanner::FindEOL(part, part_pos, part_size);//find EOL
 			++part_pos;
 			if(part[part_pos] == '\n' || part[part_pos] == '\r')
 				++part_pos;
 		}
-		for(;part_pos < part_size && pos < mem_part_pmm_reads && part[part_pos] != '>';)
-		{
-			seq[pos++] = codes[part[part_pos++]];
-		}
+		line_end = CLineScanner::FindChar(part, part_pos, MIN(part_size, part_pos + mem_part_pmm_reads), '>');
+		CSeqEncoder::Encode(part + part_pos, line_end - part_pos, seq);
+		pos = (uint32) (line_end - part_pos);
+		part_pos = line_end;
 		seq_size = pos;
 		if(part_pos < part_size && part[part_pos] != '>')//need to copy last k-1 kmers 
 		{
@@ -262,6 +253,7 @@ template <bool QUAKE_MODE> bool CSplitter<QUAKE_MODE>::GetSeq(char *seq, char *q
 {
 	uchar c;
 	uint32 pos = 0;
+	uint64 line_end;
 
 	if(file_type == fasta || file_type == multiline_fasta)
 	{
@@ -275,12 +267,7 @@ template <bool QUAKE_MODE> bool CSplitter<QUAKE_MODE>::GetSeq(char *seq, char *q
 		c = part[part_pos++];
 		if(c != '@')
 			return false;
-		for(; part_pos < part_size;)
-		{
-			c = part[part_pos++];
-			if(c < 32)					// newliners
-				break;
-		}
+		part_pos = CLineScanner::FindLineEnd(part, part_pos, part_size) + 1;		// skip the line with a newliner
 		if(part_pos >= part_size)
 			return false;
 
@@ -291,13 +278,12 @@ template <bool QUAKE_MODE> bool CSplitter<QUAKE_MODE>::GetSeq(char *seq, char *q
 			return false;
 
 		// Sequence
-		for(; part_pos < part_size;)
-		{
-			c = part[part_pos++];
-			if(c < 32)					// newliners
-				break;
-			seq[pos++] = codes[c];
-		}
+		line_end = CLineScanner::FindLineEnd(part, part_pos, part_size);
+		CSeqEncoder::Encode(part + part_pos, line_end - part_pos, seq);
+		pos = (uint32) (line_end - part_pos);
+		part_pos = line_end;
+		if(part_pos < part_size)
+			c = part[part_pos++];					// newliner
 		if(part_pos >= part_size)
 			return false;
 
@@ -313,12 +299,7 @@ template <bool QUAKE_MODE> bool CSplitter<QUAKE_MODE>::GetSeq(char *seq, char *q
 			return false;
 		if(c != '+')
 			return false;
-		for(; part_pos < part_size;)
-		{
-			c = part[part_pos++];
-			if(c < 32)					// newliners
-				break;
-		}
+		part_pos = CLineScanner::FindLineEnd(part, part_pos, part_size) + 1;		// skip the line with a newliner
 		if(part_pos >= part_size)
 			return false;
 
@@ -350,6 +331,17 @@ template <bool QUAKE_MODE> bool CSplitter<QUAKE_MODE>::GetSeq(char *seq, char *q
 }
 
 
+//----------------------------------------------------------------------------------
+// Update the statistics of a signature with a super-k-mer
+template <bool QUAKE_MODE> void CSplitter<QUAKE_MODE>::AddStats(uint32* _stats, uint32 signature, char* seq, uint32 len)
+{
+	_stats[signature] += 1 + len - kmer_len;
+	if (n_rec_stats_pos)
+		_stats[n_rec_stats_pos + signature] += CKmerBinCollector::CountPlusXRecs(seq, len, kmer_len, stats_max_x, both_strands);
+}
+
+//----------------------------------------------------------------------------------
+// Count k-mers (and k+x-mer records for cost based assignment of signatures to bins) of each signature
 template <bool QUAKE_MODE> void CSplitter<QUAKE_MODE>::CalcStats(uchar* _part, uint64 _part_size, uint32* _stats)
 {
 	part = _part;
@@ -361,7 +353,8 @@ template <bool QUAKE_MODE> void CSplitter<QUAKE_MODE>::CalcStats(uchar* _part, u
 	pmm_reads->reserve(seq);
 
 	uint32 signature_start_pos;
-	CMmer current_signature(signature_len), end_mmer(signature_len);
+	CMmer current_signature(signature_len, sig_order), end_mmer(signature_len, sig_order);
+	CMmerWindow window(kmer_len - signature_len + 1);
 
 	uint32 i;
 	uint32 len;//length of extended kmer
@@ -390,22 +383,24 @@ template <bool QUAKE_MODE> void CSplitter<QUAKE_MODE>::CalcStats(uchar* _part, u
 			signature_start_pos = i - signature_len;
 			current_signature.insert(seq + signature_start_pos);
 			end_mmer.set(current_signature);
+			window.insert(current_signature, signature_start_pos);
 			for (; i < seq_size; ++i)
 			{
 				if (seq[i] < 0)//'N'
 				{
 					if (len >= kmer_len)
-						_stats[current_signature.get()] += 1 + len - kmer_len;
+						AddStats(_stats, current_signature.get(), seq + i - len, len);
 					len = 0;
 					++i;
 					break;
 				}
 				end_mmer.insert(seq[i]);
+				window.insert(end_mmer, i - signature_len + 1);
 				if (end_mmer < current_signature)//signature at the end of current k-mer is lower than current
 				{
 					if (len >= kmer_len)
 					{
-						_stats[current_signature.get()] += 1 + len - kmer_len;
+						AddStats(_stats, current_signature.get(), seq + i - len, len);
 						len = kmer_len - 1;
 					}
 					current_signature.set(end_mmer);
@@ -418,28 +413,17 @@ template <bool QUAKE_MODE> void CSplitter<QUAKE_MODE>::CalcStats(uchar* _part, u
 				}
 				else if (signature_start_pos + kmer_len - 1 < i)//need to find new signature
 				{
-					_stats[current_signature.get()] += 1 + len - kmer_len;
+					AddStats(_stats, current_signature.get(), seq + i - len, len);
 					len = kmer_len - 1;
-					//looking for new signature
-					++signature_start_pos;
-					//building first signature in current k-mer
-					end_mmer.insert(seq + signature_start_pos);
-					current_signature.set(end_mmer);
-					for (uint32 j = signature_start_pos + signature_len; j <= i; ++j)
-					{
-						end_mmer.insert(seq[j]);
-						if (end_mmer <= current_signature)
-						{
-							current_signature.set(end_mmer);
-							signature_start_pos = j - signature_len + 1;
-						}
-					}
+					//looking for new signature: the lowest m-mer in current k-mer
+					signature_start_pos = window.find_min(signature_start_pos + 1, i - signature_len + 1);
+					current_signature.insert(seq + signature_start_pos);
 				}
 				++len;
 			}
 		}
 		if (len >= kmer_len)//last one in read
-			_stats[current_signature.get()] += 1 + len - kmer_len;
+			AddStats(_stats, current_signature.get(), seq + i - len, len);
 	}
 
 	putchar('*');
@@ -462,6 +446,7 @@ template <bool QUAKE_MODE> CSplitter<QUAKE_MODE>::CSplitter(CKMCParams &Params,
 	pmm_reads	   = Queues.pmm_reads;
 	kmer_len		  = Params.kmer_len;
 	signature_len     = Params.signature_len;
+	sig_order		  = Params.sig_order;
 	
 	mem_part_pmm_bins = Params.mem_part_pmm_bins;
 
@@ -469,15 +454,10 @@ template <bool QUAKE_MODE> CSplitter<QUAKE_MODE>::CSplitter(CKMCParams &Params,
 
 	s_mapper = Queues.s_mapper;
 
-	part = NULL;
+	n_rec_stats_pos = Params.cost_packing ? (1 << signature_len * 2) + 1 : 0;
+	stats_max_x		= use_quake ? 0 : Params.max_x;
 
-	// Prepare encoding of symbols
-	for(int i = 0; i < 256; ++i)
-		codes[i] = -1;
-	codes['A'] = codes['a'] = 0;
-	codes['C'] = codes['c'] = 1;
-	codes['G'] = codes['g'] = 2;
-	codes['T'] = codes['t'] = 3;
+	part = NULL;
 
 	n_reads = 0;
 	bins = NULL;
@@ -551,7 +531,8 @@ bool CSplitter_Impl<false>::ProcessReads(CSplitter<false> &ptr, uchar *_part, ui
 	ptr.pmm_reads->reserve(seq);
 
 	uint32 signature_start_pos;
-	CMmer current_signature(ptr.signature_len), end_mmer(ptr.signature_len);
+	CMmer current_signature(ptr.signature_len, ptr.sig_order), end_mmer(ptr.signature_len, ptr.sig_order);
+	CMmerWindow window(ptr.kmer_len - ptr.signature_len + 1);
 	uint32 bin_no;
 	
 	uint32 i;
@@ -583,6 +564,7 @@ bool CSplitter_Impl<false>::ProcessReads(CSplitter<false> &ptr, uchar *_part, ui
 			signature_start_pos = i - ptr.signature_len;
 			current_signature.insert(seq + signature_start_pos);
 			end_mmer.set(current_signature);
+			window.insert(current_signature, signature_start_pos);
 			for (; i < seq_size; ++i)
 			{
 				if (seq[i] < 0)//'N'
@@ -597,6 +579,7 @@ bool CSplitter_Impl<false>::ProcessReads(CSplitter<false> &ptr, uchar *_part, ui
 					break;
 				}
 				end_mmer.insert(seq[i]);
+				window.insert(end_mmer, i - ptr.signature_len + 1);
 				if (end_mmer < current_signature)//signature at the end of current k-mer is lower than current
 				{
 					if (len >= ptr.kmer_len)
@@ -618,20 +601,9 @@ bool CSplitter_Impl<false>::ProcessReads(CSplitter<false> &ptr, uchar *_part, ui
 					bin_no = ptr.s_mapper->get_bin_id(current_signature.get());
 					ptr.bins[bin_no]->PutExtendedKmer(seq + i - len, len);
 					len = ptr.kmer_len - 1;
-					//looking for new signature
-					++signature_start_pos;
-					//building first signature in current k-mer
-					end_mmer.insert(seq + signature_start_pos);
-					current_signature.set(end_mmer);
-					for (uint32 j = signature_start_pos + ptr.signature_len; j <= i; ++j)
-					{
-						end_mmer.insert(seq[j]);
-						if (end_mmer <= current_signature)
-						{
-							current_signature.set(end_mmer);
-							signature_start_pos = j - ptr.signature_len + 1;
-						}
-					}
+					//looking for new signature: the lowest m-mer in current k-mer
+					signature_start_pos = window.find_min(signature_start_pos + 1, i - ptr.signature_len + 1);
+					current_signature.insert(seq + signature_start_pos);
 				}
 				++len;
 				if (len == ptr.kmer_len + 255) //one byte is used to store counter of additional symbols in extended k-mer
@@ -679,7 +651,8 @@ bool CSplitter_Impl<true>::ProcessReads(CSplitter<true> &ptr, uchar *_part, uint
 	uint32 seq_size;
 
 	uint32 signature_start_pos;
-	CMmer current_signature(ptr.signature_len), end_mmer(ptr.signature_len);
+	CMmer current_signature(ptr.signature_len, ptr.sig_order), end_mmer(ptr.signature_len, ptr.sig_order);
+	CMmerWindow window(ptr.kmer_len - ptr.signature_len + 1);
 	uint32 bin_no;
 
 	uint32 i;
@@ -713,6 +686,7 @@ bool CSplitter_Impl<true>::ProcessReads(CSplitter<true> &ptr, uchar *_part, uint
 			signature_start_pos = i - ptr.signature_len;
 			current_signature.insert(seq + signature_start_pos);
 			end_mmer.set(current_signature);
+			window.insert(current_signature, signature_start_pos);
 			for (; i < seq_size; ++i)
 			{
 				if (seq[i] < 0)//'N'
@@ -727,6 +701,7 @@ bool CSplitter_Impl<true>::ProcessReads(CSplitter<true> &ptr, uchar *_part, uint
 					break;
 				}
 				end_mmer.insert(seq[i]);
+				window.insert(end_mmer, i - ptr.signature_len + 1);
 				if (end_mmer < current_signature)//signature at the end of current k-mer is lower than current
 				{
 					if (len >= ptr.kmer_len)
@@ -748,20 +723,9 @@ bool CSplitter_Impl<true>::ProcessReads(CSplitter<true> &ptr, uchar *_part, uint
 					bin_no = ptr.s_mapper->get_bin_id(current_signature.get());
 					ptr.bins[bin_no]->PutExtendedKmer(seq + i - len, quals + i - len, len);
 					len = ptr.kmer_len - 1;
-					//looking for new signature
-					++signature_start_pos;
-					//building first signature in current k-mer
-					end_mmer.insert(seq + signature_start_pos);
-					current_signature.set(end_mmer);
-					for (uint32 j = signature_start_pos + ptr.signature_len; j <= i; ++j)
-					{
-						end_mmer.insert(seq[j]);
-						if (end_mmer <= current_signature)
-						{
-							current_signature.set(end_mmer);
-							signature_start_pos = j - ptr.signature_len + 1;
-						}
-					}
+					//looking for new signature: the lowest m-mer in current k-mer
+					signature_start_pos = window.find_min(signature_start_pos + 1, i - ptr.signature_len + 1);
+					current_signature.insert(seq + signature_start_pos);
 				}
 				++len;
 				if (len == ptr.kmer_len + 255) //one byte is used to store counter of additional symbols in extended k-mer
@@ -839,10 +803,14 @@ template <bool QUAKE_MODE> void CWSplitter<QUAKE_MODE>::operator()()
 	{
 		uchar *part;
 		uint64 size;
-		if(pq->pop(part, size))
+		CMappedFile *mapped;
+		if(pq->pop(part, size, mapped))
 		{
 			spl->ProcessReads(part, size);
-			pmm_fastq->free(part);
+			if(mapped)
+				mapped->ReleaseView(part, size);
+			else
+				pmm_fastq->free(part);
 		}
 	}
 	spl->Complete();
@@ -877,6 +845,7 @@ template <bool QUAKE_MODE> class CWStatsSplitter {
 	uint32 *stats;
 	CSplitter<QUAKE_MODE> *spl;
 	uint32 signature_len;
+	uint32 stats_size;
 
 public:
 	CWStatsSplitter(CKMCParams &Params, CKMCQueues &Queues);
@@ -896,8 +865,9 @@ template <bool QUAKE_MODE> CWStatsSplitter<QUAKE_MODE>::CWStatsSplitter(CKMCPara
 	spl = new CSplitter<QUAKE_MODE>(Params, Queues);
 	
 	signature_len = Params.signature_len;
+	stats_size = Params.mem_part_pmm_stats / sizeof(uint32);
 	pmm_stats->reserve(stats);
-	fill_n(stats, (1 << signature_len * 2) + 1, 0);
+	fill_n(stats, stats_size, 0);
 }
 
 //----------------------------------------------------------------------------------
@@ -916,10 +886,14 @@ template <bool QUAKE_MODE> void CWStatsSplitter<QUAKE_MODE>::operator()()
 	{
 		uchar *part;
 		uint64 size;
-		if (spq->pop(part, size))
+		CMappedFile *mapped;
+		if (spq->pop(part, size, mapped))
 		{
 			spl->CalcStats(part, size, stats);
-			pmm_fastq->free(part);
+			if (mapped)
+				mapped->ReleaseView(part, size);
+			else
+				pmm_fastq->free(part);
 		}
 	}
 
@@ -930,8 +904,7 @@ template <bool QUAKE_MODE> void CWStatsSplitter<QUAKE_MODE>::operator()()
 //----------------------------------------------------------------------------------
 template <bool QUAKE_MODE> void CWStatsSplitter<QUAKE_MODE>::GetStats(uint32* _stats)
 {
-	uint32 size = (1 << signature_len * 2) + 1;
-	for (uint32 i = 0; i < size; ++i)
+	for (uint32 i = 0; i < stats_size; ++i)
 		_stats[i] += stats[i];
 }
 
@@ -0,0 +1,146 @@
+#include "stdafx.h"
+/*
+  This file is a part of KMC software distributed under GNU GPL 3 licence.
+  The homepage of the KMC project is http://sun.aei.polsl.pl/kmc
+
+  Authors: Sebastian Deorowicz, Agnieszka Debudaj-Grabysz, Marek Kokot
+
+  Version: 2.0
+  Date   : 2014-07-04
+*/
+
+#include "task_pool.h"
+
+//----------------------------------------------------------------------------------
+CTaskPool::CTaskPool(uint32 _n_workers, uint32 n_clients)
+{
+	n_workers	 = _n_workers;
+	n_queued	 = 0;
+	is_completed = false;
+
+	slots.resize(n_workers + n_clients);
+	for(auto p = slots.begin(); p != slots.end(); ++p)
+		*p = new CSlot;
+
+	for(uint32 i = 0; i < n_workers; ++i)
+		workers.push_back(thread(&CTaskPool::WorkerLoop, this, i));
+}
+
+//----------------------------------------------------------------------------------
+CTaskPool::~CTaskPool()
+{
+	unique_lock<mutex> lck(mtx);
+	is_completed = true;
+	cv.notify_all();
+	lck.unlock();
+
+	for(auto p = workers.begin(); p != workers.end(); ++p)
+		p->join();
+	for(auto p = slots.begin(); p != slots.end(); ++p)
+		delete *p;
+}
+
+//----------------------------------------------------------------------------------
+// Add a task to the deque of the participant
+void CTaskPool::Run(uint32 slot_id, CTaskGroup &group, task_t task)
+{
+	unique_lock<mutex> lck(mtx);
+	++group.n_pending;
+	lck.unlock();
+
+	CSlot *slot = slots[slot_id];
+	slot->mtx.lock();
+	slot->q.push_back(make_pair(task, &group));
+	slot->mtx.unlock();
+
+	// The task is counted only once it can be found in the deque
+	lck.lock();
+	++n_queued;
+	cv.notify_one();
+}
+
+//----------------------------------------------------------------------------------
+// Wait until all the tasks of the group are finished; execute any tasks meanwhile
+void CTaskPool::Wait(uint32 slot_id, CTaskGroup &group)
+{
+	elem_t elem;
+
+	while(true)
+	{
+		unique_lock<mutex> lck(mtx);
+		cv.wait(lck, [&]{return !group.n_pending || this->n_queued;});
+		if(!group.n_pending)
+			return;
+		--n_queued;
+		lck.unlock();
+
+		Take(slot_id, elem);
+		Execute(elem);
+	}
+}
+
+//----------------------------------------------------------------------------------
+// Take own task from the back of the deque or steal one from the front of other deques
+// The caller has already claimed a task by decrementing n_queued, so the deques hold at least one task
+// for it (a pass can only miss it if a task was pushed behind the scan and another one taken before it)
+void CTaskPool::Take(uint32 slot_id, elem_t &elem)
+{
+	bool found = false;
+
+	while(!found)
+	{
+		CSlot *slot = slots[slot_id];
+		slot->mtx.lock();
+		if(!slot->q.empty())
+		{
+			elem = slot->q.back();
+			slot->q.pop_back();
+			found = true;
+		}
+		slot->mtx.unlock();
+
+		for(uint32 i = 1; i < slots.size() && !found; ++i)
+		{
+			CSlot *victim = slots[(slot_id + i) % slots.size()];
+			victim->mtx.lock();
+			if(!victim->q.empty())
+			{
+				elem = victim->q.front();
+				victim->q.pop_front();
+				found = true;
+			}
+			victim->mtx.unlock();
+		}
+	}
+}
+
+//----------------------------------------------------------------------------------
+void CTaskPool::Execute(elem_t &elem)
+{
+	elem.first();
+
+	lock_guard<mutex> lck(mtx);
+	if(--elem.second->n_pending == 0)
+		cv.notify_all();
+}
+
+//----------------------------------------------------------------------------------
+void CTaskPool::WorkerLoop(uint32 slot_id)
+{
+	elem_t elem;
+
+	while(true)
+	{
+		unique_lock<mutex> lck(mtx);
+		cv.wait(lck, [this]{return this->n_queued || this->is_completed;});
+		if(!n_queued)
+			return;
+		--n_queued;
+		lck.unlock();
+
+		Take(slot_id, elem);
+		Execute(elem);
+	}
+}
+
+// ***** EOF
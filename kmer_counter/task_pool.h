@@ -0,0 +1,94 @@
+/*
+  This file is a part of KMC software distributed under GNU GPL 3 licence.
+  The homepage of the KMC project is http://sun.aei.polsl.pl/kmc
+
+  Authors: Sebastian Deorowicz, Agnieszka Debudaj-Grabysz, Marek Kokot
+
+  Version: 2.0
+  Date   : 2014-07-04
+*/
+
+#ifndef _TASK_POOL_H
+#define _TASK_POOL_H
+
+#include "defs.h"
+#include <vector>
+#include <deque>
+#include <functional>
+
+using namespace std;
+
+#ifdef THREADS_NATIVE			// C++11 threads
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+
+using std::thread;
+#else							// Boost threads
+#include <boost/thread.hpp>
+#include <boost/thread/mutex.hpp>
+#include <boost/thread/condition_variable.hpp>
+
+using namespace boost;
+#endif
+
+//************************************************************************************************************
+// CTaskGroup - tasks of a single parallel step (e.g., a radix sort pass of a bin) to wait for
+//************************************************************************************************************
+class CTaskGroup {
+	uint64 n_pending;
+
+	friend class CTaskPool;
+
+public:
+	CTaskGroup() { n_pending = 0; }
+};
+
+//************************************************************************************************************
+// CTaskPool - work-stealing pool of threads shared by the sorters in stage 2
+// Each participant (a pool thread or a sorter) has its own deque of tasks. Own tasks are taken from the back,
+// an idle participant steals from the fronts of the others. A sorter waiting for its tasks executes tasks
+// of any bin meanwhile, so all the threads are busy until the last bin is sorted.
+//************************************************************************************************************
+class CTaskPool {
+public:
+	typedef function<void()> task_t;
+
+private:
+	typedef pair<task_t, CTaskGroup*> elem_t;
+
+	struct CSlot {
+		mutex mtx;
+		deque<elem_t> q;
+	};
+
+	uint32 n_workers;
+	vector<CSlot*> slots;				// pool threads first, then the sorters
+	vector<thread> workers;
+
+	uint64 n_queued;					// tasks in the deques not claimed by any thread yet
+	bool is_completed;
+
+	mutex mtx;
+	condition_variable cv;
+
+	void Take(uint32 slot_id, elem_t &elem);
+	void Execute(elem_t &elem);
+	void WorkerLoop(uint32 slot_id);
+
+public:
+	CTaskPool(uint32 _n_workers, uint32 n_clients);
+	~CTaskPool();
+
+	// No. of threads executing the tasks (including the sorters)
+	uint32 NoThreads() { return (uint32) slots.size(); }
+	// Slot of a sorter
+	uint32 ClientSlot(uint32 client_id) { return n_workers + client_id; }
+
+	void Run(uint32 slot_id, CTaskGroup &group, task_t task);
+	void Wait(uint32 slot_id, CTaskGroup &group);
+};
+
+#endif
+
+// ***** EOF
@@ -0,0 +1,208 @@
+#include "stdafx.h"
+/*
+  This file is a part of KMC software distributed under GNU GPL 3 licence.
+  The homepage of the KMC project is http://sun.aei.polsl.pl/kmc
+
+  Authors: Sebastian Deorowicz, Agnieszka Debudaj-Grabysz, Marek Kokot
+
+  Version: 2.0
+  Date   : 2014-07-04
+*/
+
+#include "tmp_store.h"
+#include <iostream>
+
+#ifndef WIN32
+#include <fcntl.h>
+#include <unistd.h>
+#include <limits.h>
+#include <sys/uio.h>
+
+#ifndef IOV_MAX
+#define IOV_MAX 1024
+#endif
+#endif
+
+//----------------------------------------------------------------------------------
+CTmpStore::CTmpStore(const string &_file_name, uint64 initial_size)
+{
+	file_name = _file_name;
+	fd		  = -1;
+	file	  = NULL;
+	end		  = 0;
+	allocated = 0;
+	prealloc_failed = false;
+
+#ifdef WIN32
+	file = fopen(file_name.c_str(), "wb+");
+	if(file)
+		setbuf(file, nullptr);
+	if(!file)
+#else
+	fd = open(file_name.c_str(), O_RDWR | O_CREAT | O_TRUNC, 0644);
+	if(fd < 0)
+#endif
+	{
+		cout << "Error: Cannot open temporary file " << file_name << "\n";
+		exit(1);
+	}
+
+	Allocate(initial_size);
+}
+
+//----------------------------------------------------------------------------------
+CTmpStore::~CTmpStore()
+{
+#ifdef WIN32
+	if(file)
+		fclose(file);
+#else
+	if(fd >= 0)
+		close(fd);
+#endif
+}
+
+//----------------------------------------------------------------------------------
+// Preallocate the file up to the given size, so that it consists of few large extents of the file system
+void CTmpStore::Allocate(uint64 size)
+{
+	if(size <= allocated || prealloc_failed)
+		return;
+#ifndef WIN32
+	// Not all file systems support preallocation; the file grows with writes then
+	if(posix_fallocate(fd, allocated, size - allocated) != 0)
+	{
+		prealloc_failed = true;
+		return;
+	}
+#endif
+	allocated = size;
+}
+
+//----------------------------------------------------------------------------------
+// Reserve an extent for a write of a bin; returns its offset
+uint64 CTmpStore::Reserve(uint64 size)
+{
+	lock_guard<mutex> lck(mtx);
+	uint64 offset = end;
+	end += size;
+	if(end > allocated)
+		Allocate(MAX(end, allocated + TMP_STORE_GROWTH));
+
+	return offset;
+}
+
+//----------------------------------------------------------------------------------
+bool CTmpStore::Write(uint64 offset, const uchar *data, uint64 size)
+{
+#ifdef WIN32
+	lock_guard<mutex> lck(mtx);
+	my_fseek(file, offset, SEEK_SET);
+	return fwrite(data, 1, size, file) == size;
+#else
+	for(uint64 pos = 0; pos < size; )
+	{
+		ssize_t w = pwrite(fd, data + pos, size - pos, offset + pos);
+		if(w <= 0)
+			return false;
+		pos += w;
+	}
+	return true;
+#endif
+}
+
+//----------------------------------------------------------------------------------
+// Gather write of parts to a single extent
+bool CTmpStore::WriteParts(uint64 offset, const vector<pair<uchar*, uint64>> &parts)
+{
+#ifdef WIN32
+	for(auto& p : parts)
+	{
+		if(!Write(offset, p.first, p.second))
+			return false;
+		offset += p.second;
+	}
+	return true;
+#else
+	uint64 size = 0;
+	for(auto& p : parts)
+		size += p.second;
+	return WriteGathered(fd, parts, (int64) offset) == size;
+#endif
+}
+
+//----------------------------------------------------------------------------------
+// Read a range of an extent; returns the number of bytes read
+uint64 CTmpStore::Read(uint64 offset, uchar *data, uint64 size)
+{
+#ifdef WIN32
+	lock_guard<mutex> lck(mtx);
+	my_fseek(file, offset, SEEK_SET);
+	return fread(data, 1, size, file);
+#else
+	uint64 pos = 0;
+	while(pos < size)
+	{
+		ssize_t r = pread(fd, data + pos, size - pos, offset + pos);
+		if(r <= 0)
+			break;
+		pos += r;
+	}
+	return pos;
+#endif
+}
+
+//----------------------------------------------------------------------------------
+// Tell the OS that an extent will be read soon (it is read in the background) or is no longer needed
+void CTmpStore::Advise(uint64 offset, uint64 size, bool will_need)
+{
+#if !defined(WIN32) && defined(POSIX_FADV_WILLNEED)
+	posix_fadvise(fd, offset, size, will_need ? POSIX_FADV_WILLNEED : POSIX_FADV_DONTNEED);
+#endif
+}
+
+#ifndef WIN32
+//----------------------------------------------------------------------------------
+// Gather write of parts to a file at the given offset (or at its current position if offset < 0)
+// Returns the number of bytes written
+uint64 WriteGathered(int fd, const vector<pair<uchar*, uint64>> &parts, int64 offset)
+{
+	uint64 written = 0;
+	vector<iovec> iov;
+	iov.reserve(MIN(parts.size(), (size_t) IOV_MAX));
+	for(size_t i = 0; i < parts.size(); )
+	{
+		iov.clear();
+		for(; i < parts.size() && iov.size() < IOV_MAX; ++i)
+		{
+			iovec v;
+			v.iov_base = parts[i].first;
+			v.iov_len  = parts[i].second;
+			iov.push_back(v);
+		}
+
+		// Short writes are continued from the first part not written completely
+		for(size_t j = 0; j < iov.size(); )
+		{
+			ssize_t w;
+			if(offset < 0)
+				w = writev(fd, &iov[j], (int) (iov.size() - j));
+			else
+				w = pwritev(fd, &iov[j], (int) (iov.size() - j), offset + written);
+			if(w <= 0)
+				return written;
+			written += w;
+			for(; j < iov.size() && (size_t) w >= iov[j].iov_len; ++j)
+				w -= iov[j].iov_len;
+			if(j < iov.size())
+			{
+				iov[j].iov_base = (uchar *) iov[j].iov_base + w;
+				iov[j].iov_len -= w;
+			}
+		}
+	}
+	return written;
+}
+#endif
+
+// ***** EOF
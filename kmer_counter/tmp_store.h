@@ -0,0 +1,67 @@
+/*
+  This file is a part of KMC software distributed under GNU GPL 3 licence.
+  The homepage of the KMC project is http://sun.aei.polsl.pl/kmc
+
+  Authors: Sebastian Deorowicz, Agnieszka Debudaj-Grabysz, Marek Kokot
+
+  Version: 2.0
+  Date   : 2014-07-04
+*/
+
+#ifndef _TMP_STORE_H
+#define _TMP_STORE_H
+
+#include "defs.h"
+#include <string>
+#include <vector>
+#include <stdio.h>
+
+using namespace std;
+
+#ifdef THREADS_NATIVE			// C++11 threads
+#include <mutex>
+#else							// Boost threads
+#include <boost/thread/mutex.hpp>
+#include <boost/thread/locks.hpp>
+
+using namespace boost;
+#endif
+
+//************************************************************************************************************
+// CTmpStore - single preallocated file keeping the temporary bins of a working directory
+// Each write of a bin gets its own extent (a range of the file), so bins written in parallel do not fragment.
+// The file grows by large preallocated steps.
+//************************************************************************************************************
+class CTmpStore {
+	string file_name;
+	int fd;
+	FILE *file;							// used only in Windows
+	uint64 end;							// end of the last reserved extent
+	uint64 allocated;					// preallocated size of the file
+	bool prealloc_failed;				// the file system does not support preallocation
+
+	mutex mtx;
+
+	void Allocate(uint64 size);
+
+public:
+	CTmpStore(const string &_file_name, uint64 initial_size);
+	~CTmpStore();
+
+	const string &FileName() { return file_name; }
+	uint64 Size() { return end; }
+
+	uint64 Reserve(uint64 size);
+	bool Write(uint64 offset, const uchar *data, uint64 size);
+	bool WriteParts(uint64 offset, const vector<pair<uchar*, uint64>> &parts);
+	uint64 Read(uint64 offset, uchar *data, uint64 size);
+	void Advise(uint64 offset, uint64 size, bool will_need);
+};
+
+#ifndef WIN32
+uint64 WriteGathered(int fd, const vector<pair<uchar*, uint64>> &parts, int64 offset = -1);
+#endif
+
+#endif
+
+// ***** EOF